@@ -63,6 +63,16 @@ check_include_file(string.h HAVE_STRING_H)
 check_include_file(strings.h HAVE_STRINGS_H)
 check_include_file(sys/stat.h HAVE_SYS_STAT_H)
 check_include_file(sys/types.h HAVE_SYS_TYPES_H)
+check_include_file(sys/wait.h HAVE_SYS_WAIT_H)
+check_include_file(poll.h HAVE_POLL_H)
+check_include_file(sys/mman.h HAVE_SYS_MMAN_H)
+check_include_file(sys/socket.h HAVE_SYS_SOCKET_H)
+check_include_file(sys/un.h HAVE_SYS_UN_H)
+check_include_file(ucontext.h HAVE_UCONTEXT_H)
+check_include_file(dlfcn.h HAVE_DLFCN_H)
+check_include_file(fcntl.h HAVE_FCNTL_H)
+check_include_file(sys/syscall.h HAVE_SYS_SYSCALL_H)
+check_include_file(linux/perf_event.h HAVE_LINUX_PERF_EVENT_H)
 check_include_file(time.h HAVE_TIME_H)
 check_include_file(unistd.h HAVE_UNISTD_H)
 
@@ -86,6 +96,12 @@ check_function_exists(signal HAVE_SIGNAL)
 check_function_exists(strsignal HAVE_STRSIGNAL)
 check_function_exists(strcmp HAVE_STRCMP)
 check_function_exists(clock_gettime HAVE_CLOCK_GETTIME)
+check_function_exists(fork HAVE_FORK)
+check_function_exists(mprotect HAVE_MPROTECT)
+check_function_exists(sigaction HAVE_SIGACTION)
+check_function_exists(mmap HAVE_MMAP)
+check_function_exists(ftruncate HAVE_FTRUNCATE)
+check_function_exists(getcontext HAVE_GETCONTEXT)
 
 if (WIN32)
     check_function_exists(_vsnprintf_s HAVE__VSNPRINTF_S)
@@ -99,6 +115,13 @@ else (WIN32)
     check_function_exists(vsnprintf HAVE_VSNPRINTF)
 endif (WIN32)
 
+set(CMAKE_REQUIRED_LIBRARIES ${CMAKE_DL_LIBS})
+check_function_exists(dladdr HAVE_DLADDR)
+unset(CMAKE_REQUIRED_LIBRARIES)
+if (HAVE_DLADDR)
+    set(CMOCKA_BRANCHES_REQUIRED_LIBRARIES ${CMAKE_DL_LIBS} CACHE INTERNAL "cmocka_branches required system libraries")
+endif ()
+
 find_library(RT_LIBRARY rt)
 if (RT_LIBRARY AND NOT LINUX)
     set(CMOCKA_REQUIRED_LIBRARIES ${RT_LIBRARY} CACHE INTERNAL "cmocka required system libraries")
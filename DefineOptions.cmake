@@ -1,6 +1,7 @@
 option(WITH_STATIC_LIB "Build with a static library" OFF)
 option(WITH_CMOCKERY_SUPPORT "Install a cmockery header" OFF)
 option(UNIT_TESTING "Build with unit testing" OFF)
+option(WITH_FAULT_INJECTION "Build the --wrap and LD_PRELOAD fault injection libraries" ON)
 
 if (UNIT_TESTING)
     set(WITH_STATIC_LIB ON)
@@ -1,4 +1,6 @@
 # - ADD_CMOCKA_TEST(test_name test_source linklib1 ... linklibN)
+# - ADD_CMOCKA_SHARDED_TEST(test_name num_shards plan)
+#   Adds test_name_shard0 ... to CTest, each exploring its shard of the plan
 
 # Copyright (c) 2007      Daniel Gollub <dgollub@suse.de>
 # Copyright (c) 2007-2010 Andreas Schneider <asn@cynapses.org>
@@ -21,3 +23,12 @@ function (ADD_CMOCKA_TEST _testName _testSource)
     target_link_libraries(${_testName} ${ARGN})
     add_test(${_testName} ${CMAKE_CURRENT_BINARY_DIR}/${_testName})
 endfunction (ADD_CMOCKA_TEST)
+
+function (ADD_CMOCKA_SHARDED_TEST _testName _numShards _plan)
+    math(EXPR _lastShard "${_numShards} - 1")
+    foreach(_shard RANGE ${_lastShard})
+        add_test(${_testName}_shard${_shard} ${CMAKE_CURRENT_BINARY_DIR}/${_testName})
+        set_tests_properties(${_testName}_shard${_shard} PROPERTIES ENVIRONMENT
+            "CMOCKA_BRANCHES_SHARD_PLAN=${_plan};CMOCKA_BRANCHES_SHARD=${_shard};CMOCKA_BRANCHES_TIMINGS=${CMAKE_CURRENT_BINARY_DIR}/${_testName}_shard${_shard}.timings")
+    endforeach()
+endfunction (ADD_CMOCKA_SHARDED_TEST)
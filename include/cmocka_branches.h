@@ -17,6 +17,11 @@
 #define CMOCKA_BRANCHES_H_
 
 #include "cmocka.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #ifndef DOXYGEN
 unsigned int _branch_start(const char* const name, unsigned int num_twigs, char const * const * const twig_names, const char* const file, const int line, const char* const function_name);
@@ -103,23 +108,24 @@ struct CMBUnitTestWrapper {
     CMUnitTestFunction test_func;
     CMFixtureFunction  teardown_func;
     void *initial_inner_state;
+    const char *test_name;
 };
 
 /** Initializes a CMUnitTest structure. 
   * This version of the function sets up the test to be used with branch_start & branch_end
   */
-#define cmocka_unit_test_twigs(f) { #f, _branch_test_wrapper, NULL, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), NULL, NULL }))}
+#define cmocka_unit_test_twigs(f) { #f, _branch_test_wrapper, NULL, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), NULL, NULL, #f }))}
 
 /** Initializes a CMUnitTest structure with a setup function. 
   *
   * This version of the function sets up the test to be used with branch_start & branch_end
   */
-#define cmocka_unit_test_setup_twigs(f, setup) { #f, _branch_test_wrapper, setup, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), NULL, NULL }))}
+#define cmocka_unit_test_setup_twigs(f, setup) { #f, _branch_test_wrapper, setup, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), NULL, NULL, #f }))}
 
 /** Initializes a CMUnitTest structure with a teardown function. 
  *
  * This version of the function sets up the test to be used with branch_start & branch_end*/
-#define cmocka_unit_test_teardown_twigs(f, teardown) { #f, _branch_test_wrapper, NULL, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), (teardown), NULL }))}
+#define cmocka_unit_test_teardown_twigs(f, teardown) { #f, _branch_test_wrapper, NULL, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), (teardown), NULL, #f }))}
 
 /**
  * Initialize an array of CMUnitTest structures with a setup function for a test
@@ -127,7 +133,7 @@ struct CMBUnitTestWrapper {
  *
  * This version of the function sets up the test to be used with branch_start & branch_end
  */
-#define cmocka_unit_test_setup_teardown_twigs(f, setup, teardown) { #f, _branch_test_wrapper, setup, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), (teardown), NULL }))}
+#define cmocka_unit_test_setup_teardown_twigs(f, setup, teardown) { #f, _branch_test_wrapper, setup, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), (teardown), NULL, #f }))}
 
 /**
  * Initialize a CMUnitTest structure with given initial state. It will be passed
@@ -138,7 +144,7 @@ struct CMBUnitTestWrapper {
  *
  * This version of the function sets up the test to be used with branch_start & branch_end
  */
-#define cmocka_unit_test_prestate_twigs(f, state) { #f, _branch_test_wrapper, NULL, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), NULL, NULL }))}
+#define cmocka_unit_test_prestate_twigs(f, state) { #f, _branch_test_wrapper, NULL, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), NULL, NULL, #f }))}
 
 /**
  * Initialize a CMUnitTest structure with given initial state, setup and
@@ -149,7 +155,7 @@ struct CMBUnitTestWrapper {
  *
  * This version of the function sets up the test to be used with branch_start & branch_end
  */
-#define cmocka_unit_test_prestate_setup_teardown_twigs(f, setup, teardown, state) { #f, _branch_test_wrapper, setup, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), (teardown), state }))}
+#define cmocka_unit_test_prestate_setup_teardown_twigs(f, setup, teardown, state) { #f, _branch_test_wrapper, setup, _branch_teardown_wrapper, (void*) (&((const struct CMBUnitTestWrapper){ (f), (teardown), state, #f }))}
 
 /* API for use without the CMOCKA test runner */
 
@@ -160,7 +166,8 @@ typedef void (*BranchInnerFunction)(void *state);
 /**
  * Wrap a custom function for use with branches. This function should be used to wrap any function that calls branch_start and branch_end (when not using cmocka).
  * The wrapped function will be called repetitively until all branch combinations are executed.
- * This function cannot be used recursively.
+ * This function explores in the current context (see branch_context_switch). To explore from
+ * within an exploration, use branch_context_run with another context.
 
  * @param State: Forwarded to the inner func - function.
  */
@@ -169,6 +176,14 @@ void _branch_custom_func_wrapper(BranchInnerFunction func, void *state);
 
 #define branch_custom_func_wrapper(func, state) (_branch_custom_func_wrapper(func,state))
 
+/**
+ * Same as branch_custom_func_wrapper, but with a test name used to key information that is kept
+ * between test runs, like the failure history (see branch_set_history_file).
+ */
+void _branch_custom_func_wrapper_named(const char *test_name, BranchInnerFunction func, void *state);
+
+#define branch_custom_func_wrapper_named(test_name, func, state) (_branch_custom_func_wrapper_named(test_name, func, state))
+
 /*
  * This function prints the current path for branches that are executing.
    This function is primarily intended for error handling to report in which branch combination an error occurred.
@@ -177,6 +192,567 @@ void _branch_print_current_path( void );
 
 #define branch_print_current_path() (_branch_print_current_path());
 
+/* Per combination heap accounting */
+
+void *_branch_test_malloc(const size_t size, const char *file, const int line);
+void *_branch_test_calloc(const size_t number_of_elements, const size_t size, const char *file, const int line);
+void *_branch_test_realloc(void *ptr, const size_t size, const char *file, const int line);
+void _branch_test_free(void * const ptr, const char *file, const int line);
+
+/*
+ * Define CMOCKA_BRANCHES_HEAP_ACCOUNTING before including this header to route the cmocka test
+ * allocators through the branch allocators. These record bytes allocated, peak live bytes and
+ * leaked bytes for every branch combination, and attribute them to the twigs of the combination.
+ * At the end of the test, twigs whose peak is far above their siblings and twigs that leak
+ * while their siblings don't are reported.
+ */
+#ifdef CMOCKA_BRANCHES_HEAP_ACCOUNTING
+#undef test_malloc
+#undef test_calloc
+#undef test_realloc
+#undef test_free
+#define test_malloc(size) _branch_test_malloc(size, __FILE__, __LINE__)
+#define test_calloc(num, size) _branch_test_calloc(num, size, __FILE__, __LINE__)
+#define test_realloc(ptr, size) _branch_test_realloc(ptr, size, __FILE__, __LINE__)
+#define test_free(ptr) _branch_test_free(ptr, __FILE__, __LINE__)
+#endif
+
+/**
+ * Fail the test at the allocation that takes a single branch combination above max_peak_bytes
+ * allocated through the branch allocators. The limit holds until the end of the exploration it is
+ * set in or for, set to 0 (the default) to disable it.
+ */
+void branch_set_heap_limit(const size_t max_peak_bytes);
+
+/* Fills the size bytes of data, which start zeroed, see branch_memo */
+typedef void (*BranchMemoInit)(void *data, const size_t size, void *arg);
+
+void *_branch_memo(const char* const key, const size_t size, BranchMemoInit init, void *arg, const char* const file, const int line);
+
+/*
+ * Data of size bytes kept for the rest of the exploration under the string key, so expensive pure
+ * data such as key schedules or reference buffers is computed by init(data, size, arg) once instead
+ * of in every combination. The data must not be changed by the test. Hits, misses and evictions
+ * are reported at the end of the test.
+ */
+#define branch_memo(key, size, init, arg) _branch_memo(key, size, init, arg, __FILE__, __LINE__)
+
+/**
+ * Limit the memoized data of an exploration to about bytes, evicting the least recently used
+ * entries not used by the current combination. 0 (the default) keeps all entries. Without a call,
+ * the limit in the CMOCKA_BRANCHES_MEMO_LIMIT environment variable is used.
+ */
+void branch_set_memo_limit(const size_t bytes);
+
+/**
+ * Set the file used to remember which twigs were part of failing combinations in recent runs,
+ * keyed by test name and branch call site. Twigs that failed recently are explored first, so a
+ * known regression is hit by one of the first combinations. All combinations are still explored.
+ * If not set, the CMOCKA_BRANCHES_HISTORY_FILE environment variable is used. Pass NULL to fall
+ * back to the environment variable again.
+ */
+void branch_set_history_file(const char *path);
+
+/**
+ * Set the file used for incremental exploration. Every combination of a passing test is recorded
+ * with the branch call sites it visited and a fingerprint of the source files containing them and
+ * the build id (see branch_set_incremental_build_id). On the next run, combinations whose
+ * fingerprint is unchanged are replayed from the file instead of executing the test function, as
+ * long as the combinations executed before them matched the recorded run. A changed source file
+ * only executes the combinations that visited one of its branch call sites again.
+ * If not set, the CMOCKA_BRANCHES_CACHE_FILE environment variable is used. Pass NULL to fall
+ * back to the environment variable again.
+ */
+void branch_set_incremental_cache(const char *path);
+
+/**
+ * Identify the build of the code under test, for example by a hash of its sources or libraries,
+ * so that the incremental cache notices changes in code without branch call sites. A new build id
+ * executes every combination again. If not set, the
+ * CMOCKA_BRANCHES_BUILD_ID environment variable is used. Pass NULL to fall back to the
+ * environment variable again.
+ */
+void branch_set_incremental_build_id(const char *build_id);
+
+/**
+ * Execute every combination even if it could be replayed from the incremental cache, and record
+ * them for the next run. Setting the CMOCKA_BRANCHES_FULL_RUN environment variable to 1 does the same.
+ */
+void branch_set_incremental_full_run(const int full_run);
+
+/**
+ * Write the explored tree of every branch test to <path_prefix><test name>.dot and .json, with the
+ * number of passed and failed combinations and the execution time below each twig. Subtrees deeper
+ * than max_depth are collapsed into their size, 0 exports the complete tree. Without a call, the
+ * CMOCKA_BRANCHES_EXPORT and CMOCKA_BRANCHES_EXPORT_DEPTH environment variables are used.
+ */
+void branch_set_tree_export(const char *path_prefix, const unsigned int max_depth);
+
+/**
+ * Run the combinations of every branch test in forked child processes, batch_size combinations per
+ * child, so a crash or hang only fails the combination it happened in. Combinations running longer
+ * than timeout_ms are killed, 0 disables the timeout. The exploration continues after a failing
+ * combination, and the test fails at the end. A batch_size of 0 runs the combinations in the test
+ * process. Without a call, the CMOCKA_BRANCHES_ISOLATION and CMOCKA_BRANCHES_TIMEOUT environment
+ * variables are used.
+ */
+void branch_set_isolation(const unsigned int batch_size, const unsigned int timeout_ms);
+
+/**
+ * Free the subtrees below a twig as soon as the exploration moves on to the next twig, so memory
+ * grows with the depth and width of the tree instead of its number of combinations. Subtrees that
+ * are entered again are rediscovered from their first twig, which can add combinations to the
+ * exploration. Branch points that are still held, on the current path and directly below its twigs,
+ * are checked against earlier runs as usual. Those of a freed subtree are not compared with the run
+ * that discovered them, so a branch structure that changes between runs goes unnoticed there.
+ * The exported tree only holds what was not freed. Setting the CMOCKA_BRANCHES_STREAMING
+ * environment variable to 1 does the same.
+ */
+void branch_set_streaming(const int enabled);
+
+/**
+ * Register a memory region, for example a state struct or the static data of a module, that is
+ * restored before every combination to its contents at the start of the branch test. Larger regions
+ * are write protected between restores, so only the pages that were written are copied back.
+ */
+void branch_register_state(void *address, const size_t size);
+
+/**
+ * Stop restoring the region registered at address.
+ */
+void branch_unregister_state(void *address);
+
+/**
+ * Disable the write protection of registered regions, for state that is written by system calls or
+ * other code that can't take a page fault. The regions are then copied completely before every
+ * combination. Applies to regions registered after the call.
+ */
+void branch_set_state_tracking(const int enabled);
+
+/* Fault injection into wrapped library calls, see cmocka_branches_wrap and cmocka_branches_preload */
+
+/**
+ * Decides if a wrapped call to function, made from the caller return address, is a fault point.
+ * Return nonzero to explore both the succeeding call and a failing one, which returns the error
+ * value of the function with errno set to *error. The filter can change *error.
+ */
+typedef int (*BranchFaultFilter)(const char *function, const void *caller, int *error, void *data);
+
+/**
+ * Use filter to choose the call sites of wrapped functions that become two twig branch points. Without
+ * a filter, the functions listed in the comma separated CMOCKA_BRANCHES_FAULTS environment variable
+ * are used, "*" selects all. Fault points only exist while a branch combination runs.
+ */
+void branch_set_fault_filter(BranchFaultFilter filter, void *data);
+
+/* Set while fault points are active, checked by the wrappers before calling _branch_fault_point */
+extern int _branch_fault_injection_active;
+
+int _branch_fault_point(const char *function, const void *caller, int *error);
+
+/**
+ * Count instructions, cycles, cache misses, page faults and context switches of every combination
+ * with perf_event_open, and attribute them to its twigs. Cycles fall back to the task clock in
+ * nanoseconds when hardware counters are not available. At the end of the test, twigs whose
+ * average counts are far above their siblings are printed, and the tree export includes the
+ * counts. Without a call, CMOCKA_BRANCHES_PERF=1 enables the counters.
+ */
+void branch_set_perf_counters(const int enabled);
+
+/**
+ * Publish the progress of every exploration in a memory mapped block at path, for watching long
+ * explorations with the cmocka_branches_monitor tool. The layout is in cmocka_branches_monitor.h.
+ * Without a call, the path in the CMOCKA_BRANCHES_MONITOR environment variable is used.
+ */
+void branch_set_monitor_file(const char *path);
+
+/**
+ * Record branch starts and ends, combination boundaries, failures and restarts with their times in
+ * an event trace at path, see cmocka_branches_trace.h. Each thread buffers its events and appends
+ * them to the file in chunks. Convert the trace for a trace viewer with cmocka_branches_trace.
+ * Without a call, the path in the CMOCKA_BRANCHES_TRACE environment variable is used.
+ */
+void branch_set_trace_file(const char *path);
+
+/* Pruning of infeasible combinations */
+
+/**
+ * Abandon the current branch combination if cond is false. The combination is counted as pruned
+ * instead of passed or failed, and the exploration continues with the next one. The prune leaves
+ * the test with a longjmp, so a false assumption fails the test while a branch point started with a
+ * BranchSite, such as a C++ branch scope, is open.
+ */
+#define branch_assume(cond) _branch_assume(!!(cond), #cond, __FILE__, __LINE__)
+
+void _branch_assume(const int condition, const char *expression, const char *file, const int line);
+
+/*
+ * Twig twig of the branch named branch can't be combined with twig excluded_twig of excluded_branch.
+ * A side with a file only applies to the branch point at that file and line, the file matches the
+ * end of the path of the point. Without a file, every branch point with the name is meant.
+ */
+typedef struct BranchExclusion {
+    const char *branch;
+    unsigned int twig;
+    const char *excluded_branch;
+    unsigned int excluded_twig;
+    const char *file;
+    int line;
+    const char *excluded_file;
+    int excluded_line;
+} BranchExclusion;
+
+/**
+ * Set the exclusions of the current context. A branch point skips the twigs that are excluded by a
+ * twig taken earlier in the combination, so combinations with an excluded pair are never started.
+ * A branch point without a twig left to take, or held at an excluded twig by a selected path or
+ * below an equivalent twig, prunes the combination there. The table must stay valid while it is used, NULL clears it.
+ */
+void branch_set_exclusions(const BranchExclusion *exclusions, const unsigned int num_exclusions);
+
+/* Exploration contexts */
+
+/*
+ * All state of an exploration (the branch tree, the position in it, statistics and settings) is kept
+ * in a context. Branch points and the functions above use the current context, which is a default
+ * context unless another one is made current. Explorations in different contexts are independent, so
+ * they can be nested or interleaved.
+ */
+typedef struct BranchContext BranchContext;
+
+typedef struct BranchContextStatus {
+    int running;                        /* An exploration is in progress */
+    unsigned long combinations;         /* Combinations run so far */
+    unsigned long failed_combinations;  /* Combinations that failed so far */
+    unsigned long pruned_combinations;  /* Combinations pruned so far, see branch_assume */
+    unsigned int nesting_level;         /* Branch points currently open */
+    unsigned long memo_hits;            /* Memo requests found, see branch_memo */
+    unsigned long memo_misses;          /* Memo requests initialized */
+    unsigned long memo_evictions;       /* Memo entries evicted over the limit */
+} BranchContextStatus;
+
+/**
+ * Create an empty context. Settings like branch_set_isolation apply to the current context, so
+ * switch to the context to configure it.
+ */
+BranchContext *branch_context_create(void);
+
+/**
+ * Free a context, ending its exploration if one is in progress.
+ */
+void branch_context_destroy(BranchContext *context);
+
+/**
+ * Make context current for the branch points and settings that follow, NULL selects the default
+ * context. Returns the context that was current, to switch back to.
+ */
+BranchContext *branch_context_switch(BranchContext *context);
+
+/**
+ * Explore all branch combinations of func in context, like branch_custom_func_wrapper_named. The
+ * current context is restored afterwards. Can be called from within another exploration.
+ */
+void branch_context_run(BranchContext *context, const char *test_name, BranchInnerFunction func, void *state);
+
+/**
+ * Run the next branch combination of func in context. Returns nonzero while combinations remain,
+ * so several explorations can be interleaved by calling this for each context in turn.
+ */
+int branch_context_run_one(BranchContext *context, const char *test_name, BranchInnerFunction func, void *state);
+
+/**
+ * Fill status with the progress of context, NULL queries the default context.
+ */
+void branch_context_status(BranchContext *context, BranchContextStatus *status);
+
+unsigned int _branch_start_context(BranchContext *context, const char* const name, unsigned int num_twigs, char const * const * const twig_names, const char* const file, const int line, const char* const function_name);
+void _branch_end_context(BranchContext *context, const char* const name, const char* const file, const int line, const char* const function_name);
+
+/* Branch points in an explicit context, regardless of the current one */
+#define branch_start_count_context(context, name, num_branchs, twig_names) \
+    _branch_start_context(context, name, num_branchs, twig_names, __FILE__, __LINE__, __func__)
+#define branch_end_named_context(context, name) \
+    _branch_end_context(context, name, __FILE__, __LINE__, __func__)
+
+/* Twig equivalence classes */
+
+unsigned int _branch_start_classes(const char* const name, unsigned int num_twigs, char const * const * const twig_names, const unsigned int *twig_classes, const char* const file, const int line, const char* const function_name);
+
+/*
+ * Branch point whose twigs are grouped into equivalence classes, twig_classes holding the class of
+ * each of the num_twigs twigs, for example several error codes that take the same abort path. The
+ * first twig of a class is its representative and is explored in full. Below the other twigs of
+ * the class every branch point is held at its first twig, or at a twig sampled with the seed set by
+ * branch_set_equivalence_seed. twig_classes must stay valid until the test ends.
+ */
+#define branch_start_classes(name, num_twigs, twig_names, twig_classes) \
+    _branch_start_classes(name, num_twigs, twig_names, twig_classes, __FILE__, __LINE__, __func__)
+
+/**
+ * Sample the twig taken by each branch point below a twig covered by its class representative with
+ * a generator seeded by seed. The same seed takes the same twigs. Without a call or with seed 0,
+ * the seed in the CMOCKA_BRANCHES_EQUIVALENCE_SEED environment variable is used, and without it
+ * the first twig is taken.
+ */
+void branch_set_equivalence_seed(const unsigned long seed);
+
+/* Value domain branches */
+
+/*
+ * Branch points over a range or list of values return the value of the twig instead of its index.
+ * Twigs of those with many values are created when they are first taken and freed again once
+ * they are explored, so very wide branches only hold the twigs on the current path and those with
+ * subbranches left to explore. These twigs are explored in value order, the failure history
+ * doesn't reorder them. branch_end_named(name) ends them like other branch points.
+ */
+long _branch_start_range(const char* const name, const long min, const long max, const long step, const char* const file, const int line, const char* const function_name);
+long _branch_start_values(const char* const name, const long *values, const unsigned int num_values, const char* const file, const int line, const char* const function_name);
+
+/* Branch into each of min, min + step, ... up to max, returning the value. The range needs 2 or more values */
+#define branch_start_range(name, min, max, step) \
+    _branch_start_range(name, min, max, step, __FILE__, __LINE__, __func__)
+/* Branch into each of the num_values values, returning the value. values must stay valid until the branch ends */
+#define branch_start_values(name, values, num_values) \
+    _branch_start_values(name, values, num_values, __FILE__, __LINE__, __func__)
+
+/* Batched branch points */
+
+#define BRANCH_BATCH_MAX_LANES 64
+
+/* Twigs a combination evaluates together, see branch_start_batch */
+typedef struct BranchBatch {
+    const char *name;
+    unsigned int first;                 /* Twig of lane 0, lane i evaluates twig first + i */
+    unsigned int lanes;                 /* Lanes of the combination, at most the width */
+    uint64_t mask;                      /* Bit i set for every lane of the combination */
+    uint64_t failed;                    /* Lanes that failed an assertion */
+    int started;
+    unsigned int path_start;            /* Position of the batched branch point in the path id */
+} BranchBatch;
+
+unsigned int _branch_start_batch(BranchBatch *batch, const char* const name, const unsigned int num_twigs, const unsigned int width,
+                                 const char* const file, const int line, const char* const function_name);
+void _branch_batch_fail_lane(BranchBatch *batch, const unsigned int lane, const char* const expression, const char* const file, const int line);
+void _branch_end_batch(BranchBatch *batch, const char* const file, const int line, const char* const function_name);
+
+/*
+ * Branch over num_twigs twigs, width (up to BRANCH_BATCH_MAX_LANES) of them per combination, for
+ * test bodies that evaluate several twigs at once. Fills batch with the twigs of the combination
+ * and returns the number of lanes. End it with branch_end_batch, which fails the combination if
+ * any lane failed and prints a path id per failed lane. In a path, the batch index of a batched
+ * branch point can be followed by +lane to run only that lane, for example 1.2+3.
+ */
+#define branch_start_batch(batch, name, num_twigs, width) \
+    _branch_start_batch(batch, name, num_twigs, width, __FILE__, __LINE__, __func__)
+#define branch_end_batch(batch) \
+    _branch_end_batch(batch, __FILE__, __LINE__, __func__)
+/* Twig of a lane */
+#define branch_batch_twig(batch, lane) ((batch)->first + (lane))
+/* Fail a lane when c is false, the other lanes go on and all failures are reported at branch_end_batch */
+#define assert_lane_true(batch, lane, c) \
+    do { if(!(c)) { _branch_batch_fail_lane(batch, lane, #c, __FILE__, __LINE__); } } while(0)
+
+/* Cooperative test threads */
+
+typedef void (*BranchThreadFunction)(void *arg);
+
+/* Mutex of the test threads, initialize with BRANCH_MUTEX_INITIALIZER */
+typedef struct BranchMutex {
+    int locked;
+    unsigned int owner;                 /* Thread holding the mutex, 0 for the test itself */
+} BranchMutex;
+
+#define BRANCH_MUTEX_INITIALIZER {0, 0}
+
+/**
+ * Allow at most bound preemptions per combination: switches away from a thread at a sync point
+ * where it could go on. Few bugs need more than two, which is the default. Without a call, the
+ * bound in the CMOCKA_BRANCHES_PREEMPTIONS environment variable is used.
+ */
+void branch_set_preemption_bound(const unsigned int bound);
+
+/**
+ * Add a test thread running func(arg) to the current combination, started by branch_threads_run.
+ * Returns its number, counted from 1.
+ */
+unsigned int branch_thread_create(BranchThreadFunction func, void *arg);
+
+/* Number of the running test thread, 0 outside the test threads */
+unsigned int branch_thread_self(void);
+
+void _branch_threads_run(const char* const file, const int line, const char* const function_name);
+void _branch_yield(const char* const file, const int line, const char* const function_name);
+void _branch_mutex_lock(BranchMutex *mutex, const char* const file, const int line, const char* const function_name);
+void _branch_mutex_unlock(BranchMutex *mutex, const char* const file, const int line, const char* const function_name);
+long _branch_atomic_load(const long *object, const char* const file, const int line, const char* const function_name);
+void _branch_atomic_store(long *object, const long value, const char* const file, const int line, const char* const function_name);
+long _branch_atomic_fetch_add(long *object, const long value, const char* const file, const int line, const char* const function_name);
+int _branch_atomic_compare_exchange(long *object, long *expected, const long desired, const char* const file, const int line, const char* const function_name);
+
+/*
+ * Run the test threads created so far until all have finished. The threads run one at a time and
+ * only switch at sync points: branch_yield, mutex lock and unlock and the atomics. Which thread
+ * runs at a sync point is a branch point named "thread switch", so the exploration covers every
+ * interleaving within the preemption bound, and a failing interleaving is replayed by its path id.
+ * Branch points started in a thread must end before its next sync point. Fails the combination if
+ * the threads deadlock.
+ */
+#define branch_threads_run() _branch_threads_run(__FILE__, __LINE__, __func__)
+#define branch_yield() _branch_yield(__FILE__, __LINE__, __func__)
+#define branch_mutex_lock(mutex) _branch_mutex_lock(mutex, __FILE__, __LINE__, __func__)
+#define branch_mutex_unlock(mutex) _branch_mutex_unlock(mutex, __FILE__, __LINE__, __func__)
+#define branch_atomic_load(object) _branch_atomic_load(object, __FILE__, __LINE__, __func__)
+#define branch_atomic_store(object, value) _branch_atomic_store(object, value, __FILE__, __LINE__, __func__)
+#define branch_atomic_fetch_add(object, value) _branch_atomic_fetch_add(object, value, __FILE__, __LINE__, __func__)
+#define branch_atomic_compare_exchange(object, expected, desired) \
+    _branch_atomic_compare_exchange(object, expected, desired, __FILE__, __LINE__, __func__)
+
+/* Call site descriptors */
+
+/*
+ * Static description of a branch point, used by the C++ branch scopes in cmocka_branches.hpp. A
+ * branch started and ended with the same descriptor is matched by its address, so the names and
+ * location are not compared on every combination.
+ */
+typedef struct BranchSite {
+    const char *name;
+    unsigned int num_twigs;
+    char const * const * twig_names;
+    const char *file;
+    int line;
+    const char *function_name;
+} BranchSite;
+
+unsigned int _branch_start_site(const BranchSite *site);
+void _branch_end_site(const BranchSite *site);
+
+/* Branch schemas */
+
+/*
+ * A schema declares the branch points of a table driven test up front, so its combinations can be
+ * enumerated without running the test to discover them. The points are listed in preorder: a
+ * point follows its parent and the points nested in it come before the next sibling of the
+ * parent. A point is taken when its parent is taken with parent_twig, or with any twig for
+ * BRANCH_SCHEMA_ANY_TWIG. Points are combined in list order, the last one changing fastest.
+ */
+#define BRANCH_SCHEMA_ROOT ((unsigned int)-1)
+#define BRANCH_SCHEMA_ANY_TWIG ((unsigned int)-1)
+/* Twig of a point that is not taken in a combination */
+#define BRANCH_SCHEMA_INACTIVE ((unsigned int)-1)
+
+typedef struct BranchSchemaPoint {
+    const char *name;
+    unsigned int num_twigs;
+    char const * const * twig_names;    /* NULL for unnamed twigs */
+    unsigned int parent;                /* Index of the enclosing point, BRANCH_SCHEMA_ROOT at the top level */
+    unsigned int parent_twig;           /* Twig of the parent the point is taken under */
+} BranchSchemaPoint;
+
+typedef struct BranchSchema BranchSchema;
+
+/* Iterates a range of combinations, see branch_schema_iterate */
+typedef struct BranchSchemaIterator {
+    const BranchSchema *schema;
+    uint64_t index;                     /* Index of the combination in twigs after branch_schema_next */
+    uint64_t end;
+    int started;
+    unsigned int *twigs;
+} BranchSchemaIterator;
+
+/**
+ * Validate the points and count the combinations of each subtree. The points are copied, the
+ * strings they refer to must stay valid. Returns NULL after printing an error for an invalid schema.
+ */
+BranchSchema *branch_schema_create(const BranchSchemaPoint *points, const unsigned int num_points);
+
+void branch_schema_destroy(BranchSchema *schema);
+
+/**
+ * Number of combinations of the schema.
+ */
+uint64_t branch_schema_count(const BranchSchema *schema);
+
+/**
+ * Fill twigs (one per point) with combination index, BRANCH_SCHEMA_INACTIVE for the points it
+ * doesn't take. Returns 0 if index is not below the count.
+ */
+int branch_schema_decode(const BranchSchema *schema, const uint64_t index, unsigned int *twigs);
+
+/**
+ * Prepare iterator for the combinations from begin up to but not including end, which
+ * branch_schema_next writes to twigs (one per point).
+ */
+void branch_schema_iterate(BranchSchemaIterator *iterator, const BranchSchema *schema, const uint64_t begin, const uint64_t end, unsigned int *twigs);
+
+/**
+ * Prepare iterator for part (counted from 0) of num_parts about equal consecutive ranges of the
+ * combinations, for consumers that share the combinations. Fails the test if part is not below
+ * num_parts, including when num_parts is 0.
+ */
+void branch_schema_iterate_part(BranchSchemaIterator *iterator, const BranchSchema *schema, const unsigned int part, const unsigned int num_parts, unsigned int *twigs);
+
+/**
+ * Advance to the next combination. Returns 0 at the end of the range.
+ */
+int branch_schema_next(BranchSchemaIterator *iterator);
+
+/**
+ * Print the twigs taken by a combination like the branch path of a failing test, with the twig names of the points.
+ */
+void branch_schema_print_combination(const BranchSchema *schema, const unsigned int *twigs);
+
+/* Path selection, shards and exploration server */
+
+/**
+ * Explore only the combinations taking the twigs of path at their first branch points, path being
+ * twig values separated by dots in the order the branch points start, as printed in the
+ * "Branch path id" of a failing combination. With replay set only the first of these combinations
+ * runs, which reproduces a failure. NULL explores every combination. Without a call, the path in
+ * the CMOCKA_BRANCHES_REPLAY or else the CMOCKA_BRANCHES_PATH environment variable is used.
+ */
+void branch_set_path(const char *path, const int replay);
+
+/**
+ * Record the duration of every subtree keyed by the twig values of its first depth branch points
+ * (at most 8, 0 for 2) and the call site of the last of them, replacing the durations of the
+ * explored subtrees in the tab separated file at path when the exploration passes. Every shard
+ * writes its own file, cmocka_branches_shardplan balances the subtrees over the shards. Without a
+ * call, the CMOCKA_BRANCHES_TIMINGS and CMOCKA_BRANCHES_TIMING_DEPTH environment variables are used.
+ */
+void branch_set_timing_file(const char *path, const unsigned int depth);
+
+/**
+ * Explore only the subtrees the shard plan at plan assigns to shard, one after the other. A test
+ * the plan doesn't list is explored in full by shard 0 and skipped by the other shards. After its
+ * own subtrees, shard 0 explores the subtrees of a planned test that the plan leaves out. A path
+ * set with branch_set_path takes precedence. Without a call, the CMOCKA_BRANCHES_SHARD_PLAN and
+ * CMOCKA_BRANCHES_SHARD environment variables are used.
+ */
+void branch_set_shard(const char *plan, const unsigned int shard);
+
+/* Called before every request of branch_serve to bring the warm fixtures back to their initial state, returns 0 on success */
+typedef int (*BranchServeReset)(void *data);
+
+/**
+ * Serve explorations of tests on a Unix domain socket at socket_path, so a test binary and its
+ * fixtures are set up once for many short shards. Every connection sends one request line:
+ *
+ *     RUN <test> [<path>...]   explore the test, once restricted to each path, see branch_set_path
+ *     REPLAY <test> <path>     run the single combination of the path
+ *     LIST                     list the names of the tests
+ *     QUIT                     stop serving
+ *
+ * The output of the test is streamed back, ending with a line "CMOCKA_BRANCHES_RESULT <failed>".
+ * The cmocka_branches_client tool sends requests from the command line or CTest. reset, if not
+ * NULL, is called with data before every run. Returns 0 after QUIT, -1 if serving failed.
+ */
+int branch_serve(const char *socket_path, const struct CMUnitTest * const tests, const size_t num_tests,
+                 BranchServeReset reset, void *data);
+
 /** @} */
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* CMOCKA_BRANCHES_H_ */
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2017 Nordic semiconductor.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CMOCKA_BRANCHES_HPP_
+#define CMOCKA_BRANCHES_HPP_
+
+#include <cstdarg>
+#include <cstddef>
+#include <csetjmp>
+
+#include "cmocka_branches.h"
+
+/*
+ * C++ branch points (C++11). A branch scope starts a branch point when it is constructed and ends
+ * it when it goes out of scope, so start and end always pair up:
+ *
+ *     CMOCKA_BRANCH_ENUM(Phy, change_to_2mbps, change_to_coded, no_change)
+ *
+ *     static void test(void **state)
+ *     {
+ *         branch_enum(phy, Phy);
+ *         switch(phy) {
+ *             case Phy::change_to_2mbps: ...
+ *         }
+ *     }
+ *
+ * Every branch point has a static BranchSite descriptor, which the engine matches by address
+ * instead of comparing the names and location of the branch. A failing combination leaves the
+ * test with the longjmp of cmocka, which skips the destructors of the scopes, the engine ends their
+ * branch points itself. branch_assume would prune the same way, so it fails the test when a false
+ * assumption is checked inside a scope: check assumptions before the scopes they concern start.
+ */
+
+namespace cmocka {
+
+/* Twig count and names of an enum, returned by cmocka_branch_enum_info(Enum*), see CMOCKA_BRANCH_ENUM */
+struct branch_enum_info {
+    unsigned int num_twigs;
+    char const * const * twig_names;
+};
+
+/* Branch point that ends when it goes out of scope, converts to the index of the twig */
+class branch_scope {
+public:
+    explicit branch_scope(const BranchSite &site) : site_(site), twig_(_branch_start_site(&site)) {}
+    ~branch_scope() { _branch_end_site(&site_); }
+
+    unsigned int twig() const { return twig_; }
+    operator unsigned int() const { return twig_; }
+
+private:
+    branch_scope(const branch_scope &);
+    branch_scope &operator=(const branch_scope &);
+
+    const BranchSite &site_;
+    const unsigned int twig_;
+};
+
+/* Branch point over the enumerators of Enum, converts to the enumerator of the twig */
+template<typename Enum>
+class branch {
+public:
+    explicit branch(const BranchSite &site) : scope_(site) {}
+
+    Enum value() const { return static_cast<Enum>(scope_.twig()); }
+    operator Enum() const { return value(); }
+
+private:
+    branch_scope scope_;
+};
+
+/* Descriptor of a branch point over Enum, a constant expression so the static descriptors need no guard */
+template<typename Enum>
+constexpr BranchSite branch_site(const char *name, const char *file, const int line, const char *function_name)
+{
+    static_assert(cmocka_branch_enum_info(static_cast<Enum*>(nullptr)).num_twigs >= 2,
+                  "A branch enum needs at least two enumerators");
+    return BranchSite{name, cmocka_branch_enum_info(static_cast<Enum*>(nullptr)).num_twigs,
+                      cmocka_branch_enum_info(static_cast<Enum*>(nullptr)).twig_names,
+                      file, line, function_name};
+}
+
+} /* namespace cmocka */
+
+/* Stringify up to 16 enumerators */
+#define CMOCKA_BRANCH_STR_1(a) #a
+#define CMOCKA_BRANCH_STR_2(a, ...) #a, CMOCKA_BRANCH_STR_1(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_3(a, ...) #a, CMOCKA_BRANCH_STR_2(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_4(a, ...) #a, CMOCKA_BRANCH_STR_3(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_5(a, ...) #a, CMOCKA_BRANCH_STR_4(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_6(a, ...) #a, CMOCKA_BRANCH_STR_5(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_7(a, ...) #a, CMOCKA_BRANCH_STR_6(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_8(a, ...) #a, CMOCKA_BRANCH_STR_7(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_9(a, ...) #a, CMOCKA_BRANCH_STR_8(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_10(a, ...) #a, CMOCKA_BRANCH_STR_9(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_11(a, ...) #a, CMOCKA_BRANCH_STR_10(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_12(a, ...) #a, CMOCKA_BRANCH_STR_11(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_13(a, ...) #a, CMOCKA_BRANCH_STR_12(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_14(a, ...) #a, CMOCKA_BRANCH_STR_13(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_15(a, ...) #a, CMOCKA_BRANCH_STR_14(__VA_ARGS__)
+#define CMOCKA_BRANCH_STR_16(a, ...) #a, CMOCKA_BRANCH_STR_15(__VA_ARGS__)
+#define CMOCKA_BRANCH_COUNT(...) CMOCKA_BRANCH_COUNT_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define CMOCKA_BRANCH_COUNT_(a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15, a16, n, ...) n
+#define CMOCKA_BRANCH_CONCAT(a, b) CMOCKA_BRANCH_CONCAT_(a, b)
+#define CMOCKA_BRANCH_CONCAT_(a, b) a##b
+#define CMOCKA_BRANCH_STR(...) CMOCKA_BRANCH_CONCAT(CMOCKA_BRANCH_STR_, CMOCKA_BRANCH_COUNT(__VA_ARGS__))(__VA_ARGS__)
+
+/*
+ * Define enum class name with up to 16 enumerators, named after them when branched over. Use at
+ * namespace scope. The twigs of other enums are described by defining a constexpr function
+ * cmocka::branch_enum_info cmocka_branch_enum_info(Enum*) next to the enum.
+ */
+#define CMOCKA_BRANCH_ENUM(name, ...) \
+    enum class name { __VA_ARGS__ }; \
+    static const char * const cmocka_branch_twig_names_##name[] = { CMOCKA_BRANCH_STR(__VA_ARGS__) }; \
+    static constexpr cmocka::branch_enum_info cmocka_branch_enum_info(name*) \
+    { \
+        return cmocka::branch_enum_info{CMOCKA_BRANCH_COUNT(__VA_ARGS__), cmocka_branch_twig_names_##name}; \
+    }
+
+/* Declare var as a branch point named #var over the twigs of enum type, converting to the enumerator */
+#define branch_enum(var, type) \
+    static const BranchSite var##_branch_site = cmocka::branch_site<type>(#var, __FILE__, __LINE__, __func__); \
+    const cmocka::branch<type> var(var##_branch_site)
+
+/* Declare var as a branch point named name with num_twigs twigs, converting to the twig index */
+#define branch_scope_count(var, name, num_twigs, twig_names) \
+    static const BranchSite var##_branch_site = {name, num_twigs, twig_names, __FILE__, __LINE__, __func__}; \
+    const cmocka::branch_scope var(var##_branch_site)
+
+#endif /* CMOCKA_BRANCHES_HPP_ */
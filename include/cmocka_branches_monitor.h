@@ -0,0 +1,50 @@
+/*
+ * Copyright 2017 Nordic semiconductor.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CMOCKA_BRANCHES_MONITOR_H_
+#define CMOCKA_BRANCHES_MONITOR_H_
+
+#include <stdint.h>
+
+/*
+ * Layout of the progress block that a running exploration publishes in the file set with
+ * branch_set_monitor_file or CMOCKA_BRANCHES_MONITOR. The engine updates it after every combination
+ * with relaxed stores, so readers map the file and read it without locking. Fields may be from
+ * consecutive combinations. The test name is changed between two increments of sequence, readers
+ * copy it again while sequence is odd or changes during the copy.
+ */
+#define BRANCH_MONITOR_MAGIC 0x434d4252u
+#define BRANCH_MONITOR_VERSION 1
+#define BRANCH_MONITOR_TEST_NAME_SIZE 128
+
+typedef struct BranchMonitorBlock {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;                       /* Process running the exploration */
+    uint32_t running;                   /* Cleared when the exploration ends */
+    uint32_t sequence;                  /* Odd while test_name is changed */
+    uint32_t nesting_depth;             /* Deepest branch nesting of the last combination */
+    uint64_t combinations;
+    uint64_t failures;
+    uint64_t pruned;
+    uint64_t path_id;                   /* Hash of the branch points and twigs of the last combination */
+    uint64_t nodes;                     /* Branches and twigs discovered */
+    uint64_t combinations_per_second;   /* Measured over about a second */
+    uint64_t start_ns;                  /* CLOCK_MONOTONIC time when the exploration started */
+    uint64_t update_ns;                 /* CLOCK_MONOTONIC time of the last update */
+    char test_name[BRANCH_MONITOR_TEST_NAME_SIZE];
+} BranchMonitorBlock;
+
+#endif /* CMOCKA_BRANCHES_MONITOR_H_ */
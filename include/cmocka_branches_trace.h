@@ -0,0 +1,69 @@
+/*
+ * Copyright 2017 Nordic semiconductor.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CMOCKA_BRANCHES_TRACE_H_
+#define CMOCKA_BRANCHES_TRACE_H_
+
+#include <stdint.h>
+
+/*
+ * Format of the event trace written to the file set with branch_set_trace_file or
+ * CMOCKA_BRANCHES_TRACE. The file is a sequence of chunks in host byte order, each a
+ * BranchTraceChunk followed by size bytes. A records chunk holds BranchTraceRecords of one thread.
+ * A site chunk describes a branch point: a BranchTraceSite followed by its name, file, function
+ * and num_names twig names as zero terminated strings. Threads and isolated child processes append
+ * whole chunks, so chunks of different threads can be interleaved.
+ */
+#define BRANCH_TRACE_MAGIC 0x54524243u
+#define BRANCH_TRACE_VERSION 1
+
+#define BRANCH_TRACE_CHUNK_RECORDS 1
+#define BRANCH_TRACE_CHUNK_SITE 2
+
+typedef struct BranchTraceChunk {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t kind;
+    uint32_t pid;
+    uint32_t thread;                    /* Numbered from 1 in each process */
+    uint32_t size;
+    uint32_t reserved;
+} BranchTraceChunk;
+
+typedef struct BranchTraceSite {
+    uint32_t id;
+    int32_t line;
+    uint32_t num_twigs;
+    uint32_t num_names;                 /* Twig names that follow, 0 if the twigs are unnamed */
+} BranchTraceSite;
+
+enum BranchTraceType {
+    BRANCH_TRACE_COMBINATION_BEGIN = 1,
+    BRANCH_TRACE_COMBINATION_END,       /* value: 0 passed, 1 failed, 2 pruned */
+    BRANCH_TRACE_BRANCH_START,          /* site, value: twig */
+    BRANCH_TRACE_BRANCH_END,            /* site */
+    BRANCH_TRACE_FAILURE,
+    BRANCH_TRACE_RESTART,               /* value: nonzero if more combinations follow */
+};
+
+typedef struct BranchTraceRecord {
+    uint64_t time_ns;                   /* CLOCK_MONOTONIC */
+    uint32_t type;
+    uint32_t site;                      /* Id of a site chunk, 0 for none */
+    uint32_t value;
+    uint32_t depth;                     /* Branch nesting level when the event was recorded */
+} BranchTraceRecord;
+
+#endif /* CMOCKA_BRANCHES_TRACE_H_ */
@@ -20,6 +20,10 @@
 #include "config.h"
 #endif
 
+#if defined(HAVE_DLADDR) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
 #endif
@@ -36,6 +40,56 @@
 #include <strings.h>
 #endif
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_UCONTEXT_H
+#include <ucontext.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
 #include <stdint.h>
 #include <setjmp.h>
 #include <stdarg.h>
@@ -46,6 +100,8 @@
 #include <time.h>
 
 #include "cmocka_branches.h"
+#include "cmocka_branches_monitor.h"
+#include "cmocka_branches_trace.h"
 
 #if defined(HAVE_GCC_THREAD_LOCAL_STORAGE)
 # define CMOCKA_THREAD __thread
@@ -60,10 +116,13 @@
 
 /* Printf formatting for source code locations. */
 #define SOURCE_LOCATION_FORMAT "%s:%u"
+/* Printf formatting for the caller of a fault point, which has a module offset in place of a line */
+#define MODULE_OFFSET_FORMAT "%s+0x%x"
 
 //void cm_print_error(const char * const format, ...) CMOCKA_PRINTF_ATTRIBUTE(1, 2);
 
 #define branch_print_error print_error
+#define branch_print_message print_message
 #define cm_print_error print_error
 
 /* Doubly linked list node. */
@@ -187,6 +246,7 @@ typedef enum
 {
     FORK_BRANCH_STATE_UNINITIALIZED = 0,  /* This twig has never been executed for any sub combinations */
     FORK_BRANCH_STATE_DISCOVERED = 1,     /* This twig has never been executed for at least one sub combination */
+    FORK_BRANCH_STATE_TRUNCATED = 2,      /* A combination crashed or was pruned in this twig before all its sub branches were discovered */
 } BranchTwigState;
 
 typedef enum
@@ -196,6 +256,46 @@ typedef enum
     FORK_RESTART_CODE_ERROR = 2,
 } BranchRestartCode;
 
+/* Performance counters collected for every combination, see branch_set_perf_counters */
+typedef enum
+{
+    BRANCH_PERF_INSTRUCTIONS,
+    BRANCH_PERF_CYCLES,                 /* Task clock nanoseconds when hardware counters are not available */
+    BRANCH_PERF_CACHE_MISSES,
+    BRANCH_PERF_PAGE_FAULTS,
+    BRANCH_PERF_CONTEXT_SWITCHES,
+    BRANCH_PERF_COUNTERS
+} BranchPerfCounter;
+
+/* Statistics aggregated over all combinations that passed through a twig */
+typedef struct
+{
+    unsigned long combinations;
+    unsigned long failures;
+    unsigned long pruned;
+    uint64_t time_ns;           /* Execution time, summed over combinations */
+    size_t heap_allocated;      /* Bytes allocated, summed over combinations */
+    size_t heap_peak;           /* Largest peak of live bytes in one combination */
+    size_t heap_leaked;         /* Bytes leaked, summed over combinations */
+    uint64_t perf[BRANCH_PERF_COUNTERS];    /* Counter values, summed over combinations */
+} BranchTwigStats;
+
+/* Statistics of the twigs of a lazy branch that were freed, see branch_twig_stats_fold */
+typedef struct
+{
+    BranchTwigStats stats;      /* Summed over the twigs, heap_peak is the largest */
+    size_t heap_peak_sum;       /* Peaks summed over the twigs, for the sibling averages of the heap report */
+    uint64_t perf_average_sum[BRANCH_PERF_COUNTERS];    /* Averages per combination summed over the twigs */
+} BranchFoldedStats;
+
+/* Values returned by a value domain branch point, see branch_start_range and branch_start_values */
+typedef struct
+{
+    long min;
+    long step;
+    const long *values;         /* Returned values, NULL for a range */
+} BranchDomain;
+
 struct BranchInformation_s;
 typedef struct
 {
@@ -206,6 +306,9 @@ typedef struct
     ListNode* current_prev_subbranch;
     struct BranchInformation_s* parent_branch;
     ListNode subbranches;
+    BranchTwigStats *stats;     /* Allocated on first use, NULL if no statistics are collected */
+    unsigned char equivalent;   /* Another twig of its class is the representative, see branch_start_classes */
+    unsigned char pin_subbranches; /* Sub branches take a single twig, set at and below equivalent twigs */
 } BranchTwig;
 
 
@@ -218,17 +321,203 @@ typedef struct BranchInformation_s
     unsigned int line;
     unsigned int num_twigs;
     char const * const * twig_names;
+    const unsigned int *twig_classes;   /* Equivalence class of every twig, NULL if all twigs differ */
+
+    BranchDomain domain;
+    int has_domain;
+    const BranchSite *site;             /* Call site descriptor of C++ branch points, NULL otherwise */
+    uint32_t trace_site;                /* Site id in the event trace, 0 until the branch is traced */
 
     /* Bookkeeping info */
     BranchTwig *parent_twig;
-    BranchTwig *twigs;
+    BranchTwig *twigs;                  /* All twigs, NULL for a lazy branch */
+    BranchTwig **lazy_twigs;            /* Twigs of a lazy branch that exist, sorted by value */
+    unsigned int num_lazy_twigs;
+    unsigned int lazy_twigs_capacity;
+    BranchFoldedStats *folded;          /* Statistics of freed lazy twigs, NULL if none */
     unsigned int current_twig_idx;
+    int pinned;                         /* Held at the twig of the selected path or of an equivalent twig, never mutated */
+    unsigned int path_start;            /* Position of the branch in the path of the combination it was last taken in */
 
 } BranchInformation;
 
-/* Global collection of branch related information */
+/* One branch start of a recorded combination, in execution order */
+typedef struct
+{
+    char const *name;
+    char const *file;
+    char const *function_name;
+    unsigned int line;
+    unsigned int num_twigs;
+    unsigned int value;
+    unsigned int nesting;
+    int equivalent;             /* The twig was covered by the representative of its class */
+} BranchCacheStep;
+
+/* A combination that passed, with a fingerprint of the build id and the source files of its branch call sites */
+typedef struct
+{
+    uint64_t fingerprint;
+    int has_fingerprint;        /* Cleared if a source file could not be read */
+    unsigned int num_steps;
+    BranchCacheStep *steps;
+} BranchCachePath;
+
+/* State of the incremental exploration, see branch_set_incremental_cache */
+typedef struct
+{
+    char const *file;
+    char const *build_id;
+    int full_run;
+    int active;                     /* A cache file is used for the current test */
+    int in_sync;                    /* All combinations so far matched the ones of the cached run */
+    int replaying;                  /* The current combination is replayed from the cache */
+    ListNode other_lines;           /* Lines of the cache file belonging to other tests */
+    ListNode strings;               /* Strings referenced by the cached paths */
+    ListNode file_hashes;           /* BranchCacheFileHash values of the source files read so far */
+    BranchCachePath *cached_paths;  /* Combinations recorded by the last passing run */
+    unsigned int num_cached_paths;
+    BranchCachePath *recorded_paths;  /* Combinations of the current run */
+    unsigned int num_recorded_paths;
+    unsigned int recorded_paths_capacity;
+    unsigned long replayed;
+} BranchCache;
+
+/* State of the crash isolation, see branch_set_isolation */
+typedef struct
+{
+    int configured;                 /* Set by branch_set_isolation, the environment is not used */
+    unsigned int batch_size;        /* Combinations per child process, 0 runs them in the test process */
+    unsigned int timeout_ms;        /* Largest allowed duration of one combination, 0 for no limit */
+    int child;                      /* Set in a child process, branch points are sent to the parent */
+    int fd;                         /* Pipe to the parent in a child process */
+    unsigned long failures;         /* Combinations that crashed, hung or failed in a child process */
+} BranchIsolation;
+
+/* A memory region restored before every combination, see branch_register_state */
+typedef struct
+{
+    unsigned char *address;
+    size_t size;
+    unsigned char *snapshot;        /* Contents when the exploration started */
+    unsigned char *first_page;      /* First page completely inside the region, NULL if pages are not tracked */
+    size_t num_pages;               /* Pages completely inside the region */
+    unsigned char *dirty;           /* One flag per page, set when the page was written since the last restore */
+} BranchStateRegion;
+
+#if defined(HAVE_UCONTEXT_H) && defined(HAVE_GETCONTEXT)
+#define BRANCH_THREADS_SUPPORTED 1
+#endif
+
+typedef enum {
+    BRANCH_THREAD_RUNNABLE,
+    BRANCH_THREAD_BLOCKED,
+    BRANCH_THREAD_FINISHED,
+} BranchThreadState;
+
+/* A cooperative test thread, see branch_thread_create */
+typedef struct
+{
+    BranchThreadFunction func;
+    void *arg;
+    BranchThreadState state;
+    const BranchMutex *waiting_for;     /* Mutex a blocked thread waits for */
+    unsigned char *stack;
+#ifdef BRANCH_THREADS_SUPPORTED
+    ucontext_t context;
+#endif
+} BranchThread;
+
+/* State of the cooperative threads of the current combination, see branch_threads_run */
+typedef struct
+{
+    int configured;                     /* Set by branch_set_preemption_bound, the environment is not used */
+    unsigned int preemption_bound;
+    BranchThread **threads;             /* Allocated one by one, a saved context must not move */
+    unsigned int *candidates;           /* Threads to choose from at a scheduling point */
+    unsigned int num_threads;
+    unsigned int threads_capacity;
+    unsigned int current;               /* Index of the running thread + 1, 0 for the test itself */
+    int running;
+    unsigned int active_bound;          /* Preemption bound of the current run */
+    unsigned int preemptions;           /* Preemptions taken by the current combination */
+    unsigned int open_choices;          /* Scheduling branch points to end when the threads finish */
+    const char *file;                   /* Sync point where the last thread stopped */
+    int line;
+    const char *function_name;
+#ifdef BRANCH_THREADS_SUPPORTED
+    ucontext_t scheduler_context;
+#endif
+} BranchScheduler;
+
+/* Memoized data, allocated together with its key, see branch_memo */
+typedef struct BranchMemoEntry
+{
+    struct BranchMemoEntry *next_in_bucket;
+    struct BranchMemoEntry *prev;       /* Neighbours in the list of entries by last use */
+    struct BranchMemoEntry *next;
+    uint64_t hash;
+    unsigned long used_in;              /* Combination that last used the entry */
+    size_t size;                        /* Bytes of data */
+    size_t footprint;                   /* Bytes of the whole allocation */
+    const char *key;
+    void *data;
+} BranchMemoEntry;
+
+/* Data memoized across the combinations of one exploration */
+typedef struct
+{
+    int configured;                     /* Set by branch_set_memo_limit, the environment is not used */
+    size_t limit;                       /* Largest total footprint of the entries, 0 for no limit */
+    size_t active_limit;
+    BranchMemoEntry **buckets;
+    unsigned int num_buckets;
+    unsigned int num_entries;
+    BranchMemoEntry lru;                /* Head of the list by last use, next is the most recently used entry */
+    size_t footprint;
+    void *pending;                      /* Entry being initialized, freed if the initialization fails */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} BranchMemo;
+
+/* Largest number of leading branch points a timing subtree is keyed by */
+#define BRANCH_TIMING_MAX_DEPTH 8
+
+/* Time spent below a path prefix, keyed by its twig values and the call site of its last branch point */
+typedef struct BranchTimingEntry
+{
+    struct BranchTimingEntry *next_in_bucket;
+    uint64_t hash;
+    char *path;
+    char *name;
+    char *file;
+    int line;
+    uint64_t time_ns;
+    unsigned long combinations;
+} BranchTimingEntry;
+
+/* Per subtree durations of one exploration, see branch_set_timing_file */
 typedef struct
 {
+    char const *file;
+    unsigned int depth;
+    int configured;                     /* Set by branch_set_timing_file, the environment is not used */
+    char const *active_file;            /* Durations are recorded and written to this file */
+    unsigned int active_depth;
+    unsigned int values[BRANCH_TIMING_MAX_DEPTH]; /* Twig values of the first branch points of the combination */
+    BranchInformation *branches[BRANCH_TIMING_MAX_DEPTH];
+    BranchTimingEntry **buckets;
+    unsigned int num_entries;
+    char **kept_lines;                  /* Lines of the file for other tests and paths, written back unchanged */
+    unsigned int num_kept_lines;
+} BranchTimings;
+
+/* Collection of branch related information of one exploration context, see branch_context_create */
+typedef struct BranchContext
+{
+    int enabled;                        /* An exploration is running in this context */
+    struct BranchContext *outer;        /* Context that was current when this one was run */
     BranchInformation *current_branch;
     BranchTwig *current_twig;
     BranchInformation *next_mutate_subbranch;
@@ -238,41 +527,490 @@ typedef struct
     unsigned int nesting_level;
     ListNode branchlines;
     BranchTwig trunk;
+
+    /* Heap accounting, see _branch_test_malloc */
+    size_t heap_live;                   /* Bytes currently allocated through the branch allocators */
+    size_t heap_limit;                  /* Largest allowed peak per combination, 0 for no limit */
+    size_t heap_combination_start;      /* heap_live when the current combination started */
+    size_t heap_combination_allocated;
+    size_t heap_combination_peak;
+    int heap_accounting_active;         /* Set when the branch allocators are used during an exploration */
+
+    /* Statistics of the current exploration */
+    int collect_twig_stats;             /* Attribute every combination to its twigs */
+    unsigned long combinations;
+    unsigned long failed_combinations;
+    unsigned long pruned_combinations;
+    uint64_t time_ns;
+    uint64_t combination_start_ns;
+
+    /* Pruning, see branch_assume and branch_set_exclusions */
+    jmp_buf *prune_env;                 /* Return point of the running combination */
+    int combination_pruned;
+    int truncated;                      /* The current combination ended before reaching all its branches */
+    const BranchExclusion *exclusions;
+    unsigned int num_exclusions;
+    unsigned int *exclusion_marks;      /* Two per exclusion, the path position + 1 where either twig was first taken in the current combination */
+
+    /* Performance counters, see branch_set_perf_counters */
+    int perf;
+    int perf_active;                    /* Counters are attributed to twigs in the current exploration */
+    int perf_open;                      /* The counters of this process are open */
+    int perf_fds[BRANCH_PERF_COUNTERS];
+    int perf_available[BRANCH_PERF_COUNTERS];
+    int perf_software[BRANCH_PERF_COUNTERS];    /* The software fallback of the counter is used */
+    uint64_t perf_start[BRANCH_PERF_COUNTERS];
+    uint64_t perf_combination[BRANCH_PERF_COUNTERS];   /* Counted during the current combination */
+
+    /* Live progress monitor, see branch_set_monitor_file */
+    char const *monitor_file;
+    volatile BranchMonitorBlock *monitor;   /* Mapped progress block, NULL when not monitored */
+    uint64_t monitor_path_id;               /* Hash of the current combination so far */
+    unsigned int monitor_depth;             /* Deepest nesting of the current combination */
+    unsigned long discovered_nodes;
+    uint64_t monitor_window_ns;             /* Start of the current rate measurement */
+    unsigned long monitor_window_combinations;
+
+    /* Event trace, see branch_set_trace_file */
+    char const *trace_file;
+    int trace_opened;                   /* The exploration writes to the trace of the thread */
+
+    /* Tree export, see branch_set_tree_export */
+    char const *export_path;
+    unsigned int export_depth;
+
+    /* Failure history, see branch_set_history_file */
+    char const *test_name;
+    char const *history_file;
+    ListNode history;                   /* BranchHistoryEntry values loaded from the history file */
+    int history_modified;
+
+    BranchCache cache;
+    BranchIsolation isolation;
+    BranchScheduler scheduler;
+    BranchMemo memo;
+    BranchTimings timings;
+
+    /* Registered state, see branch_register_state */
+    BranchStateRegion *state_regions;
+    unsigned int num_state_regions;
+    int state_tracking_disabled;
+    int state_handler_installed;
+
+    /* Fault injection, see branch_set_fault_filter */
+    BranchFaultFilter fault_filter;
+    void *fault_filter_data;
+    int faults_configured;              /* Fault points take part in the current exploration */
+    int faults_suspended;               /* Inside the engine, calls made here are not fault points */
+
+    /* Path selection, see branch_set_path and branch_set_shard */
+    char const *path;
+    int path_configured;                /* Set by branch_set_path, the environment is not used */
+    int path_replay;
+    int path_invalid;
+    char const *shard_plan;
+    unsigned int shard;
+    int shard_configured;               /* Set by branch_set_shard, the environment is not used */
+    char **paths;                       /* Explored one after the other */
+    unsigned int num_paths;
+    unsigned int path_index;
+    int path_restricted;                /* Only the combinations below the paths are explored, maybe none */
+    unsigned int *pins;                 /* Twig values of the first branch points of every combination */
+    unsigned int *pin_lanes;            /* Lane + 1 a batched branch point of the path runs, 0 for all lanes */
+    unsigned int num_pins;
+    unsigned int path_starts;           /* Branch points started in the current combination */
+    char **planned_paths;               /* Paths of every shard of the plan, the first shard explores what they leave out */
+    unsigned int num_planned_paths;
+    unsigned int planned_depth;         /* Most twig values in a planned path */
+    unsigned int *complement_values;    /* Twig values of the first planned_depth branch points of the combination */
+    int complement_active;              /* Exploring the subtrees of the test outside the planned paths */
+
+    /* Twig equivalence classes, see branch_start_classes */
+    unsigned long equivalence_seed;
+    int equivalence_configured;         /* Set by branch_set_equivalence_seed with a seed, the environment is not used */
+    uint64_t equivalence_random;        /* State of the twig sampling, 0 takes the first twig */
+    unsigned long equivalent_twigs;
+    unsigned long equivalence_pins;
+
+    /* Streaming exploration, see branch_set_streaming */
+    int streaming;
+    int streaming_active;               /* Completed subtrees are freed in the current exploration */
 } BranchesInformation;
 
-/* Struct containing all global state related to test branches */
-static CMOCKA_THREAD BranchesInformation global_branch_information;
-static CMOCKA_THREAD int global_branches_enabled = 0;
+/* Context used when no other context is current */
+static CMOCKA_THREAD BranchesInformation default_branch_context;
+/* Context of the branch points, NULL for the default context. Switching contexts swaps this pointer */
+static CMOCKA_THREAD BranchesInformation *current_branch_context = NULL;
+
+/* Branch point of the event trace that has been described in a site chunk */
+typedef struct BranchTraceSiteEntry {
+    const char *name;
+    const char *file;
+    const char *function_name;
+    int line;
+    uint32_t id;                        /* 0 for an unused entry */
+} BranchTraceSiteEntry;
+
+/* Event trace of a thread, shared by the explorations the thread runs */
+typedef struct BranchTrace {
+    int active;                         /* Events are recorded */
+    unsigned int users;                 /* Explorations writing to the trace */
+    int fd;
+    uint32_t thread;
+    char *buffer;                       /* Chunk header followed by the records */
+    BranchTraceRecord *records;
+    unsigned int num_records;
+    BranchTraceSiteEntry *sites;        /* Hash table of the sites written by this thread */
+    unsigned int sites_capacity;
+    unsigned int num_sites;
+} BranchTrace;
+
+static CMOCKA_THREAD BranchTrace branch_trace;
+
+static void branch_trace_record(const uint32_t type, const uint32_t site, const uint32_t value);
+
+/* Record an event if the trace of the thread is active */
+#define BRANCH_TRACE_EVENT(type, site, value) \
+    do { \
+        if(branch_trace.active) { \
+            branch_trace_record((type), (site), (value)); \
+        } \
+    } while(0)
+
+/* All engine state lives in the current context, functions look it up once and again after switching contexts */
+static BranchesInformation *branch_current_context(void)
+{
+    return current_branch_context != NULL ? current_branch_context : &default_branch_context;
+}
+
+
+/* The path id of the progress monitor is an FNV-1a hash over the line and twig of every branch point */
+#define BRANCH_MONITOR_PATH_ID_BASIS 0xcbf29ce484222325ULL
+#define BRANCH_MONITOR_PATH_ID_PRIME 0x100000001b3ULL
 
 /* -------------------------- Functions -------------------------- */
 
+static void branch_history_order_twigs(BranchInformation *branch_info);
+static void branch_history_load(void);
+static void branch_cache_load(void);
+static const char *branch_export_path(void);
+static int branch_streaming(void);
+static int branch_faults_configured(void);
+static int branch_is_fault_point(const BranchInformation *branch_info);
+static void branch_state_snapshot(void);
+static void branch_isolation_send_start(const char* const name, const unsigned int num_twigs, char const * const * const twig_names, const unsigned int *twig_classes, const BranchDomain *domain, const BranchSite *site, const char* const file, const int line, const char* const function_name);
+static void branch_isolation_send_end(const char* const name, const char* const file, const int line, const char* const function_name);
+static void branch_isolation_send_prune(void);
+static void branch_monitor_open(void);
+static int branch_perf_enabled(void);
+static void branch_perf_open(void);
+static const char *branch_perf_name(const unsigned int counter);
+static void branch_monitor_update(void);
+static void branch_monitor_close(void);
+static uint32_t branch_trace_site(BranchInformation *branch_info);
+static void branch_trace_open(void);
+static void branch_trace_close(void);
+static void branch_prune(void);
+static void branch_path_load(void);
+static int branch_path_next(void);
+static char *branch_strdup(const char *str);
+static unsigned int branch_split_fields(char *line, char **fields, const unsigned int max_fields);
+static void branch_timing_load(void);
+static void branch_timing_record(const uint64_t time_ns);
+static void branch_timing_save(const int passed);
+static void branch_threads_release(void);
+static void branch_memo_init(void);
+static void branch_memo_release(void);
+static void branch_print_path_id(void);
+static void branch_print_path_id_lane(const unsigned int lane_position, const unsigned int lane);
+static int branch_skips_twigs(void);
+static int branch_complement_planned(const unsigned int value, const unsigned int position);
+static int branch_twig_skipped(const BranchInformation *branch_info, const unsigned int value);
+static void branch_exclusions_mark(const BranchInformation *branch_info, const unsigned int value, const unsigned int position);
+static void branch_twigs_skip(BranchInformation *branch_info);
+static int branch_twigs_remaining(const BranchInformation *branch_info);
+static char *branch_read_line(FILE *file, char **buffer, size_t *size);
+
 static int branch_info_equal(BranchInformation const * const subbranch_information, const char* const name, const unsigned int num_twigs, const char* const file, const unsigned int line, const char* const function_name)
 {
-    return (subbranch_information->name == name &&
+    return ((subbranch_information->name == name || strcmp(subbranch_information->name, name) == 0) &&
             subbranch_information->num_twigs == num_twigs &&
             strcmp(subbranch_information->file, file) == 0 &&
             subbranch_information->line == line &&
             strcmp(subbranch_information->function_name, function_name) == 0);
 }
 
+static void free_branch(const void *value, void *cleanup_value_data);
+static void branch_trunk_initialize(void);
+static int branch_twig_stats_fold(BranchTwig *twig);
+
+/*
+ * Value domain branches with at least this many twigs are lazy: a twig only exists while it is
+ * current, or when it has sub branches or statistics that can't be folded into the branch, see
+ * branch_twig_stats_fold. Other twigs are created again when they
+ * become current. Other branches keep all their twigs, so the failure history can reorder them.
+ */
+#define BRANCH_LAZY_MIN_TWIGS 64
+
+/* Value of the first twig in the equivalence class of the twig with the given value */
+static unsigned int branch_class_representative(const BranchInformation *branch_info, const unsigned int value)
+{
+    unsigned int i;
+    for(i = 0; i < value; i++) {
+        if(branch_info->twig_classes[i] == branch_info->twig_classes[value]) {
+            return i;
+        }
+    }
+    return value;
+}
+
+static void branch_twig_initialize(BranchTwig *twig, BranchInformation *branch_info, const unsigned int value)
+{
+    twig->state = FORK_BRANCH_STATE_UNINITIALIZED;
+    twig->current_prev_subbranch = &twig->subbranches;
+    twig->parent_branch = branch_info;
+    twig->value = value;
+    twig->stats = NULL;
+    twig->equivalent = branch_info->twig_classes != NULL && branch_class_representative(branch_info, value) != value;
+    twig->pin_subbranches = twig->equivalent || branch_info->parent_twig->pin_subbranches;
+    list_initialize(&twig->subbranches);
+}
+
+/* Position of the first existing twig of a lazy branch with a value not below value */
+static unsigned int branch_lazy_position(const BranchInformation *branch_info, const unsigned int value)
+{
+    unsigned int low = 0, high = branch_info->num_lazy_twigs;
+    while(low < high) {
+        const unsigned int middle = low + (high - low) / 2;
+        if(branch_info->lazy_twigs[middle]->value < value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* The twig at index idx of the branch, created if the branch is lazy and the twig doesn't exist */
+static BranchTwig *branch_twig(BranchInformation *branch_info, const unsigned int idx)
+{
+    unsigned int position;
+    BranchTwig *twig;
+    if(branch_info->twigs != NULL) {
+        return &branch_info->twigs[idx];
+    }
+    /* The twigs of lazy branches are never reordered, so the index is the value */
+    position = branch_lazy_position(branch_info, idx);
+    if(position < branch_info->num_lazy_twigs && branch_info->lazy_twigs[position]->value == idx) {
+        return branch_info->lazy_twigs[position];
+    }
+    if(branch_info->num_lazy_twigs == branch_info->lazy_twigs_capacity) {
+        branch_info->lazy_twigs_capacity = branch_info->lazy_twigs_capacity != 0 ? 2 * branch_info->lazy_twigs_capacity : 4;
+        branch_info->lazy_twigs = (BranchTwig**)realloc(branch_info->lazy_twigs, branch_info->lazy_twigs_capacity * sizeof(BranchTwig*));
+    }
+    memmove(&branch_info->lazy_twigs[position + 1], &branch_info->lazy_twigs[position],
+            (branch_info->num_lazy_twigs - position) * sizeof(BranchTwig*));
+    twig = (BranchTwig*)malloc(sizeof(BranchTwig));
+    branch_twig_initialize(twig, branch_info, idx);
+    branch_info->lazy_twigs[position] = twig;
+    branch_info->num_lazy_twigs++;
+    return twig;
+}
+
+/* Value of the twig at index idx, without creating the twig of a lazy branch */
+static unsigned int branch_twig_value(const BranchInformation *branch_info, const unsigned int idx)
+{
+    return branch_info->twigs != NULL ? branch_info->twigs[idx].value : idx;
+}
+
+/*
+ * Called when the exploration leaves a twig, frees the twig of a lazy branch if it isn't needed again.
+ * Returns 1 if the twig was freed.
+ */
+static int branch_twig_left(BranchTwig *twig)
+{
+    BranchInformation * const branch_info = twig->parent_branch;
+    unsigned int position;
+    if(branch_info->twigs != NULL || !list_empty(&twig->subbranches) ||
+       (twig->stats != NULL && !branch_twig_stats_fold(twig))) {
+        return 0;
+    }
+    position = branch_lazy_position(branch_info, twig->value);
+    branch_info->num_lazy_twigs--;
+    memmove(&branch_info->lazy_twigs[position], &branch_info->lazy_twigs[position + 1],
+            (branch_info->num_lazy_twigs - position) * sizeof(BranchTwig*));
+    free(twig);
+    return 1;
+}
+
+/* Iterate the twigs of a branch that exist, starting with *position 0. Returns NULL after the last one. */
+static BranchTwig *branch_twig_next(const BranchInformation *branch_info, unsigned int *position)
+{
+    if(branch_info->twigs != NULL) {
+        return *position < branch_info->num_twigs ? &branch_info->twigs[(*position)++] : NULL;
+    }
+    return *position < branch_info->num_lazy_twigs ? branch_info->lazy_twigs[(*position)++] : NULL;
+}
+
+/*
+ * In streaming mode, free the subtrees below the branches of a twig that is left by a mutation or
+ * reset of its branch. The branches directly below the twig have to stay: when the twig is entered
+ * again they continue from their current twig rather than from the first one, which decides the
+ * combinations explored after it. Deeper branches are reset whenever the twig is entered again, so
+ * they are rediscovered in the same order. Of a lazy branch directly below, only the current twig
+ * and the twigs branch_twig_left keeps stay, so a wide branch doesn't keep a twig per value.
+ */
+static void branch_release_twig(BranchTwig *twig)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ListNode *node;
+    if(!ctx->streaming_active) {
+        return;
+    }
+    for(node = twig->subbranches.next; node != &twig->subbranches; node = node->next) {
+        BranchInformation * const branch_info = (BranchInformation*)node->value;
+        BranchTwig *subtwig;
+        unsigned int position = 0;
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            if(!list_empty(&subtwig->subbranches)) {
+                list_free(&subtwig->subbranches, free_branch, (void*)0);
+                subtwig->current_prev_subbranch = &subtwig->subbranches;
+                subtwig->state = FORK_BRANCH_STATE_UNINITIALIZED;
+            }
+            if(branch_info->twigs == NULL && subtwig->value != branch_info->current_twig_idx && branch_twig_left(subtwig)) {
+                position--;
+            }
+        }
+    }
+}
+
+/* The current twig of the branch is left for another one */
+static void branch_leave_twig(BranchInformation *branch_info)
+{
+    BranchTwig * const twig = branch_twig(branch_info, branch_info->current_twig_idx);
+    branch_release_twig(twig);
+    branch_twig_left(twig);
+}
+
 static void branch_try_mutate( void )
 {
-    if( global_branch_information.prev_mutate_subbranch == global_branch_information.current_branch)
+    BranchesInformation * const ctx = branch_current_context();
+    if( ctx->prev_mutate_subbranch == ctx->current_branch)
     {
         /* Mutate */
-        global_branch_information.current_branch->current_twig_idx++;
-        global_branch_information.prev_mutate_subbranch = NULL; /* Record that we have mutated a subbranch */
+        branch_leave_twig(ctx->current_branch);
+        ctx->current_branch->current_twig_idx++;
+        ctx->prev_mutate_subbranch = NULL; /* Record that we have mutated a subbranch */
     }
-    else if((global_branch_information.nesting_level > global_branch_information.prev_mutate_subbranch_nesting_level) ||
-             (((global_branch_information.nesting_level + 1) == global_branch_information.prev_mutate_subbranch_nesting_level) && (global_branch_information.prev_mutate_subbranch == NULL)))
+    else if((ctx->nesting_level > ctx->prev_mutate_subbranch_nesting_level) ||
+             (((ctx->nesting_level + 1) == ctx->prev_mutate_subbranch_nesting_level) && (ctx->prev_mutate_subbranch == NULL)))
     {
-        global_branch_information.current_branch->current_twig_idx = 0;
+        branch_leave_twig(ctx->current_branch);
+        ctx->current_branch->current_twig_idx = 0;
     }
 }
 
-unsigned int _branch_start(const char* const name, unsigned int num_twigs, char const * const * const twig_names, const char* const file, const int line, const char* const function_name)
+/* Leave the current branch, recording it for mutation if it has twigs left */
+static void branch_unnest(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchTwig *inner_twig;
+    if(!ctx->current_branch->pinned &&
+       (ctx->current_branch->current_twig_idx != (ctx->current_branch->num_twigs - 1)) &&
+       (!branch_skips_twigs() || branch_twigs_remaining(ctx->current_branch)) &&
+       (ctx->next_mutate_subbranch_nesting_level <= ctx->nesting_level)) {
+            /* Mark this subbranch as pending mutation */
+            ctx->next_mutate_subbranch = ctx->current_branch;
+            ctx->next_mutate_subbranch_nesting_level = ctx->nesting_level;
+    }
+
+    /* Un-nest branch level */
+    ctx->current_twig->current_prev_subbranch = &ctx->current_twig->subbranches; /* Reset twig of the (inner) subbranch we are leaving */
+    inner_twig = ctx->current_twig;
+    ctx->current_twig = ctx->current_branch->parent_twig;
+    ctx->current_branch =  inner_twig->parent_branch->parent_twig->parent_branch;
+    ctx->nesting_level--;
+}
+
+/* End the current combination early, unwinding its open branches */
+static void branch_truncate_combination(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    /* Twigs entered for the first time may have sub branches after this point that were never seen */
+    while(ctx->nesting_level > 0) {
+        if(ctx->current_twig->state == FORK_BRANCH_STATE_UNINITIALIZED) {
+            ctx->current_twig->state = FORK_BRANCH_STATE_TRUNCATED;
+        }
+        branch_unnest();
+    }
+    if(ctx->trunk.state == FORK_BRANCH_STATE_UNINITIALIZED) {
+        ctx->trunk.state = FORK_BRANCH_STATE_TRUNCATED;
+    }
+    ctx->truncated = 1;
+}
+
+/* Hold a new branch at the twig with the given value */
+static void branch_pin_twig(BranchInformation *branch_info, const unsigned int value)
+{
+    unsigned int i;
+    branch_info->current_twig_idx = value;
+    for(i = 0; branch_info->twigs != NULL && i < branch_info->num_twigs; i++) {
+        if(branch_info->twigs[i].value == value) {
+            branch_info->current_twig_idx = i;
+        }
+    }
+    branch_info->pinned = 1;
+}
+
+/* Twig value taken by a branch below an equivalent twig: the first, or a sample if a seed is set */
+static unsigned int branch_equivalence_sample(const unsigned int num_twigs)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    uint64_t random = ctx->equivalence_random;
+    if(random == 0) {
+        return 0;
+    }
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    ctx->equivalence_random = random;
+    return (unsigned int)(random % num_twigs);
+}
+
+/* Mark the twigs below twig whose sub branches are pinned */
+static void branch_classes_mark(BranchTwig *twig)
+{
+    ListNode *node;
+    for(node = twig->subbranches.next; node != &twig->subbranches; node = node->next) {
+        BranchInformation * const branch_info = (BranchInformation*)node->value;
+        BranchTwig *subtwig;
+        unsigned int position = 0;
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            subtwig->pin_subbranches = subtwig->equivalent || twig->pin_subbranches;
+            branch_classes_mark(subtwig);
+        }
+    }
+}
+
+/* Set the twig classes of a branch discovered without them */
+static void branch_classes_apply(BranchInformation *branch_info, const unsigned int *twig_classes)
+{
+    BranchTwig *twig;
+    unsigned int position = 0;
+    branch_info->twig_classes = twig_classes;
+    while((twig = branch_twig_next(branch_info, &position)) != NULL) {
+        twig->equivalent = branch_class_representative(branch_info, twig->value) != twig->value;
+        twig->pin_subbranches = twig->equivalent || branch_info->parent_twig->pin_subbranches;
+        branch_classes_mark(twig);
+    }
+}
+
+static unsigned int branch_start_point(const char* const name, unsigned int num_twigs, char const * const * const twig_names, const unsigned int *twig_classes, const BranchDomain *domain, const BranchSite *site, const char* const file, const int line, const char* const function_name)
 {
+    BranchesInformation * const ctx = branch_current_context();
     int branch_ret_val = 0;
+    BranchTwigState state;
+    unsigned int path_start;
     if(num_twigs < 2) {
         cm_print_error(SOURCE_LOCATION_FORMAT
                        ": error: Branch start in function %s requested for %d branches, only 2 or more branches are supported\n",
@@ -282,7 +1020,7 @@ unsigned int _branch_start(const char* const name, unsigned int num_twigs, char
         return 0;
     }
 
-    if(!global_branches_enabled) {
+    if(!ctx->enabled) {
         cm_print_error(SOURCE_LOCATION_FORMAT
                        ": error: Branch start in function %s with name %s called outside a test.\n",
                        file, line,function_name, name);
@@ -290,78 +1028,150 @@ unsigned int _branch_start(const char* const name, unsigned int num_twigs, char
         return 0;
     }
 
-    switch (global_branch_information.current_twig->state) {
+    path_start = ctx->path_starts++;
+    if(ctx->path_invalid ||
+       (path_start < ctx->num_pins && ctx->pins[path_start] >= num_twigs)) {
+        cm_print_error(SOURCE_LOCATION_FORMAT
+                       ": error: The selected branch path does not fit branch %s in function %s with %u twigs\n",
+                       file, line, name, function_name, num_twigs);
+        _fail(file, line);
+        return 0;
+    }
+
+    state = ctx->current_twig->state;
+    if(state == FORK_BRANCH_STATE_TRUNCATED) {
+        /* Sub branches after the point where a combination crashed are discovered as new ones */
+        state = ctx->current_twig->current_prev_subbranch->next == &ctx->current_twig->subbranches ?
+                FORK_BRANCH_STATE_UNINITIALIZED : FORK_BRANCH_STATE_DISCOVERED;
+    }
+
+    switch (state) {
         case FORK_BRANCH_STATE_UNINITIALIZED:
         {
             unsigned int i;
             BranchInformation * const new_branch_information =
                     (BranchInformation*)malloc(sizeof(BranchInformation));
-            list_add_value(&global_branch_information.current_twig->subbranches, new_branch_information, 0);
+            list_add_value(&ctx->current_twig->subbranches, new_branch_information, 0);
             /* Initialize branch struct */
             new_branch_information->name = name;
             new_branch_information->file = file;
             new_branch_information->function_name = function_name;
             new_branch_information->line = line;
             new_branch_information->num_twigs = num_twigs;
-            new_branch_information->parent_twig = global_branch_information.current_twig;
+            new_branch_information->parent_twig = ctx->current_twig;
             new_branch_information->twig_names = twig_names;
-            new_branch_information->twigs = (BranchTwig*)malloc(sizeof(BranchTwig)*new_branch_information->num_twigs);
+            new_branch_information->twig_classes = twig_classes;
+            new_branch_information->site = site;
+            new_branch_information->trace_site = 0;
+            new_branch_information->has_domain = domain != NULL;
+            if(domain != NULL) {
+                new_branch_information->domain = *domain;
+            }
             new_branch_information->current_twig_idx = 0;
-            /* Add the twigs */
-            for(i = 0; i < num_twigs; i++) {
-                new_branch_information->twigs[i].state = FORK_BRANCH_STATE_UNINITIALIZED;
-                new_branch_information->twigs[i].current_prev_subbranch = &new_branch_information->twigs[i].subbranches;
-                new_branch_information->twigs[i].parent_branch = new_branch_information;
-                new_branch_information->twigs[i].value = i;
-                list_initialize(&new_branch_information->twigs[i].subbranches);
+            new_branch_information->pinned = 0;
+            new_branch_information->path_start = path_start;
+            new_branch_information->lazy_twigs = NULL;
+            new_branch_information->num_lazy_twigs = 0;
+            new_branch_information->lazy_twigs_capacity = 0;
+            new_branch_information->folded = NULL;
+            if(domain != NULL && num_twigs >= BRANCH_LAZY_MIN_TWIGS) {
+                new_branch_information->twigs = NULL;
+                ctx->discovered_nodes++;
+            } else {
+                new_branch_information->twigs = (BranchTwig*)malloc(sizeof(BranchTwig)*new_branch_information->num_twigs);
+                ctx->discovered_nodes += 1 + num_twigs;
+                /* Add the twigs */
+                for(i = 0; i < num_twigs; i++) {
+                    branch_twig_initialize(&new_branch_information->twigs[i], new_branch_information, i);
+                }
+                /* Twigs that failed in earlier runs are explored first */
+                branch_history_order_twigs(new_branch_information);
+            }
+            if(path_start < ctx->num_pins) {
+                branch_pin_twig(new_branch_information, ctx->pins[path_start]);
+            } else if(ctx->current_twig->pin_subbranches) {
+                /* Below an equivalent twig, one twig stands for the subtree its representative explores */
+                branch_pin_twig(new_branch_information, branch_equivalence_sample(num_twigs));
+                ctx->equivalence_pins++;
+            } else if(branch_skips_twigs()) {
+                branch_twigs_skip(new_branch_information);
             }
             /* Update sub branch information for the current branch level */
-            global_branch_information.current_twig->current_prev_subbranch = (global_branch_information.current_twig->current_prev_subbranch->next);
-            global_branch_information.current_branch = new_branch_information;
-            assert_ptr_equal(global_branch_information.current_twig->current_prev_subbranch->value, new_branch_information);
+            ctx->current_twig->current_prev_subbranch = (ctx->current_twig->current_prev_subbranch->next);
+            ctx->current_branch = new_branch_information;
+            assert_ptr_equal(ctx->current_twig->current_prev_subbranch->value, new_branch_information);
 
             /* Set up the the newly created branch (in next nesting level) as the current twig */
-            global_branch_information.current_twig = &global_branch_information.current_branch->twigs[new_branch_information->current_twig_idx];
-            global_branch_information.nesting_level++;
+            ctx->current_twig = branch_twig(new_branch_information, new_branch_information->current_twig_idx);
+            ctx->nesting_level++;
 
+            /* Update return value */
+            branch_ret_val = ctx->current_twig->value;
         }
         break;
         case FORK_BRANCH_STATE_DISCOVERED:
         {
             ListNode * subbranch_node;
             BranchInformation const * subbranch_information;
-            if (global_branch_information.current_twig->current_prev_subbranch->next == &global_branch_information.current_twig->subbranches) {
+            if (ctx->current_twig->current_prev_subbranch->next == &ctx->current_twig->subbranches) {
                 /* We have looped around the list and now have more sub branches this time than previous runs */
-                cm_print_error("Failend %s\n", global_branch_information.current_twig->current_prev_subbranch->value ? ((const BranchInformation*)global_branch_information.current_twig->current_prev_subbranch->value)->name : "<null>");
+                cm_print_error("Failend %s\n", ctx->current_twig->current_prev_subbranch->value ? ((const BranchInformation*)ctx->current_twig->current_prev_subbranch->value)->name : "<null>");
                 _fail(file, line);
             } else {
                 /* Change to the next sub branch of this twig */
-                global_branch_information.current_twig->current_prev_subbranch = global_branch_information.current_twig->current_prev_subbranch->next;
-                global_branch_information.current_branch = (BranchInformation*) global_branch_information.current_twig->current_prev_subbranch->value;
+                ctx->current_twig->current_prev_subbranch = ctx->current_twig->current_prev_subbranch->next;
+                ctx->current_branch = (BranchInformation*) ctx->current_twig->current_prev_subbranch->value;
             }
 
             /* Validate that the branch matches the parameters */
-            assert_ptr_equal(global_branch_information.current_twig, ((BranchInformation*)global_branch_information.current_twig->current_prev_subbranch->value)->parent_twig);
-            subbranch_node = global_branch_information.current_twig->current_prev_subbranch;
+            assert_ptr_equal(ctx->current_twig, ((BranchInformation*)ctx->current_twig->current_prev_subbranch->value)->parent_twig);
+            subbranch_node = ctx->current_twig->current_prev_subbranch;
             subbranch_information = (const BranchInformation*) subbranch_node->value;
             assert_non_null(subbranch_information);
 
-            if(!branch_info_equal(subbranch_information, name, num_twigs, file, line, function_name)) {
+            /* A branch started from the same call site descriptor matches without comparing its strings */
+            if((site == NULL || subbranch_information->site != site) &&
+               !branch_info_equal(subbranch_information, name, num_twigs, file, line, function_name)) {
                 cm_print_error("Failinfo\n");
                 _fail(file, line);
             }
 
             /* Update global pointers */
-            global_branch_information.current_branch = (BranchInformation*) subbranch_information;
+            ctx->current_branch = (BranchInformation*) subbranch_information;
+            if(ctx->current_branch->site == NULL) {
+                /* The branch was discovered by replaying a combination of another process */
+                ctx->current_branch->site = site;
+            }
+            if(ctx->current_branch->twig_names == NULL) {
+                /* The branch was discovered by replaying a cached combination */
+                ctx->current_branch->twig_names = twig_names;
+            }
+            if(!ctx->current_branch->has_domain && domain != NULL) {
+                ctx->current_branch->domain = *domain;
+                ctx->current_branch->has_domain = 1;
+            }
+            if(ctx->current_branch->twig_classes == NULL && twig_classes != NULL) {
+                /* The branch was discovered by replaying a cached combination */
+                branch_classes_apply(ctx->current_branch, twig_classes);
+            }
+            if(ctx->current_twig->pin_subbranches) {
+                ctx->current_branch->pinned = 1;
+            }
 
-            branch_try_mutate();
+            ctx->current_branch->path_start = path_start;
+            if(!ctx->current_branch->pinned) {
+                branch_try_mutate();
+                if(branch_skips_twigs()) {
+                    branch_twigs_skip(ctx->current_branch);
+                }
+            }
 
             /* Update global pointers */
-            global_branch_information.current_twig = &global_branch_information.current_branch->twigs[global_branch_information.current_branch->current_twig_idx];
-            global_branch_information.nesting_level++;
+            ctx->current_twig = branch_twig(ctx->current_branch, ctx->current_branch->current_twig_idx);
+            ctx->nesting_level++;
 
             /* Update return value */
-            branch_ret_val = global_branch_information.current_twig->value;
+            branch_ret_val = ctx->current_twig->value;
         }
         break;
         default:
@@ -369,20 +1179,31 @@ unsigned int _branch_start(const char* const name, unsigned int num_twigs, char
             _fail(file, line);
         break;
     }
+    if(ctx->num_exclusions != 0) {
+        branch_exclusions_mark(ctx->current_branch, branch_ret_val, path_start);
+    }
+    if(ctx->complement_active && path_start < ctx->planned_depth) {
+        ctx->complement_values[path_start] = branch_ret_val;
+    }
+    if(path_start < ctx->timings.active_depth) {
+        ctx->timings.values[path_start] = branch_ret_val;
+        ctx->timings.branches[path_start] = ctx->current_branch;
+    }
+    branch_isolation_send_start(name, num_twigs, twig_names, twig_classes, domain, site, file, line, function_name);
     return branch_ret_val;
 }
 
-void _branch_end(const char* const name, const char* const file, const int line, const char* const function_name)
+static void branch_end_point(const char* const name, const BranchSite *site, const char* const file, const int line, const char* const function_name)
 {
-    BranchTwig *inner_twig;
-    if(!global_branches_enabled) {
+    BranchesInformation * const ctx = branch_current_context();
+    if(!ctx->enabled) {
         cm_print_error(SOURCE_LOCATION_FORMAT
                        ": error: Branch start in function %s called outside a test.\n",
                        file, line,function_name);
         _fail(file, line);
         return;
     }
-    if(global_branch_information.current_branch == NULL) {
+    if(ctx->current_branch == NULL) {
         cm_print_error(SOURCE_LOCATION_FORMAT
                        ": error: Branch end requested in function %s using name \"%s\", but no branch started.\n",
                        file, line,
@@ -390,182 +1211,4500 @@ void _branch_end(const char* const name, const char* const file, const int line,
         _fail(file, line);
         return;
     }
-    if(strcmp(name, global_branch_information.current_branch->name) != 0) {
+    if((site == NULL || site != ctx->current_branch->site) &&
+       strcmp(name, ctx->current_branch->name) != 0) {
         cm_print_error(SOURCE_LOCATION_FORMAT
                        ": error: Branch end in function %s using name \"%s\". Expected name \"%s\" as used by last branch start\n",
                        file, line,
-                       function_name, name, global_branch_information.current_branch->name);
+                       function_name, name, ctx->current_branch->name);
         _fail(file, line);
         return;
     }
 
-    if(global_branch_information.current_branch != global_branch_information.current_branch->parent_twig->current_prev_subbranch->value) {
+    if(ctx->current_branch != ctx->current_branch->parent_twig->current_prev_subbranch->value) {
         cm_print_error(SOURCE_LOCATION_FORMAT
                        ": error: Inconsistent amount of branch start/end function pairs detected in function %s using name \"%s\", with cmocka recorded branch name \"%s\".\n",
                        file, line,
-                       function_name, name, global_branch_information.current_branch->name);
+                       function_name, name, ctx->current_branch->name);
         _fail(file, line);
         return;
     }
 
-    if(global_branch_information.current_twig->state == FORK_BRANCH_STATE_UNINITIALIZED) {
-        global_branch_information.current_twig->state = FORK_BRANCH_STATE_DISCOVERED;
+    if(ctx->current_twig->state == FORK_BRANCH_STATE_UNINITIALIZED ||
+       ctx->current_twig->state == FORK_BRANCH_STATE_TRUNCATED) {
+        ctx->equivalent_twigs += ctx->current_twig->state == FORK_BRANCH_STATE_UNINITIALIZED &&
+                                                      ctx->current_twig->equivalent;
+        ctx->current_twig->state = FORK_BRANCH_STATE_DISCOVERED;
     }
-    else if (global_branch_information.current_twig->state != FORK_BRANCH_STATE_DISCOVERED) {
+    else if (ctx->current_twig->state != FORK_BRANCH_STATE_DISCOVERED) {
         _fail(file, line);
     }
 
-    if((global_branch_information.current_branch->current_twig_idx != (global_branch_information.current_branch->num_twigs - 1)) &&
-       (global_branch_information.next_mutate_subbranch_nesting_level <= global_branch_information.nesting_level)) {
-            /* Mark this subbranch as pending mutation */
-            global_branch_information.next_mutate_subbranch = global_branch_information.current_branch;
-            global_branch_information.next_mutate_subbranch_nesting_level = global_branch_information.nesting_level;
-    }
-
-    /* Un-nest branch level */
-    global_branch_information.current_twig->current_prev_subbranch = &global_branch_information.current_twig->subbranches; /* Reset twig of the (inner) subbranch we are leaving */
-    inner_twig = global_branch_information.current_twig;
-    global_branch_information.current_twig = global_branch_information.current_branch->parent_twig;
-    global_branch_information.current_branch =  inner_twig->parent_branch->parent_twig->parent_branch;
-    global_branch_information.nesting_level--;
-
+    branch_unnest();
+    branch_isolation_send_end(name, file, line, function_name);
 }
 
-static BranchRestartCode branches_restart( void )
+/* Calls made by the engine itself, for example to malloc, are not fault points */
+static unsigned int branch_start_domain(const char* const name, unsigned int num_twigs, char const * const * const twig_names, const unsigned int *twig_classes, const BranchDomain *domain, const BranchSite *site, const char* const file, const int line, const char* const function_name)
 {
-    if(((global_branch_information.current_twig != &global_branch_information.trunk) ||
-                   (global_branch_information.nesting_level != 0))) {
-        cm_print_error("ERROR: Number of branch ends doesn't match branch starts in top level\n");
-        fail();
-        return FORK_RESTART_CODE_ERROR;
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int value;
+    ctx->faults_suspended++;
+    value = branch_start_point(name, num_twigs, twig_names, twig_classes, domain, site, file, line, function_name);
+    if(branch_trace.active) {
+        branch_trace_record(BRANCH_TRACE_BRANCH_START, branch_trace_site(ctx->current_branch), value);
     }
-    if((global_branch_information.current_twig->current_prev_subbranch->next != &global_branch_information.current_twig->subbranches)) {
-        cm_print_error("ERROR: Number of branches in top level not consistent between runs\n");
-        fail();
-        return FORK_RESTART_CODE_ERROR;
+    if(ctx->monitor != NULL) {
+        ctx->monitor_path_id = (ctx->monitor_path_id ^ ((uint64_t)line << 16 ^ value)) * BRANCH_MONITOR_PATH_ID_PRIME;
+        if(ctx->nesting_level > ctx->monitor_depth) {
+            ctx->monitor_depth = ctx->nesting_level;
+        }
     }
-
-    if(global_branch_information.current_twig->state == FORK_BRANCH_STATE_UNINITIALIZED) {
-        global_branch_information.current_twig->state = FORK_BRANCH_STATE_DISCOVERED;
+    /*
+     * Excluded and planned twigs are skipped when the twig is chosen, only a held branch or one
+     * without a twig left ends up here. Only checked while a combination runs here, the parent of
+     * isolated combinations learns about pruning from the children.
+     */
+    if(branch_skips_twigs() && ctx->prune_env != NULL &&
+       branch_twig_skipped(ctx->current_branch, value)) {
+        branch_prune();
     }
-
-    global_branch_information.prev_mutate_subbranch = global_branch_information.next_mutate_subbranch;
-    global_branch_information.prev_mutate_subbranch_nesting_level = global_branch_information.next_mutate_subbranch_nesting_level;
-    global_branch_information.next_mutate_subbranch = NULL;
-    global_branch_information.next_mutate_subbranch_nesting_level = 0;
-
-    /* Move to the start of the sub branch list for the top twig */
-    global_branch_information.current_twig->current_prev_subbranch = &global_branch_information.current_twig->subbranches; /* Before first subbranch in list */
-    global_branch_information.current_branch = (BranchInformation*) global_branch_information.current_twig->current_prev_subbranch->value;
-
-    return global_branch_information.prev_mutate_subbranch != NULL ? FORK_RESTART_CODE_RESTART : FORK_RESTART_CODE_COMPLETE;
+    ctx->faults_suspended--;
+    return value;
 }
 
-static void branches_init( void )
+unsigned int _branch_start(const char* const name, unsigned int num_twigs, char const * const * const twig_names, const char* const file, const int line, const char* const function_name)
 {
-    global_branch_information.trunk.state = FORK_BRANCH_STATE_UNINITIALIZED;
-    global_branch_information.trunk.parent_branch = NULL;
-    list_initialize(&global_branch_information.trunk.subbranches);
-    list_initialize(&global_branch_information.branchlines);
+    return branch_start_domain(name, num_twigs, twig_names, NULL, NULL, NULL, file, line, function_name);
+}
 
-    global_branch_information.current_branch = NULL;
-    global_branch_information.trunk.current_prev_subbranch = &global_branch_information.trunk.subbranches;
-    global_branch_information.current_twig = &global_branch_information.trunk;
-    global_branch_information.next_mutate_subbranch = NULL;
-    global_branch_information.prev_mutate_subbranch = NULL;
-    global_branch_information.nesting_level = 0;
-    global_branch_information.next_mutate_subbranch_nesting_level = 0;
-    global_branches_enabled = 1;
+unsigned int _branch_start_classes(const char* const name, unsigned int num_twigs, char const * const * const twig_names, const unsigned int *twig_classes, const char* const file, const int line, const char* const function_name)
+{
+    return branch_start_domain(name, num_twigs, twig_names, twig_classes, NULL, NULL, file, line, function_name);
 }
 
-static void free_branch(const void *value, void *cleanup_value_data);
+/* Environment variable with the seed of the twig sampling, used when branch_set_equivalence_seed is not called */
+#define BRANCH_EQUIVALENCE_SEED_ENV "CMOCKA_BRANCHES_EQUIVALENCE_SEED"
 
-static void free_branch_twig(BranchTwig *twig, void *cleanup_value_data)
+void branch_set_equivalence_seed(const unsigned long seed)
 {
-    if(twig != NULL) {
-        list_free(&twig->subbranches, free_branch, cleanup_value_data);
-    }
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->equivalence_seed = seed;
+    /* 0 goes back to the environment */
+    ctx->equivalence_configured = seed != 0;
 }
 
-static void free_branch(const void *value, void *cleanup_value_data)
+static void branch_equivalence_init(void)
 {
-    unsigned int i;
-    if(value != NULL) {
-        BranchInformation * const info = (BranchInformation * ) value;
-        for(i = 0; i < info->num_twigs; i++) {
-            free_branch_twig(&info->twigs[i], cleanup_value_data);
-        }
-        free(info->twigs);
-        free(info);
-    }
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const seed = getenv(BRANCH_EQUIVALENCE_SEED_ENV);
+    /* Spread the bits of small seeds, the first xorshift step keeps them in the low bits. The
+     * multiplier is odd, so only seed 0 gives state 0 */
+    ctx->equivalence_random = (ctx->equivalence_configured || seed == NULL ?
+                               ctx->equivalence_seed : strtoull(seed, NULL, 10)) *
+                              UINT64_C(0x9E3779B97F4A7C15);
+    ctx->equivalent_twigs = 0;
+    ctx->equivalence_pins = 0;
 }
 
-static void branch_print_twig_name(const BranchTwig *twig, unsigned int nesting)
+/*
+ * Value of the twig with the given value index of a value domain branch. Ranges are computed in
+ * unsigned long, as the offset from min of a range over more than half the long values overflows
+ * a long even though the value itself fits.
+ */
+static long branch_domain_value(const BranchDomain *domain, const unsigned int value)
 {
-    unsigned int i;
+    return domain->values != NULL ? domain->values[value] :
+           (long)((unsigned long)domain->min + (unsigned long)value * (unsigned long)domain->step);
+}
+
+long _branch_start_range(const char* const name, const long min, const long max, const long step, const char* const file, const int line, const char* const function_name)
+{
+    BranchDomain domain;
+    unsigned long num_twigs;
+    if(step <= 0 || max < min) {
+        cm_print_error(SOURCE_LOCATION_FORMAT
+                       ": error: Branch range %s in function %s from %ld to %ld with step %ld is empty\n",
+                       file, line, name, function_name, min, max, step);
+        _fail(file, line);
+        return min;
+    }
+    num_twigs = ((unsigned long)max - (unsigned long)min) / (unsigned long)step + 1;
+    if(num_twigs < 2) {
+        cm_print_error(SOURCE_LOCATION_FORMAT
+                       ": error: Branch range %s in function %s from %ld to %ld with step %ld only has the value %ld, 2 or more values are needed\n",
+                       file, line, name, function_name, min, max, step, min);
+        _fail(file, line);
+        return min;
+    }
+    if(num_twigs > UINT_MAX) {
+        cm_print_error(SOURCE_LOCATION_FORMAT
+                       ": error: Branch range %s in function %s has more than %u values\n",
+                       file, line, name, function_name, UINT_MAX);
+        _fail(file, line);
+        return min;
+    }
+    domain.min = min;
+    domain.step = step;
+    domain.values = NULL;
+    return branch_domain_value(&domain, branch_start_domain(name, (unsigned int)num_twigs, NULL, NULL, &domain, NULL, file, line, function_name));
+}
+
+long _branch_start_values(const char* const name, const long *values, const unsigned int num_values, const char* const file, const int line, const char* const function_name)
+{
+    BranchDomain domain;
+    domain.min = 0;
+    domain.step = 0;
+    domain.values = values;
+    return branch_domain_value(&domain, branch_start_domain(name, num_values, NULL, NULL, &domain, NULL, file, line, function_name));
+}
+
+static void branch_end_traced(const char* const name, const BranchSite *site, const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->faults_suspended++;
+    if(branch_trace.active && ctx->current_branch != NULL) {
+        branch_trace_record(BRANCH_TRACE_BRANCH_END, branch_trace_site(ctx->current_branch), 0);
+    }
+    branch_end_point(name, site, file, line, function_name);
+    ctx->faults_suspended--;
+}
+
+void _branch_end(const char* const name, const char* const file, const int line, const char* const function_name)
+{
+    branch_end_traced(name, NULL, file, line, function_name);
+}
+
+unsigned int _branch_start_site(const BranchSite *site)
+{
+    return branch_start_domain(site->name, site->num_twigs, site->twig_names, NULL, NULL, site, site->file, site->line, site->function_name);
+}
+
+void _branch_end_site(const BranchSite *site)
+{
+    branch_end_traced(site->name, site, site->file, site->line, site->function_name);
+}
+
+static BranchRestartCode branches_restart( void )
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchRestartCode restart;
+    if(ctx->truncated) {
+        /* The combination crashed or was pruned, the top level branches after that point were not reached */
+        ctx->truncated = 0;
+    } else {
+        if(((ctx->current_twig != &ctx->trunk) ||
+                       (ctx->nesting_level != 0))) {
+            cm_print_error("ERROR: Number of branch ends doesn't match branch starts in top level\n");
+            fail();
+            return FORK_RESTART_CODE_ERROR;
+        }
+        if((ctx->current_twig->current_prev_subbranch->next != &ctx->current_twig->subbranches)) {
+            cm_print_error("ERROR: Number of branches in top level not consistent between runs\n");
+            fail();
+            return FORK_RESTART_CODE_ERROR;
+        }
+
+        if(ctx->current_twig->state == FORK_BRANCH_STATE_UNINITIALIZED ||
+           ctx->current_twig->state == FORK_BRANCH_STATE_TRUNCATED) {
+            ctx->current_twig->state = FORK_BRANCH_STATE_DISCOVERED;
+        }
+    }
+
+    /* A replayed path runs a single combination */
+    ctx->prev_mutate_subbranch = ctx->path_replay ? NULL : ctx->next_mutate_subbranch;
+    ctx->prev_mutate_subbranch_nesting_level = ctx->next_mutate_subbranch_nesting_level;
+    ctx->next_mutate_subbranch = NULL;
+    ctx->next_mutate_subbranch_nesting_level = 0;
+
+    /* Move to the start of the sub branch list for the top twig */
+    ctx->current_twig->current_prev_subbranch = &ctx->current_twig->subbranches; /* Before first subbranch in list */
+    ctx->current_branch = (BranchInformation*) ctx->current_twig->current_prev_subbranch->value;
+    restart = ctx->prev_mutate_subbranch != NULL ? FORK_RESTART_CODE_RESTART : FORK_RESTART_CODE_COMPLETE;
+
+    if(restart == FORK_RESTART_CODE_COMPLETE && branch_path_next()) {
+        /* The next path is explored in a new tree, its first branch points are pinned to other twigs */
+        list_free(&ctx->trunk.subbranches, free_branch, (void*)0);
+        branch_trunk_initialize();
+        restart = FORK_RESTART_CODE_RESTART;
+    }
+
+    if(ctx->monitor != NULL) {
+        branch_monitor_update();
+    }
+    BRANCH_TRACE_EVENT(BRANCH_TRACE_RESTART, 0, restart == FORK_RESTART_CODE_RESTART);
+
+    return restart;
+}
+
+static void branch_trunk_initialize(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->trunk.state = FORK_BRANCH_STATE_UNINITIALIZED;
+    ctx->trunk.parent_branch = NULL;
+    ctx->trunk.equivalent = 0;
+    ctx->trunk.pin_subbranches = 0;
+    list_initialize(&ctx->trunk.subbranches);
+
+    ctx->current_branch = NULL;
+    ctx->trunk.current_prev_subbranch = &ctx->trunk.subbranches;
+    ctx->current_twig = &ctx->trunk;
+    ctx->next_mutate_subbranch = NULL;
+    ctx->prev_mutate_subbranch = NULL;
+    ctx->nesting_level = 0;
+    ctx->next_mutate_subbranch_nesting_level = 0;
+}
+
+static void branches_init( void )
+{
+    BranchesInformation * const ctx = branch_current_context();
+    branch_trunk_initialize();
+    ctx->trunk.stats = NULL;
+    list_initialize(&ctx->branchlines);
+    ctx->heap_accounting_active = 0;
+    ctx->collect_twig_stats = (branch_export_path() != NULL);
+    ctx->combinations = 0;
+    ctx->failed_combinations = 0;
+    ctx->pruned_combinations = 0;
+    ctx->time_ns = 0;
+    ctx->prune_env = NULL;
+    ctx->truncated = 0;
+    ctx->isolation.child = 0;
+    ctx->isolation.failures = 0;
+    ctx->streaming_active = branch_streaming();
+    ctx->faults_configured = branch_faults_configured();
+    /* Only the test function makes fault points, see branch_run_combination */
+    ctx->faults_suspended = 1;
+    ctx->discovered_nodes = 0;
+    ctx->perf_active = branch_perf_enabled();
+    if(ctx->perf_active) {
+        ctx->collect_twig_stats = 1;
+        branch_perf_open();
+    }
+    branch_state_snapshot();
+    list_initialize(&ctx->history);
+    ctx->history_modified = 0;
+    branch_history_load();
+    branch_path_load();
+    branch_timing_load();
+    branch_equivalence_init();
+    branch_memo_init();
+    branch_cache_load();
+    branch_monitor_open();
+    branch_trace_open();
+    ctx->enabled = 1;
+}
+
+static void free_branch_twig(BranchTwig *twig, void *cleanup_value_data)
+{
+    if(twig != NULL) {
+        list_free(&twig->subbranches, free_branch, cleanup_value_data);
+    }
+}
+
+static void free_branch(const void *value, void *cleanup_value_data)
+{
+    unsigned int position = 0;
+    if(value != NULL) {
+        BranchInformation * const info = (BranchInformation * ) value;
+        BranchTwig *twig;
+        while((twig = branch_twig_next(info, &position)) != NULL) {
+            free_branch_twig(twig, cleanup_value_data);
+            free(twig->stats);
+            if(info->twigs == NULL) {
+                free(twig);
+            }
+        }
+        free(info->lazy_twigs);
+        free(info->twigs);
+        free(info->folded);
+        free(info);
+    }
+}
+
+static void branch_print_twig_name(const BranchTwig *twig, unsigned int nesting)
+{
+    unsigned int i;
     for(i = 0;i < nesting;i++) {
         branch_print_error("  ");
     }
 
-    if(twig) {
-        if(twig->parent_branch->twig_names != NULL) {
-            branch_print_error("- %s (%s, %d)\n", twig->parent_branch->name, twig->parent_branch->twig_names[twig->value], twig->value);
+    if(twig) {
+        if(twig->parent_branch->has_domain) {
+            branch_print_error("- %s (%ld, %d)\n", twig->parent_branch->name,
+                               branch_domain_value(&twig->parent_branch->domain, twig->value), twig->value);
+        }
+        else if(branch_is_fault_point(twig->parent_branch)) {
+            branch_print_error("- %s (%s, %d) called from " MODULE_OFFSET_FORMAT "\n", twig->parent_branch->name,
+                               twig->parent_branch->twig_names[twig->value], twig->value,
+                               twig->parent_branch->file, twig->parent_branch->line);
+        }
+        else if(twig->parent_branch->twig_names != NULL) {
+            branch_print_error("- %s (%s, %d)\n", twig->parent_branch->name, twig->parent_branch->twig_names[twig->value], twig->value);
+        }
+        else {
+            branch_print_error("- %s (%d)\n", twig->parent_branch->name, twig->value);
+        }
+    } else
+    {
+        branch_print_error("- ????\n");
+    }
+}
+
+/* Called for each twig of the last executed combination, with the nesting level of the twig */
+typedef void (*BranchTwigVisitor)(BranchTwig *twig, unsigned int nesting, void *data);
+
+/*
+ * Visit the twigs of the last executed combination below twig, in the order they were executed.
+ * As the sub branches of a twig must be the same for every run, the combination is given by the
+ * current twig of every sub branch, recursively.
+ */
+static void branch_visit_combination(BranchTwig *twig, unsigned int nesting, BranchTwigVisitor visitor, void *data)
+{
+    ListNode *subbranch_node;
+    for(subbranch_node = twig->subbranches.next; subbranch_node != &twig->subbranches; subbranch_node = subbranch_node->next) {
+        BranchInformation *branch_info = (BranchInformation*)subbranch_node->value;
+        BranchTwig *subtwig = branch_twig(branch_info, branch_info->current_twig_idx);
+        visitor(subtwig, nesting, data);
+        branch_visit_combination(subtwig, nesting + 1, visitor, data);
+    }
+}
+
+static void branch_print_twig_visitor(BranchTwig *twig, unsigned int nesting, void *data)
+{
+    (void)data;
+    branch_print_twig_name(twig, nesting);
+}
+
+/* Print the twig and the twigs it is nested in, outermost first */
+static unsigned int branch_print_twig_ancestry(const BranchTwig *twig)
+{
+    unsigned int nesting = 0;
+    if(twig->parent_branch != NULL) {
+        nesting = branch_print_twig_ancestry(twig->parent_branch->parent_twig);
+        branch_print_twig_name(twig, nesting);
+        nesting++;
+    }
+    return nesting;
+}
+
+/*
+ * Visit the twigs of the combination that is executing: the twigs the given twig is nested in
+ * and, on every nesting level, the current twigs of the branches started before them.
+ * Returns the nesting level below the given twig.
+ */
+static unsigned int branch_visit_current_path_to(BranchTwig *twig, BranchTwigVisitor visitor, void *data)
+{
+    unsigned int nesting = 0;
+    if(twig->parent_branch != NULL) {
+        BranchTwig * const parent_twig = twig->parent_branch->parent_twig;
+        ListNode *current_branch_node;
+        nesting = branch_visit_current_path_to(parent_twig, visitor, data);
+        for(current_branch_node = parent_twig->subbranches.next;
+            current_branch_node->value != twig->parent_branch;
+            current_branch_node = current_branch_node->next) {
+            BranchInformation *branch_info = (BranchInformation*)current_branch_node->value;
+            visitor(branch_twig(branch_info, branch_info->current_twig_idx), nesting, data);
+        }
+        visitor(twig, nesting, data);
+        nesting++;
+    }
+    return nesting;
+}
+
+static void branch_visit_current_path(BranchTwigVisitor visitor, void *data)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->current_twig == &ctx->trunk) {
+        /* Between runs, visit the combination that was executed last */
+        branch_visit_combination(&ctx->trunk, 0, visitor, data);
+    } else {
+        branch_visit_current_path_to(ctx->current_twig, visitor, data);
+    }
+}
+
+void _branch_print_current_path( void )
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->faults_suspended++;
+    branch_print_error("\n");
+    branch_visit_current_path(branch_print_twig_visitor, NULL);
+    ctx->faults_suspended--;
+}
+
+/*****************************************************************************/
+/**** Streaming exploration                                                  ***/
+/*****************************************************************************/
+
+/* Environment variable enabling the streaming exploration, used when branch_set_streaming is not called */
+#define BRANCH_STREAMING_ENV "CMOCKA_BRANCHES_STREAMING"
+
+void branch_set_streaming(const int enabled)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->streaming = enabled;
+}
+
+static int branch_streaming(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const streaming = getenv(BRANCH_STREAMING_ENV);
+    return ctx->streaming || (streaming != NULL && streaming[0] == '1');
+}
+
+/*****************************************************************************/
+/**** Batched branch points                                                  ***/
+/*****************************************************************************/
+
+/*
+ * A batched branch point is a range branch over the batches of width consecutive twigs, so every
+ * combination takes a whole batch and the enumeration advances by the width
+ */
+unsigned int _branch_start_batch(BranchBatch *batch, const char* const name, const unsigned int num_twigs, const unsigned int width,
+                                 const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchDomain domain;
+    unsigned int num_batches;
+    batch->name = name;
+    batch->first = 0;
+    batch->lanes = 0;
+    batch->mask = 0;
+    batch->failed = 0;
+    batch->started = 0;
+    batch->path_start = UINT_MAX;
+    if(width == 0 || width > BRANCH_BATCH_MAX_LANES || num_twigs < 2) {
+        cm_print_error(SOURCE_LOCATION_FORMAT
+                       ": error: Batched branch %s in function %s with %u twigs needs a width from 1 to %u and 2 or more twigs\n",
+                       file, line, name, function_name, num_twigs, BRANCH_BATCH_MAX_LANES);
+        _fail(file, line);
+        return 0;
+    }
+    num_batches = num_twigs / width + (num_twigs % width != 0);
+    if(num_batches >= 2) {
+        domain.min = 0;
+        domain.step = (long)width;
+        domain.values = NULL;
+        batch->first = (unsigned int)branch_domain_value(&domain, branch_start_domain(name, num_batches, NULL, NULL, &domain, NULL, file, line, function_name));
+        batch->started = 1;
+        batch->path_start = ctx->path_starts - 1;
+    }
+    batch->lanes = num_twigs - batch->first < width ? num_twigs - batch->first : width;
+    if(batch->started && batch->path_start < ctx->num_pins && ctx->pin_lanes[batch->path_start] != 0) {
+        /* The path selects a single lane, to replay the failure of one twig */
+        const unsigned int lane = ctx->pin_lanes[batch->path_start] - 1;
+        if(lane >= batch->lanes) {
+            cm_print_error(SOURCE_LOCATION_FORMAT ": error: The selected branch path has lane %u of batched branch %s with %u lanes\n",
+                           file, line, lane, name, batch->lanes);
+            _fail(file, line);
+            return 0;
+        }
+        batch->first += lane;
+        batch->lanes = 1;
+    }
+    batch->mask = batch->lanes == 64 ? ~(uint64_t)0 : ((uint64_t)1 << batch->lanes) - 1;
+    return batch->lanes;
+}
+
+void _branch_batch_fail_lane(BranchBatch *batch, const unsigned int lane, const char* const expression, const char* const file, const int line)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->faults_suspended++;
+    cm_print_error("%s\n" SOURCE_LOCATION_FORMAT ": error: Lane %u of batched branch %s failed for twig %u\n",
+                   expression, file, line, lane, batch->name, batch->first + lane);
+    ctx->faults_suspended--;
+    if(lane < batch->lanes) {
+        batch->failed |= (uint64_t)1 << lane;
+    } else {
+        _fail(file, line);
+    }
+}
+
+void _branch_end_batch(BranchBatch *batch, const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int lane;
+    if(batch->started) {
+        branch_end_traced(batch->name, NULL, file, line, function_name);
+        batch->started = 0;
+    }
+    if(batch->failed != 0) {
+        /* The combination fails, faults stay suspended until the exploration ends */
+        ctx->faults_suspended++;
+        /* Report the twig of every failed lane, the path of the batch follows with the failure */
+        cm_print_error(SOURCE_LOCATION_FORMAT ": error: Batched branch %s failed for twigs", file, line, batch->name);
+        for(lane = 0; lane < batch->lanes; lane++) {
+            if(batch->failed & ((uint64_t)1 << lane)) {
+                cm_print_error(" %u", batch->first + lane);
+            }
+        }
+        cm_print_error("\n");
+        /* A path id per lane replays just that lane */
+        for(lane = 0; batch->path_start != UINT_MAX && lane < batch->lanes; lane++) {
+            if(batch->failed & ((uint64_t)1 << lane)) {
+                branch_print_path_id_lane(batch->path_start, lane);
+            }
+        }
+        _fail(file, line);
+    }
+}
+
+/*****************************************************************************/
+/**** Cooperative threads                                                    ***/
+/*****************************************************************************/
+
+/* Environment variable with the preemption bound, used when branch_set_preemption_bound is not called */
+#define BRANCH_PREEMPTIONS_ENV "CMOCKA_BRANCHES_PREEMPTIONS"
+#define BRANCH_PREEMPTIONS_DEFAULT 2
+#define BRANCH_THREAD_STACK_SIZE (256 * 1024)
+/* Name of the branch points choosing the next thread */
+#define BRANCH_THREAD_SWITCH "thread switch"
+
+void branch_set_preemption_bound(const unsigned int bound)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->scheduler.configured = 1;
+    ctx->scheduler.preemption_bound = bound;
+}
+
+static unsigned int branch_preemption_bound(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char *bound;
+    if(ctx->scheduler.configured) {
+        return ctx->scheduler.preemption_bound;
+    }
+    bound = getenv(BRANCH_PREEMPTIONS_ENV);
+    return bound != NULL ? (unsigned int)strtoul(bound, NULL, 10) : BRANCH_PREEMPTIONS_DEFAULT;
+}
+
+unsigned int branch_thread_self(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    return ctx->scheduler.current;
+}
+
+/* Free the threads of the last run, also those left behind by a failure */
+static void branch_threads_release(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchScheduler * const scheduler = &ctx->scheduler;
+    unsigned int i;
+    for(i = 0; i < scheduler->num_threads; i++) {
+        free(scheduler->threads[i]->stack);
+        free(scheduler->threads[i]);
+    }
+    free(scheduler->threads);
+    free(scheduler->candidates);
+    scheduler->threads = NULL;
+    scheduler->candidates = NULL;
+    scheduler->num_threads = 0;
+    scheduler->threads_capacity = 0;
+    scheduler->current = 0;
+    scheduler->running = 0;
+    scheduler->open_choices = 0;
+}
+
+/*
+ * Choose the thread to run next, returns its index + 1 or 0 when no thread can run. Continuing the
+ * thread that stopped is the first twig, switching away from it while it could go on is a
+ * preemption and is only offered while the preemption bound allows.
+ */
+static unsigned int branch_threads_choose(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchScheduler * const scheduler = &ctx->scheduler;
+    const unsigned int previous = scheduler->current;
+    unsigned int num_candidates = 0;
+    unsigned int twig;
+    unsigned int i;
+    if(previous != 0 && scheduler->threads[previous - 1]->state == BRANCH_THREAD_RUNNABLE) {
+        scheduler->candidates[num_candidates++] = previous;
+    }
+    for(i = 1; i <= scheduler->num_threads; i++) {
+        if(i != previous && scheduler->threads[i - 1]->state == BRANCH_THREAD_RUNNABLE) {
+            scheduler->candidates[num_candidates++] = i;
+        }
+    }
+    if(num_candidates == 0) {
+        return 0;
+    }
+    if(num_candidates == 1 || (scheduler->candidates[0] == previous && scheduler->preemptions >= scheduler->active_bound)) {
+        return scheduler->candidates[0];
+    }
+    twig = branch_start_domain(BRANCH_THREAD_SWITCH, num_candidates, NULL, NULL, NULL, NULL,
+                               scheduler->file, scheduler->line, scheduler->function_name);
+    scheduler->open_choices++;
+    if(twig != 0 && scheduler->candidates[0] == previous) {
+        scheduler->preemptions++;
+    }
+    return scheduler->candidates[twig];
+}
+
+#ifdef BRANCH_THREADS_SUPPORTED
+
+static void branch_thread_entry(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchScheduler * const scheduler = &ctx->scheduler;
+    BranchThread * const thread = scheduler->threads[scheduler->current - 1];
+    thread->func(thread->arg);
+    thread->state = BRANCH_THREAD_FINISHED;
+    /* Returns to the scheduler through uc_link */
+}
+
+unsigned int branch_thread_create(BranchThreadFunction func, void *arg)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchScheduler * const scheduler = &ctx->scheduler;
+    BranchThread *thread;
+    ctx->faults_suspended++;
+    if(scheduler->num_threads == scheduler->threads_capacity) {
+        scheduler->threads_capacity = scheduler->threads_capacity != 0 ? 2 * scheduler->threads_capacity : 4;
+        scheduler->threads = (BranchThread**)realloc(scheduler->threads, scheduler->threads_capacity * sizeof(BranchThread*));
+        scheduler->candidates = (unsigned int*)realloc(scheduler->candidates, scheduler->threads_capacity * sizeof(unsigned int));
+    }
+    thread = (BranchThread*)malloc(sizeof(BranchThread));
+    thread->func = func;
+    thread->arg = arg;
+    thread->state = BRANCH_THREAD_RUNNABLE;
+    thread->waiting_for = NULL;
+    thread->stack = (unsigned char*)malloc(BRANCH_THREAD_STACK_SIZE);
+    getcontext(&thread->context);
+    thread->context.uc_stack.ss_sp = thread->stack;
+    thread->context.uc_stack.ss_size = BRANCH_THREAD_STACK_SIZE;
+    thread->context.uc_link = &scheduler->scheduler_context;
+    makecontext(&thread->context, branch_thread_entry, 0);
+    scheduler->threads[scheduler->num_threads++] = thread;
+    ctx->faults_suspended--;
+    return scheduler->num_threads;
+}
+
+/* Leave the running thread for the scheduler, which resumes it when it is chosen again */
+static void branch_thread_switch(const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchScheduler * const scheduler = &ctx->scheduler;
+    scheduler->file = file;
+    scheduler->line = line;
+    scheduler->function_name = function_name;
+    swapcontext(&scheduler->threads[scheduler->current - 1]->context, &scheduler->scheduler_context);
+}
+
+void _branch_threads_run(const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchScheduler * const scheduler = &ctx->scheduler;
+    unsigned int next;
+    unsigned int i;
+    if(scheduler->running) {
+        cm_print_error(SOURCE_LOCATION_FORMAT ": error: Test threads run from function %s, which runs in a test thread\n",
+                       file, line, function_name);
+        _fail(file, line);
+        return;
+    }
+    scheduler->running = 1;
+    scheduler->active_bound = branch_preemption_bound();
+    scheduler->preemptions = 0;
+    scheduler->open_choices = 0;
+    scheduler->current = 0;
+    scheduler->file = file;
+    scheduler->line = line;
+    scheduler->function_name = function_name;
+    while((next = branch_threads_choose()) != 0) {
+        scheduler->current = next;
+        swapcontext(&scheduler->scheduler_context, &scheduler->threads[next - 1]->context);
+    }
+    scheduler->current = 0;
+    for(i = 0; i < scheduler->num_threads; i++) {
+        if(scheduler->threads[i]->state == BRANCH_THREAD_BLOCKED) {
+            cm_print_error(SOURCE_LOCATION_FORMAT ": error: Deadlock, thread %u and the other unfinished threads wait for mutexes, last switch in function %s\n",
+                           scheduler->file, scheduler->line, i + 1, scheduler->function_name);
+            _fail(file, line);
+            return;
+        }
+    }
+    for(; scheduler->open_choices > 0; scheduler->open_choices--) {
+        branch_end_traced(BRANCH_THREAD_SWITCH, NULL, file, line, function_name);
+    }
+    branch_threads_release();
+}
+
+#else
+
+unsigned int branch_thread_create(BranchThreadFunction func, void *arg)
+{
+    cm_print_error("ERROR: Test threads are not supported on this platform\n");
+    fail();
+    (void)func;
+    (void)arg;
+    return 0;
+}
+
+static void branch_thread_switch(const char* const file, const int line, const char* const function_name)
+{
+    (void)file;
+    (void)line;
+    (void)function_name;
+}
+
+void _branch_threads_run(const char* const file, const int line, const char* const function_name)
+{
+    cm_print_error(SOURCE_LOCATION_FORMAT ": error: Test threads in function %s are not supported on this platform\n",
+                   file, line, function_name);
+    _fail(file, line);
+}
+
+#endif
+
+void _branch_yield(const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->scheduler.current != 0) {
+        branch_thread_switch(file, line, function_name);
+    }
+}
+
+void _branch_mutex_lock(BranchMutex *mutex, const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchScheduler * const scheduler = &ctx->scheduler;
+    _branch_yield(file, line, function_name);
+    while(mutex->locked) {
+        if(scheduler->current == 0) {
+            cm_print_error(SOURCE_LOCATION_FORMAT ": error: Deadlock, mutex locked by thread %u is locked again in function %s outside the test threads\n",
+                           file, line, mutex->owner, function_name);
+            _fail(file, line);
+            return;
+        }
+        scheduler->threads[scheduler->current - 1]->state = BRANCH_THREAD_BLOCKED;
+        scheduler->threads[scheduler->current - 1]->waiting_for = mutex;
+        branch_thread_switch(file, line, function_name);
+    }
+    mutex->locked = 1;
+    mutex->owner = scheduler->current;
+}
+
+void _branch_mutex_unlock(BranchMutex *mutex, const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchScheduler * const scheduler = &ctx->scheduler;
+    unsigned int i;
+    if(!mutex->locked || mutex->owner != scheduler->current) {
+        cm_print_error(SOURCE_LOCATION_FORMAT ": error: Mutex unlocked in function %s by thread %u, which doesn't hold it\n",
+                       file, line, function_name, scheduler->current);
+        _fail(file, line);
+        return;
+    }
+    mutex->locked = 0;
+    for(i = 0; i < scheduler->num_threads; i++) {
+        if(scheduler->threads[i]->state == BRANCH_THREAD_BLOCKED && scheduler->threads[i]->waiting_for == mutex) {
+            scheduler->threads[i]->state = BRANCH_THREAD_RUNNABLE;
+            scheduler->threads[i]->waiting_for = NULL;
+        }
+    }
+    _branch_yield(file, line, function_name);
+}
+
+/* Atomics are sync points, the access itself can't be interrupted as the threads are cooperative */
+long _branch_atomic_load(const long *object, const char* const file, const int line, const char* const function_name)
+{
+    _branch_yield(file, line, function_name);
+    return *object;
+}
+
+void _branch_atomic_store(long *object, const long value, const char* const file, const int line, const char* const function_name)
+{
+    _branch_yield(file, line, function_name);
+    *object = value;
+}
+
+long _branch_atomic_fetch_add(long *object, const long value, const char* const file, const int line, const char* const function_name)
+{
+    long previous;
+    _branch_yield(file, line, function_name);
+    previous = *object;
+    *object = previous + value;
+    return previous;
+}
+
+int _branch_atomic_compare_exchange(long *object, long *expected, const long desired, const char* const file, const int line, const char* const function_name)
+{
+    _branch_yield(file, line, function_name);
+    if(*object == *expected) {
+        *object = desired;
+        return 1;
+    }
+    *expected = *object;
+    return 0;
+}
+
+/*****************************************************************************/
+/**** Path selection                                                         ***/
+/*****************************************************************************/
+
+/* Environment variables selecting a path, used when branch_set_path is not called */
+#define BRANCH_PATH_ENV "CMOCKA_BRANCHES_PATH"
+#define BRANCH_REPLAY_ENV "CMOCKA_BRANCHES_REPLAY"
+/* Environment variables selecting a shard, used when branch_set_shard is not called */
+#define BRANCH_SHARD_PLAN_ENV "CMOCKA_BRANCHES_SHARD_PLAN"
+#define BRANCH_SHARD_ENV "CMOCKA_BRANCHES_SHARD"
+/* Fields of a shard plan line: test name, shard and path */
+#define BRANCH_SHARD_PLAN_FIELDS 3
+
+void branch_set_path(const char *path, const int replay)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->path = path;
+    ctx->path_replay = replay;
+    ctx->path_configured = 1;
+}
+
+void branch_set_shard(const char *plan, const unsigned int shard)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->shard_plan = plan;
+    ctx->shard = shard;
+    ctx->shard_configured = 1;
+}
+
+static void branch_path_add(const char *path)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->paths = (char**)realloc(ctx->paths,
+                                                      (ctx->num_paths + 1) * sizeof(char*));
+    ctx->paths[ctx->num_paths++] = branch_strdup(path);
+}
+
+/*
+ * Add the paths of the shard of the plan to explore. The first shard explores the tests the plan
+ * doesn't know in full, returns 0 for them. After its own paths it explores the subtrees of the
+ * test that no shard has in the plan, such as ones added since the timings were recorded.
+ */
+static int branch_shard_load(const char *plan, const unsigned int shard)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    char *line = NULL;
+    size_t line_size = 0;
+    FILE * const plan_file = fopen(plan, "r");
+    if(plan_file == NULL) {
+        cm_print_error("ERROR: Could not read the shard plan %s\n", plan);
+        return 0;
+    }
+    while(branch_read_line(plan_file, &line, &line_size) != NULL) {
+        char *fields[BRANCH_SHARD_PLAN_FIELDS];
+        unsigned int depth = 1;
+        const char *dot;
+        line[strcspn(line, "\r\n")] = '\0';
+        if(line[0] == '#' || branch_split_fields(line, fields, BRANCH_SHARD_PLAN_FIELDS) != BRANCH_SHARD_PLAN_FIELDS ||
+           strcmp(fields[0], ctx->test_name) != 0) {
+            continue;
+        }
+        if((unsigned int)strtoul(fields[1], NULL, 10) == shard) {
+            branch_path_add(fields[2]);
+        }
+        ctx->planned_paths = (char**)realloc(ctx->planned_paths, (ctx->num_planned_paths + 1) * sizeof(char*));
+        ctx->planned_paths[ctx->num_planned_paths++] = branch_strdup(fields[2]);
+        for(dot = strchr(fields[2], '.'); dot != NULL; dot = strchr(dot + 1, '.')) {
+            depth++;
+        }
+        if(depth > ctx->planned_depth) {
+            ctx->planned_depth = depth;
+        }
+    }
+    free(line);
+    fclose(plan_file);
+    if(ctx->num_planned_paths != 0 && shard == 0) {
+        /* The empty path explores the whole test, passing over the planned paths */
+        ctx->complement_values = (unsigned int*)calloc(ctx->planned_depth, sizeof(unsigned int));
+        branch_path_add("");
+    }
+    return ctx->num_planned_paths != 0 || shard != 0;
+}
+
+/*
+ * Returns 1 if the path has exactly the twig values of the first position branch points of the
+ * combination followed by value
+ */
+static int branch_complement_matches(const char *path, const unsigned int position, const unsigned int value)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    for(i = 0; i <= position; i++) {
+        char *next;
+        const unsigned long twig = strtoul(path, &next, 10);
+        if(next == path || twig != (i < position ? ctx->complement_values[i] : value) ||
+           (i < position ? *next != '.' : *next != '\0')) {
+            return 0;
+        }
+        path = next + 1;
+    }
+    return 1;
+}
+
+/* Returns 1 while exploring the rest of a test if twig value at position leads into a planned path */
+static int branch_complement_planned(const unsigned int value, const unsigned int position)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    if(!ctx->complement_active || position >= ctx->planned_depth) {
+        return 0;
+    }
+    for(i = 0; i < ctx->num_planned_paths; i++) {
+        if(branch_complement_matches(ctx->planned_paths[i], position, value)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Parse a path into the twig values the first branch points are pinned to */
+static void branch_path_parse(const char *path)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const full_path = path;
+    unsigned int capacity = 0;
+    free(ctx->pins);
+    free(ctx->pin_lanes);
+    ctx->pins = NULL;
+    ctx->pin_lanes = NULL;
+    ctx->num_pins = 0;
+    /* Only the first shard adds an empty path, after its own */
+    ctx->complement_active = path[0] == '\0' && ctx->num_planned_paths != 0;
+    while(path[0] != '\0') {
+        char *next;
+        const unsigned long value = strtoul(path, &next, 10);
+        unsigned long lane = 0;
+        int valid_lane = 1;
+        if(next != path && *next == '+') {
+            const char * const lane_start = next + 1;
+            lane = strtoul(lane_start, &next, 10) + 1;
+            valid_lane = next != lane_start && lane <= BRANCH_BATCH_MAX_LANES;
+        }
+        if(next == path || !valid_lane || (*next != '.' && *next != '\0') || value >= UINT_MAX) {
+            cm_print_error("ERROR: Malformed branch path \"%s\", expected twig values separated by dots, batches with an optional +lane\n", full_path);
+            ctx->path_invalid = 1;
+            return;
+        }
+        if(ctx->num_pins == capacity) {
+            capacity = capacity != 0 ? 2 * capacity : 8;
+            ctx->pins = (unsigned int*)realloc(ctx->pins, capacity * sizeof(unsigned int));
+            ctx->pin_lanes = (unsigned int*)realloc(ctx->pin_lanes, capacity * sizeof(unsigned int));
+        }
+        ctx->pin_lanes[ctx->num_pins] = (unsigned int)lane;
+        ctx->pins[ctx->num_pins++] = (unsigned int)value;
+        path = *next == '.' ? next + 1 : next;
+    }
+}
+
+/* Collect the paths to explore from the path or shard settings, and pin the first one */
+static void branch_path_load(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char *path = ctx->path;
+    const char *plan = ctx->shard_plan;
+    unsigned int shard = ctx->shard;
+    ctx->pins = NULL;
+    ctx->pin_lanes = NULL;
+    ctx->num_pins = 0;
+    ctx->paths = NULL;
+    ctx->num_paths = 0;
+    ctx->path_index = 0;
+    ctx->path_restricted = 0;
+    ctx->path_starts = 0;
+    ctx->path_invalid = 0;
+    ctx->planned_paths = NULL;
+    ctx->num_planned_paths = 0;
+    ctx->planned_depth = 0;
+    ctx->complement_values = NULL;
+    ctx->complement_active = 0;
+    if(!ctx->path_configured) {
+        path = getenv(BRANCH_REPLAY_ENV);
+        ctx->path_replay = path != NULL && path[0] != '\0';
+        if(!ctx->path_replay) {
+            path = getenv(BRANCH_PATH_ENV);
+        }
+    }
+    if(!ctx->shard_configured) {
+        const char * const shard_env = getenv(BRANCH_SHARD_ENV);
+        plan = getenv(BRANCH_SHARD_PLAN_ENV);
+        shard = shard_env != NULL ? (unsigned int)strtoul(shard_env, NULL, 10) : 0;
+    }
+    if(path != NULL && path[0] != '\0') {
+        branch_path_add(path);
+        ctx->path_restricted = 1;
+    } else if(plan != NULL && ctx->test_name != NULL) {
+        ctx->path_restricted = branch_shard_load(plan, shard);
+        if(ctx->path_restricted && ctx->num_paths == 0) {
+            branch_print_message("Branch shard %u: no paths of test %s\n", shard, ctx->test_name);
+        }
+    }
+    if(ctx->num_paths != 0) {
+        branch_path_parse(ctx->paths[0]);
+    } else {
+        ctx->path_replay = 0;
+    }
+}
+
+/* Move on to the next path to explore, returns 0 after the last one */
+static int branch_path_next(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->path_index + 1 >= ctx->num_paths) {
+        return 0;
+    }
+    ctx->path_index++;
+    branch_path_parse(ctx->paths[ctx->path_index]);
+    return 1;
+}
+
+static void branch_path_unload(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    for(i = 0; i < ctx->num_paths; i++) {
+        free(ctx->paths[i]);
+    }
+    free(ctx->paths);
+    free(ctx->pins);
+    free(ctx->pin_lanes);
+    for(i = 0; i < ctx->num_planned_paths; i++) {
+        free(ctx->planned_paths[i]);
+    }
+    free(ctx->planned_paths);
+    free(ctx->complement_values);
+    ctx->planned_paths = NULL;
+    ctx->num_planned_paths = 0;
+    ctx->complement_values = NULL;
+    ctx->complement_active = 0;
+    ctx->paths = NULL;
+    ctx->num_paths = 0;
+    ctx->pins = NULL;
+    ctx->pin_lanes = NULL;
+    ctx->num_pins = 0;
+}
+
+/* Printing state of a path id, the twig at lane_position is followed by the lane */
+typedef struct
+{
+    int first;
+    unsigned int position;
+    unsigned int lane_position;
+    unsigned int lane;
+} BranchPathId;
+
+static void branch_path_id_visitor(BranchTwig *twig, unsigned int nesting, void *data)
+{
+    BranchPathId * const path_id = (BranchPathId*)data;
+    branch_print_error(path_id->first ? "%u" : ".%u", twig->value);
+    if(path_id->position++ == path_id->lane_position) {
+        branch_print_error("+%u", path_id->lane);
+    }
+    path_id->first = 0;
+    (void)nesting;
+}
+
+/* Visit the sub branches of the twig up to and including the given one, with their sub branches */
+static void branch_path_id_started(BranchTwig *twig, const ListNode *last, BranchPathId *path_id)
+{
+    ListNode *subbranch_node;
+    if(last == &twig->subbranches) {
+        return;
+    }
+    for(subbranch_node = twig->subbranches.next; subbranch_node != &twig->subbranches; subbranch_node = subbranch_node->next) {
+        BranchInformation *branch_info = (BranchInformation*)subbranch_node->value;
+        BranchTwig *subtwig = branch_twig(branch_info, branch_info->current_twig_idx);
+        branch_path_id_visitor(subtwig, 0, path_id);
+        branch_visit_combination(subtwig, 0, branch_path_id_visitor, path_id);
+        if(subbranch_node == last) {
+            break;
+        }
+    }
+}
+
+/* Visit the twigs of the running combination that were entered before the given twig, in start order */
+static void branch_path_id_to(BranchTwig *twig, BranchPathId *path_id)
+{
+    if(twig->parent_branch != NULL) {
+        BranchTwig * const parent_twig = twig->parent_branch->parent_twig;
+        ListNode *previous_branch_node = &parent_twig->subbranches;
+        branch_path_id_to(parent_twig, path_id);
+        while(previous_branch_node->next->value != twig->parent_branch) {
+            previous_branch_node = previous_branch_node->next;
+        }
+        branch_path_id_started(parent_twig, previous_branch_node, path_id);
+        branch_path_id_visitor(twig, 0, path_id);
+    }
+}
+
+/*
+ * Print the twig values of the running combination in the order its branch points started, the
+ * form taken by branch_set_path, with the lane of the batched branch point at lane_position
+ */
+static void branch_print_path_id_lane(const unsigned int lane_position, const unsigned int lane)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchTwig * const twig = ctx->current_twig;
+    BranchPathId path_id;
+    path_id.first = 1;
+    path_id.position = 0;
+    path_id.lane_position = lane_position;
+    path_id.lane = lane;
+    branch_print_error("Branch path id: ");
+    branch_path_id_to(twig, &path_id);
+    branch_path_id_started(twig, twig->current_prev_subbranch, &path_id);
+    branch_print_error("\n");
+}
+
+static void branch_print_path_id(void)
+{
+    branch_print_path_id_lane(UINT_MAX, 0);
+}
+
+/*****************************************************************************/
+/**** Failure history                                                        ***/
+/*****************************************************************************/
+
+/* Environment variable naming the history file, used when branch_set_history_file is not called */
+#define BRANCH_HISTORY_FILE_ENV "CMOCKA_BRANCHES_HISTORY_FILE"
+/* Twigs are forgotten when they have not been part of a failing combination for this many passing runs */
+#define BRANCH_HISTORY_MAX_AGE 5
+/* Number of tab separated fields in a history file line */
+#define BRANCH_HISTORY_FIELDS 8
+
+/* A twig that was part of a failing combination, keyed by test name and branch call site */
+typedef struct
+{
+    char *test_name;
+    char *name;
+    char *file;
+    char *function_name;
+    unsigned int line;
+    unsigned int num_twigs;
+    unsigned int twig;
+    unsigned int age;   /* Passing runs of the test since the twig last failed */
+} BranchHistoryEntry;
+
+static char *branch_strdup(const char *str)
+{
+    const size_t size = strlen(str) + 1;
+    char * const copy = (char*)malloc(size);
+    memcpy(copy, str, size);
+    return copy;
+}
+
+static void free_history_entry(const void *value, void *cleanup_value_data)
+{
+    BranchHistoryEntry * const entry = (BranchHistoryEntry*)value;
+    (void)cleanup_value_data;
+    free(entry->test_name);
+    free(entry->name);
+    free(entry->file);
+    free(entry->function_name);
+    free(entry);
+}
+
+void branch_set_history_file(const char *path)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->history_file = path;
+}
+
+static const char *branch_history_path(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->history_file != NULL) {
+        return ctx->history_file;
+    }
+    return getenv(BRANCH_HISTORY_FILE_ENV);
+}
+
+static int branch_history_entry_matches(const BranchHistoryEntry *entry, const BranchInformation *branch_info)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    return (entry->line == branch_info->line &&
+            entry->num_twigs == branch_info->num_twigs &&
+            strcmp(entry->test_name, ctx->test_name) == 0 &&
+            strcmp(entry->name, branch_info->name) == 0 &&
+            strcmp(entry->file, branch_info->file) == 0 &&
+            strcmp(entry->function_name, branch_info->function_name) == 0);
+}
+
+/* Split line at tabs into at most max_fields fields, returns the number of fields */
+static unsigned int branch_split_fields(char *line, char **fields, const unsigned int max_fields)
+{
+    unsigned int num_fields = 0;
+    while(num_fields < max_fields) {
+        char * const separator = strchr(line, '\t');
+        fields[num_fields++] = line;
+        if(separator == NULL) {
+            break;
+        }
+        *separator = '\0';
+        line = separator + 1;
+    }
+    return num_fields;
+}
+
+/* Read a line of any length, returns NULL at end of file */
+static char *branch_read_line(FILE *file, char **buffer, size_t *size)
+{
+    size_t length = 0;
+    if(*buffer == NULL) {
+        *size = 256;
+        *buffer = (char*)malloc(*size);
+    }
+    while(fgets(*buffer + length, (int)(*size - length), file) != NULL) {
+        length += strlen(*buffer + length);
+        if(length > 0 && (*buffer)[length - 1] == '\n') {
+            (*buffer)[--length] = '\0';
+            return *buffer;
+        }
+        *size *= 2;
+        *buffer = (char*)realloc(*buffer, *size);
+    }
+    return length > 0 ? *buffer : NULL;
+}
+
+static void branch_history_load(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    char *line = NULL;
+    size_t line_size = 0;
+    const char * const path = branch_history_path();
+    FILE *history_file;
+    if(path == NULL || ctx->test_name == NULL) {
+        return;
+    }
+    history_file = fopen(path, "r");
+    if(history_file == NULL) {
+        return;
+    }
+    while(branch_read_line(history_file, &line, &line_size) != NULL) {
+        char *fields[BRANCH_HISTORY_FIELDS];
+        BranchHistoryEntry *entry;
+        line[strcspn(line, "\r\n")] = '\0';
+        if(branch_split_fields(line, fields, BRANCH_HISTORY_FIELDS) != BRANCH_HISTORY_FIELDS) {
+            continue;
+        }
+        entry = (BranchHistoryEntry*)malloc(sizeof(BranchHistoryEntry));
+        entry->test_name = branch_strdup(fields[0]);
+        entry->name = branch_strdup(fields[1]);
+        entry->file = branch_strdup(fields[2]);
+        entry->line = (unsigned int)strtoul(fields[3], NULL, 10);
+        entry->function_name = branch_strdup(fields[4]);
+        entry->num_twigs = (unsigned int)strtoul(fields[5], NULL, 10);
+        entry->twig = (unsigned int)strtoul(fields[6], NULL, 10);
+        entry->age = (unsigned int)strtoul(fields[7], NULL, 10);
+        list_add_value(&ctx->history, entry, 0);
+    }
+    free(line);
+    fclose(history_file);
+}
+
+static void branch_history_save(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const path = branch_history_path();
+    ListNode *node;
+    FILE *history_file;
+    if(path == NULL || !ctx->history_modified) {
+        return;
+    }
+    history_file = fopen(path, "w");
+    if(history_file == NULL) {
+        cm_print_error("ERROR: Could not write branch failure history to %s\n", path);
+        return;
+    }
+    for(node = ctx->history.next; node != &ctx->history; node = node->next) {
+        const BranchHistoryEntry * const entry = (const BranchHistoryEntry*)node->value;
+        fprintf(history_file, "%s\t%s\t%s\t%u\t%s\t%u\t%u\t%u\n",
+                entry->test_name, entry->name, entry->file, entry->line,
+                entry->function_name, entry->num_twigs, entry->twig, entry->age);
+    }
+    fclose(history_file);
+}
+
+/*
+ * Reorder the twigs of a newly discovered branch so that twigs that were part of a failing
+ * combination in recent runs are explored first, most recently failed first. The remaining twigs
+ * keep their order, so every twig is still explored.
+ */
+static void branch_history_order_twigs(BranchInformation *branch_info)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int position = 0;
+    unsigned int age;
+    if(branch_info->twigs == NULL) {
+        /* Lazily stored branches keep their twigs in value order */
+        return;
+    }
+    if(list_empty(&ctx->history) || ctx->cache.in_sync) {
+        /* Replaying cached combinations relies on the twig order of the cached run */
+        return;
+    }
+    for(age = 0; age < BRANCH_HISTORY_MAX_AGE; age++) {
+        ListNode *node;
+        for(node = ctx->history.next; node != &ctx->history; node = node->next) {
+            const BranchHistoryEntry * const entry = (const BranchHistoryEntry*)node->value;
+            unsigned int i;
+            if(entry->age != age || !branch_history_entry_matches(entry, branch_info)) {
+                continue;
+            }
+            for(i = position; i < branch_info->num_twigs; i++) {
+                if(branch_info->twigs[i].value == entry->twig) {
+                    /* Move the twig value to the front, keeping the order of the others */
+                    for(; i > position; i--) {
+                        branch_info->twigs[i].value = branch_info->twigs[i - 1].value;
+                    }
+                    branch_info->twigs[position++].value = entry->twig;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void branch_history_failure_visitor(BranchTwig *twig, unsigned int nesting, void *data)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const BranchInformation * const branch_info = twig->parent_branch;
+    BranchHistoryEntry *entry;
+    ListNode *node;
+    (void)nesting;
+    (void)data;
+    for(node = ctx->history.next; node != &ctx->history; node = node->next) {
+        entry = (BranchHistoryEntry*)node->value;
+        if(entry->twig == twig->value && branch_history_entry_matches(entry, branch_info)) {
+            entry->age = 0;
+            return;
+        }
+    }
+    entry = (BranchHistoryEntry*)malloc(sizeof(BranchHistoryEntry));
+    entry->test_name = branch_strdup(ctx->test_name);
+    entry->name = branch_strdup(branch_info->name);
+    entry->file = branch_strdup(branch_info->file);
+    entry->line = branch_info->line;
+    entry->function_name = branch_strdup(branch_info->function_name);
+    entry->num_twigs = branch_info->num_twigs;
+    entry->twig = twig->value;
+    entry->age = 0;
+    list_add_value(&ctx->history, entry, 0);
+}
+
+/* Remember the twigs of the failing combination */
+static void branch_history_record_failure(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->test_name == NULL || branch_history_path() == NULL) {
+        return;
+    }
+    branch_visit_current_path(branch_history_failure_visitor, NULL);
+    ctx->history_modified = 1;
+}
+
+/* Age the twigs of the test after a passing run, forgetting twigs that have not failed recently */
+static void branch_history_record_success(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ListNode *node = ctx->history.next;
+    while(node != &ctx->history) {
+        BranchHistoryEntry * const entry = (BranchHistoryEntry*)node->value;
+        ListNode * const next = node->next;
+        if(strcmp(entry->test_name, ctx->test_name) == 0) {
+            if(++entry->age >= BRANCH_HISTORY_MAX_AGE) {
+                list_remove_free(node, free_history_entry, NULL);
+            }
+            ctx->history_modified = 1;
+        }
+        node = next;
+    }
+}
+
+/*****************************************************************************/
+/**** Incremental exploration                                                ***/
+/*****************************************************************************/
+
+/* Environment variable naming the cache file, used when branch_set_incremental_cache is not called */
+#define BRANCH_CACHE_FILE_ENV "CMOCKA_BRANCHES_CACHE_FILE"
+/* Environment variable that forces every combination to be executed when set to 1 */
+#define BRANCH_CACHE_FULL_RUN_ENV "CMOCKA_BRANCHES_FULL_RUN"
+/* Environment variable identifying the build, used when branch_set_incremental_build_id is not called */
+#define BRANCH_CACHE_BUILD_ID_ENV "CMOCKA_BRANCHES_BUILD_ID"
+
+#define BRANCH_FNV_OFFSET_BASIS 14695981039346656037ULL
+#define BRANCH_FNV_PRIME 1099511628211ULL
+
+/* Content hash of a source file, computed once per exploration */
+typedef struct
+{
+    char const *file;
+    uint64_t hash;
+    int readable;
+} BranchCacheFileHash;
+
+/* Growable list of steps, filled while visiting a combination */
+typedef struct
+{
+    BranchCacheStep *steps;
+    unsigned int num_steps;
+    unsigned int capacity;
+} BranchCacheStepBuffer;
+
+static void free_value(const void *value, void *cleanup_value_data)
+{
+    (void)cleanup_value_data;
+    free((void*)value);
+}
+
+static uint64_t branch_fnv1a(uint64_t hash, const void *data, const size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    size_t i;
+    for(i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= BRANCH_FNV_PRIME;
+    }
+    return hash;
+}
+
+void branch_set_incremental_cache(const char *path)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->cache.file = path;
+}
+
+void branch_set_incremental_full_run(const int full_run)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->cache.full_run = full_run;
+}
+
+void branch_set_incremental_build_id(const char *build_id)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->cache.build_id = build_id;
+}
+
+static const char *branch_cache_path(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->cache.file != NULL) {
+        return ctx->cache.file;
+    }
+    return getenv(BRANCH_CACHE_FILE_ENV);
+}
+
+static int branch_cache_full_run(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const full_run = getenv(BRANCH_CACHE_FULL_RUN_ENV);
+    return ctx->cache.full_run || (full_run != NULL && full_run[0] == '1');
+}
+
+static const BranchCacheFileHash *branch_cache_file_hash(const char *file)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchCache * const cache = &ctx->cache;
+    BranchCacheFileHash *file_hash;
+    ListNode *node;
+    FILE *source;
+    for(node = cache->file_hashes.next; node != &cache->file_hashes; node = node->next) {
+        file_hash = (BranchCacheFileHash*)node->value;
+        if(file_hash->file == file || strcmp(file_hash->file, file) == 0) {
+            return file_hash;
+        }
+    }
+    file_hash = (BranchCacheFileHash*)malloc(sizeof(BranchCacheFileHash));
+    file_hash->file = file;
+    file_hash->hash = BRANCH_FNV_OFFSET_BASIS;
+    file_hash->readable = 0;
+    source = fopen(file, "rb");
+    if(source != NULL) {
+        char buffer[4096];
+        size_t size;
+        while((size = fread(buffer, 1, sizeof(buffer), source)) > 0) {
+            file_hash->hash = branch_fnv1a(file_hash->hash, buffer, size);
+        }
+        file_hash->readable = !ferror(source);
+        fclose(source);
+    }
+    list_add_value(&cache->file_hashes, file_hash, 0);
+    return file_hash;
+}
+
+/*
+ * Fingerprint of a combination: the build id and the hash of every source file containing one of
+ * the branch call sites it visited, so a change only executes the combinations passing through the
+ * changed files again. Returns 0 if a file can't be read or the combination visited no branch
+ * point, in which case it is always executed.
+ */
+static int branch_cache_fingerprint(const BranchCachePath *path, uint64_t *fingerprint)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char *build_id = ctx->cache.build_id;
+    unsigned int i, j;
+    if(path->num_steps == 0) {
+        return 0;
+    }
+    if(build_id == NULL) {
+        build_id = getenv(BRANCH_CACHE_BUILD_ID_ENV);
+    }
+    *fingerprint = BRANCH_FNV_OFFSET_BASIS;
+    if(build_id != NULL) {
+        *fingerprint = branch_fnv1a(*fingerprint, build_id, strlen(build_id) + 1);
+    }
+    for(i = 0; i < path->num_steps; i++) {
+        const BranchCacheFileHash *file_hash;
+        for(j = 0; j < i; j++) {
+            if(strcmp(path->steps[j].file, path->steps[i].file) == 0) {
+                break;
+            }
+        }
+        if(j < i) {
+            continue;   /* File already hashed */
+        }
+        file_hash = branch_cache_file_hash(path->steps[i].file);
+        if(!file_hash->readable) {
+            return 0;
+        }
+        *fingerprint = branch_fnv1a(*fingerprint, &file_hash->hash, sizeof(file_hash->hash));
+    }
+    return 1;
+}
+
+static int branch_cache_steps_equal(const BranchCacheStep *a, const BranchCacheStep *b)
+{
+    return (a->line == b->line && a->num_twigs == b->num_twigs &&
+            strcmp(a->name, b->name) == 0 &&
+            strcmp(a->file, b->file) == 0 &&
+            strcmp(a->function_name, b->function_name) == 0);
+}
+
+static int branch_cache_paths_equal(const BranchCachePath *a, const BranchCachePath *b)
+{
+    unsigned int i;
+    if(a->num_steps != b->num_steps) {
+        return 0;
+    }
+    for(i = 0; i < a->num_steps; i++) {
+        if(a->steps[i].value != b->steps[i].value || a->steps[i].nesting != b->steps[i].nesting ||
+           !branch_cache_steps_equal(&a->steps[i], &b->steps[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static BranchCacheStep *branch_cache_add_step(BranchCacheStepBuffer *buffer)
+{
+    if(buffer->num_steps == buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 8;
+        buffer->steps = (BranchCacheStep*)realloc(buffer->steps, buffer->capacity * sizeof(BranchCacheStep));
+    }
+    return &buffer->steps[buffer->num_steps++];
+}
+
+static BranchCachePath *branch_cache_add_path(BranchCachePath **paths, unsigned int *num_paths, unsigned int *capacity)
+{
+    if(*num_paths == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        *paths = (BranchCachePath*)realloc(*paths, *capacity * sizeof(BranchCachePath));
+    }
+    return &(*paths)[(*num_paths)++];
+}
+
+static char *branch_cache_string(const char *str)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    char * const copy = branch_strdup(str);
+    list_add_value(&ctx->cache.strings, copy, 0);
+    return copy;
+}
+
+/* Parse "<fingerprint> <site>:<value>:<nesting> ..." into a cached path */
+static void branch_cache_parse_path(char *line, const BranchCacheStep *sites, const unsigned int num_sites, unsigned int *capacity)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchCache * const cache = &ctx->cache;
+    BranchCacheStepBuffer buffer = { NULL, 0, 0 };
+    BranchCachePath * const path = branch_cache_add_path(&cache->cached_paths, &cache->num_cached_paths, capacity);
+    char *next;
+    path->has_fingerprint = (line[0] != '-');
+    path->fingerprint = strtoull(line, &next, 16);
+    while(*next == ' ') {
+        const unsigned long site = strtoul(next + 1, &next, 10);
+        BranchCacheStep * const step = branch_cache_add_step(&buffer);
+        if(site >= num_sites || *next != ':') {
+            path->has_fingerprint = 0;  /* Corrupt line, never reuse it */
+            buffer.num_steps--;
+            break;
+        }
+        *step = sites[site];
+        step->value = (unsigned int)strtoul(next + 1, &next, 10);
+        step->nesting = (unsigned int)strtoul(next + 1, &next, 10);
+        step->equivalent = next[0] == ':' && next[1] == 'e';
+        next += step->equivalent ? 2 : 0;
+    }
+    path->steps = buffer.steps;
+    path->num_steps = buffer.num_steps;
+}
+
+/*
+ * Cache file format, one section per test:
+ *   T <test name>
+ *   S <line> <number of twigs> <name>\t<file>\t<function>    (sites, numbered from 0)
+ *   P <fingerprint> <site>:<twig>:<nesting>[:e] ...          (combinations in execution order, e for equivalent twigs)
+ */
+static void branch_cache_load(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchCache * const cache = &ctx->cache;
+    const char * const path = branch_cache_path();
+    BranchCacheStep *sites = NULL;
+    unsigned int num_sites = 0, sites_capacity = 0, paths_capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    int own_section = 0;
+    FILE *cache_file;
+
+    /* A run restricted to a path can't tell which combinations of the test are left */
+    cache->active = (path != NULL && ctx->test_name != NULL && !ctx->path_restricted);
+    cache->in_sync = 0;
+    cache->replaying = 0;
+    cache->cached_paths = NULL;
+    cache->num_cached_paths = 0;
+    cache->recorded_paths = NULL;
+    cache->num_recorded_paths = 0;
+    cache->recorded_paths_capacity = 0;
+    cache->replayed = 0;
+    list_initialize(&cache->other_lines);
+    list_initialize(&cache->strings);
+    list_initialize(&cache->file_hashes);
+    if(!cache->active || (cache_file = fopen(path, "r")) == NULL) {
+        return;
+    }
+    while(branch_read_line(cache_file, &line, &line_size) != NULL) {
+        if(line[0] == 'T' && line[1] == ' ') {
+            own_section = strcmp(line + 2, ctx->test_name) == 0;
+        }
+        if(!own_section) {
+            list_add_value(&cache->other_lines, branch_strdup(line), 0);
+        } else if(line[0] == 'S' && line[1] == ' ') {
+            char *fields[3];
+            char *next;
+            BranchCacheStep site;
+            site.line = (unsigned int)strtoul(line + 2, &next, 10);
+            site.num_twigs = (unsigned int)strtoul(next, &next, 10);
+            if(*next != ' ' || branch_split_fields(next + 1, fields, 3) != 3) {
+                continue;
+            }
+            site.name = branch_cache_string(fields[0]);
+            site.file = branch_cache_string(fields[1]);
+            site.function_name = branch_cache_string(fields[2]);
+            if(num_sites == sites_capacity) {
+                sites_capacity = sites_capacity ? sites_capacity * 2 : 16;
+                sites = (BranchCacheStep*)realloc(sites, sites_capacity * sizeof(BranchCacheStep));
+            }
+            sites[num_sites++] = site;
+        } else if(line[0] == 'P' && line[1] == ' ') {
+            branch_cache_parse_path(line + 2, sites, num_sites, &paths_capacity);
+        }
+    }
+    free(line);
+    free(sites);
+    fclose(cache_file);
+    cache->in_sync = cache->num_cached_paths > 0 && !branch_cache_full_run();
+}
+
+static unsigned int branch_cache_site_index(const BranchCacheStep **sites, unsigned int *num_sites, const BranchCacheStep *step)
+{
+    unsigned int i;
+    for(i = 0; i < *num_sites; i++) {
+        if(branch_cache_steps_equal(sites[i], step)) {
+            return i;
+        }
+    }
+    sites[(*num_sites)++] = step;
+    return i;
+}
+
+/* Write the cache file. The combinations of this run are only kept when the test passed. */
+static void branch_cache_save(const int passed)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchCache * const cache = &ctx->cache;
+    const BranchCacheStep **sites = NULL;
+    unsigned int num_sites = 0, total_steps = 0, i, j;
+    ListNode *node;
+    FILE *cache_file;
+    if(!cache->active) {
+        return;
+    }
+    cache_file = fopen(branch_cache_path(), "w");
+    if(cache_file == NULL) {
+        cm_print_error("ERROR: Could not write branch cache to %s\n", branch_cache_path());
+        return;
+    }
+    for(node = cache->other_lines.next; node != &cache->other_lines; node = node->next) {
+        fprintf(cache_file, "%s\n", (const char*)node->value);
+    }
+    if(passed && ctx->pruned_combinations == 0) {
+        for(i = 0; i < cache->num_recorded_paths; i++) {
+            total_steps += cache->recorded_paths[i].num_steps;
+        }
+        sites = (const BranchCacheStep**)malloc((total_steps + 1) * sizeof(BranchCacheStep*));
+        for(i = 0; i < cache->num_recorded_paths; i++) {
+            for(j = 0; j < cache->recorded_paths[i].num_steps; j++) {
+                branch_cache_site_index(sites, &num_sites, &cache->recorded_paths[i].steps[j]);
+            }
+        }
+        fprintf(cache_file, "T %s\n", ctx->test_name);
+        for(i = 0; i < num_sites; i++) {
+            fprintf(cache_file, "S %u %u %s\t%s\t%s\n", sites[i]->line, sites[i]->num_twigs,
+                    sites[i]->name, sites[i]->file, sites[i]->function_name);
+        }
+        for(i = 0; i < cache->num_recorded_paths; i++) {
+            const BranchCachePath * const path = &cache->recorded_paths[i];
+            if(path->has_fingerprint) {
+                fprintf(cache_file, "P %" PRIx64, path->fingerprint);
+            } else {
+                fprintf(cache_file, "P -");
+            }
+            for(j = 0; j < path->num_steps; j++) {
+                fprintf(cache_file, " %u:%u:%u%s", branch_cache_site_index(sites, &num_sites, &path->steps[j]),
+                        path->steps[j].value, path->steps[j].nesting, path->steps[j].equivalent ? ":e" : "");
+            }
+            fprintf(cache_file, "\n");
+        }
+        free((void*)sites);
+    }
+    fclose(cache_file);
+}
+
+static void branch_cache_free_paths(BranchCachePath *paths, const unsigned int num_paths)
+{
+    unsigned int i;
+    for(i = 0; i < num_paths; i++) {
+        free(paths[i].steps);
+    }
+    free(paths);
+}
+
+/* Called after the branch tree is freed, as cached strings may be referenced by the tree */
+static void branch_cache_cleanup(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchCache * const cache = &ctx->cache;
+    if(cache->active && cache->replayed != 0) {
+        branch_print_message("Branch cache: %lu of %u combinations reused from an earlier run\n",
+                             cache->replayed, cache->num_recorded_paths);
+    }
+    branch_cache_free_paths(cache->cached_paths, cache->num_cached_paths);
+    branch_cache_free_paths(cache->recorded_paths, cache->num_recorded_paths);
+    list_free(&cache->other_lines, free_value, NULL);
+    list_free(&cache->strings, free_value, NULL);
+    list_free(&cache->file_hashes, free_value, NULL);
+    cache->active = 0;
+    cache->in_sync = 0;
+}
+
+/* Drive the branch points of a cached combination, in place of executing the test function */
+static void branch_cache_replay_steps(const BranchCachePath *path, unsigned int *step_idx, const unsigned int nesting)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    while(*step_idx < path->num_steps && path->steps[*step_idx].nesting == nesting) {
+        const BranchCacheStep * const step = &path->steps[(*step_idx)++];
+        const unsigned int value = _branch_start(step->name, step->num_twigs, NULL, step->file, (int)step->line, step->function_name);
+        if(value != step->value) {
+            cm_print_error(SOURCE_LOCATION_FORMAT
+                           ": error: Replaying cached combination of branch %s gave twig %u, expected %u\n",
+                           step->file, step->line, step->name, value, step->value);
+            _fail(step->file, (int)step->line);
+        }
+        if(step->equivalent && !ctx->current_twig->equivalent) {
+            /* The twig classes are only known to the test function, the branches below stay pinned */
+            ctx->current_twig->equivalent = 1;
+            ctx->current_twig->pin_subbranches = 1;
+            branch_classes_mark(ctx->current_twig);
+        }
+        branch_cache_replay_steps(path, step_idx, nesting + 1);
+        _branch_end(step->name, step->file, (int)step->line, step->function_name);
+    }
+}
+
+/*
+ * Replay the next combination from the cache instead of executing it, if all combinations so far
+ * matched the cached run and the fingerprint of the cached combination is unchanged.
+ * Returns 1 if the combination was replayed.
+ */
+static int branch_cache_replay_combination(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchCache * const cache = &ctx->cache;
+    const BranchCachePath *path;
+    uint64_t fingerprint;
+    unsigned int step_idx = 0;
+    if(!cache->in_sync || cache->num_recorded_paths >= cache->num_cached_paths) {
+        return 0;
+    }
+    path = &cache->cached_paths[cache->num_recorded_paths];
+    if(!path->has_fingerprint || !branch_cache_fingerprint(path, &fingerprint) || fingerprint != path->fingerprint) {
+        return 0;
+    }
+    cache->replaying = 1;
+    branch_cache_replay_steps(path, &step_idx, 0);
+    cache->replayed++;
+    return 1;
+}
+
+static void branch_cache_step_visitor(BranchTwig *twig, unsigned int nesting, void *data)
+{
+    const BranchInformation * const branch_info = twig->parent_branch;
+    BranchCacheStep * const step = branch_cache_add_step((BranchCacheStepBuffer*)data);
+    step->name = branch_info->name;
+    step->file = branch_info->file;
+    step->function_name = branch_info->function_name;
+    step->line = branch_info->line;
+    step->num_twigs = branch_info->num_twigs;
+    step->value = twig->value;
+    step->nesting = nesting;
+    step->equivalent = twig->equivalent;
+}
+
+/* Record the combination that just finished, and check if it still matches the cached run */
+static void branch_cache_combination_end(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchCache * const cache = &ctx->cache;
+    BranchCacheStepBuffer buffer = { NULL, 0, 0 };
+    BranchCachePath *path;
+    if(!cache->active) {
+        return;
+    }
+    branch_visit_combination(&ctx->trunk, 0, branch_cache_step_visitor, &buffer);
+    path = branch_cache_add_path(&cache->recorded_paths, &cache->num_recorded_paths, &cache->recorded_paths_capacity);
+    path->steps = buffer.steps;
+    path->num_steps = buffer.num_steps;
+    path->has_fingerprint = branch_cache_fingerprint(path, &path->fingerprint);
+    if(cache->in_sync && !cache->replaying &&
+       (cache->num_recorded_paths > cache->num_cached_paths ||
+        !branch_cache_paths_equal(path, &cache->cached_paths[cache->num_recorded_paths - 1]))) {
+        /* The structure changed, the rest of the cached run can't be replayed */
+        cache->in_sync = 0;
+    }
+    cache->replaying = 0;
+}
+
+/*****************************************************************************/
+/**** Heap accounting                                                        ***/
+/*****************************************************************************/
+
+/* A twig is reported when its peak is this many times larger than the average of its siblings */
+#define BRANCH_HEAP_OUTLIER_FACTOR 4
+/* Peaks below this size are never reported as outliers */
+#define BRANCH_HEAP_OUTLIER_MIN_BYTES 1024
+
+/* Prepended to every block allocated by the branch allocators to remember its size */
+typedef union
+{
+    size_t size;
+    void *pointer_alignment;
+    long double float_alignment;
+} BranchHeapHeader;
+
+static void branch_heap_record_alloc(const size_t size)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->heap_live += size;
+    if(ctx->enabled) {
+        ctx->heap_accounting_active = 1;
+        ctx->heap_combination_allocated += size;
+        if(ctx->heap_live - ctx->heap_combination_start >
+           ctx->heap_combination_peak) {
+            ctx->heap_combination_peak =
+                ctx->heap_live - ctx->heap_combination_start;
+        }
+    }
+}
+
+/* Fail the test before an allocation that would take the current combination above the heap limit */
+static void branch_heap_check_limit(const size_t size, const char *file, const int line)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const size_t live = ctx->heap_live > ctx->heap_combination_start ?
+        ctx->heap_live - ctx->heap_combination_start : 0;
+    const size_t peak = live + size;
+    if(ctx->enabled && ctx->heap_limit != 0 &&
+       (peak > ctx->heap_limit || peak < size)) {
+        cm_print_error("ERROR: Allocating %lu bytes at %s:%d takes the branch combination to %lu heap bytes, the limit is %lu bytes\n",
+                       (unsigned long)size, file, line, (unsigned long)peak,
+                       (unsigned long)ctx->heap_limit);
+        _fail(file, line);
+    }
+}
+
+void *_branch_test_malloc(const size_t size, const char *file, const int line)
+{
+    BranchHeapHeader *header;
+    branch_heap_check_limit(size, file, line);
+    header = (BranchHeapHeader*)_test_malloc(sizeof(BranchHeapHeader) + size, file, line);
+    if(header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    branch_heap_record_alloc(size);
+    return header + 1;
+}
+
+void *_branch_test_calloc(const size_t number_of_elements, const size_t size, const char *file, const int line)
+{
+    void *ptr;
+    if(size != 0 && number_of_elements > SIZE_MAX / size) {
+        return NULL;
+    }
+    ptr = _branch_test_malloc(number_of_elements * size, file, line);
+    if(ptr != NULL) {
+        memset(ptr, 0, number_of_elements * size);
+    }
+    return ptr;
+}
+
+void _branch_test_free(void * const ptr, const char *file, const int line)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchHeapHeader *header;
+    if(ptr == NULL) {
+        return;
+    }
+    header = (BranchHeapHeader*)ptr - 1;
+    if(header->size <= ctx->heap_live) {
+        ctx->heap_live -= header->size;
+    } else {
+        ctx->heap_live = 0;
+    }
+    _test_free(header, file, line);
+}
+
+void *_branch_test_realloc(void *ptr, const size_t size, const char *file, const int line)
+{
+    void *new_ptr;
+    size_t old_size;
+    if(ptr == NULL) {
+        return _branch_test_malloc(size, file, line);
+    }
+    if(size == 0) {
+        _branch_test_free(ptr, file, line);
+        return NULL;
+    }
+    old_size = ((BranchHeapHeader*)ptr - 1)->size;
+    new_ptr = _branch_test_malloc(size, file, line);
+    if(new_ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        _branch_test_free(ptr, file, line);
+    }
+    return new_ptr;
+}
+
+void branch_set_heap_limit(const size_t max_peak_bytes)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->heap_limit = max_peak_bytes;
+}
+
+/* Report twigs whose heap usage stands out from their siblings, recursively below twig */
+static void branch_heap_report(const BranchTwig *twig)
+{
+    ListNode *subbranch_node;
+    for(subbranch_node = twig->subbranches.next; subbranch_node != &twig->subbranches; subbranch_node = subbranch_node->next) {
+        const BranchInformation * const branch_info = (const BranchInformation*)subbranch_node->value;
+        size_t peak_sum = 0;
+        unsigned int leaking_twigs = 0;
+        unsigned int position = 0;
+        const BranchTwig *subtwig;
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            const BranchTwigStats * const stats = subtwig->stats;
+            if(stats != NULL) {
+                peak_sum += stats->heap_peak;
+                leaking_twigs += stats->heap_leaked != 0;
+            }
+        }
+        if(branch_info->folded != NULL) {
+            peak_sum += branch_info->folded->heap_peak_sum;
+        }
+        position = 0;
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            const BranchTwigStats * const stats = subtwig->stats;
+            size_t siblings_average;
+            if(stats == NULL || stats->combinations == 0) {
+                continue;
+            }
+            siblings_average = (peak_sum - stats->heap_peak) / (branch_info->num_twigs - 1);
+            if(stats->heap_peak >= BRANCH_HEAP_OUTLIER_MIN_BYTES &&
+               stats->heap_peak > BRANCH_HEAP_OUTLIER_FACTOR * siblings_average) {
+                branch_print_message("Branch heap: peak of %lu bytes, siblings average %lu bytes, in:\n",
+                                     (unsigned long)stats->heap_peak, (unsigned long)siblings_average);
+                branch_print_twig_ancestry(subtwig);
+            }
+            /* Only leaks that depend on the twig chosen here are attributed to the twig */
+            if(stats->heap_leaked != 0 && leaking_twigs < branch_info->num_twigs) {
+                branch_print_message("Branch heap: %lu bytes leaked in %lu combinations of:\n",
+                                     (unsigned long)stats->heap_leaked, stats->combinations);
+                branch_print_twig_ancestry(subtwig);
+            }
+            branch_heap_report(subtwig);
+        }
+    }
+}
+
+/*****************************************************************************/
+/**** Shard timings                                                          ***/
+/*****************************************************************************/
+
+/* Environment variables with the timing file and depth, used when branch_set_timing_file is not called */
+#define BRANCH_TIMING_FILE_ENV "CMOCKA_BRANCHES_TIMINGS"
+#define BRANCH_TIMING_DEPTH_ENV "CMOCKA_BRANCHES_TIMING_DEPTH"
+#define BRANCH_TIMING_DEFAULT_DEPTH 2
+#define BRANCH_TIMING_BUCKETS 256
+/* Fields of a timing file line: test, path, time in ns, combinations, name, file and line */
+#define BRANCH_TIMING_FIELDS 7
+
+void branch_set_timing_file(const char *path, const unsigned int depth)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->timings.file = path;
+    ctx->timings.depth = depth;
+    ctx->timings.configured = 1;
+}
+
+/* Returns nonzero if the path prefixes overlap, one being a prefix of the other in whole twig values */
+static int branch_timing_overlaps(const char *a, const char *b)
+{
+    const size_t length_a = strlen(a);
+    const size_t length_b = strlen(b);
+    const size_t length = length_a < length_b ? length_a : length_b;
+    return strncmp(a, b, length) == 0 &&
+           (length_a == length_b || a[length] == '.' || b[length] == '.');
+}
+
+/* Returns nonzero if the current exploration replaces the durations measured for path */
+static int branch_timing_replaced(const char *path)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    int complement = 0;
+    if(!ctx->path_restricted) {
+        return 1;
+    }
+    for(i = 0; i < ctx->num_paths; i++) {
+        if(ctx->paths[i][0] == '\0') {
+            complement = 1;
+        } else if(branch_timing_overlaps(path, ctx->paths[i])) {
+            return 1;
+        }
+    }
+    /* The first shard explores everything outside the planned paths */
+    for(i = 0; complement && i < ctx->num_planned_paths; i++) {
+        if(branch_timing_overlaps(path, ctx->planned_paths[i])) {
+            return 0;
+        }
+    }
+    return complement;
+}
+
+static void branch_timing_load(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchTimings * const timings = &ctx->timings;
+    const char *depth = timings->configured ? NULL : getenv(BRANCH_TIMING_DEPTH_ENV);
+    char *line = NULL;
+    size_t line_size = 0;
+    FILE *timing_file;
+    timings->active_file = timings->configured ? timings->file : getenv(BRANCH_TIMING_FILE_ENV);
+    timings->active_depth = depth != NULL ? (unsigned int)strtoul(depth, NULL, 10) : timings->depth;
+    if(timings->active_depth == 0) {
+        timings->active_depth = BRANCH_TIMING_DEFAULT_DEPTH;
+    } else if(timings->active_depth > BRANCH_TIMING_MAX_DEPTH) {
+        timings->active_depth = BRANCH_TIMING_MAX_DEPTH;
+    }
+    timings->buckets = NULL;
+    timings->num_entries = 0;
+    timings->kept_lines = NULL;
+    timings->num_kept_lines = 0;
+    if(timings->active_file == NULL || timings->active_file[0] == '\0' || ctx->test_name == NULL) {
+        timings->active_file = NULL;
+        timings->active_depth = 0;
+        return;
+    }
+    timings->buckets = (BranchTimingEntry**)calloc(BRANCH_TIMING_BUCKETS, sizeof(BranchTimingEntry*));
+    timing_file = fopen(timings->active_file, "r");
+    if(timing_file == NULL) {
+        return;
+    }
+    while(branch_read_line(timing_file, &line, &line_size) != NULL) {
+        char *fields[BRANCH_TIMING_FIELDS];
+        char *kept;
+        line[strcspn(line, "\r\n")] = '\0';
+        kept = branch_strdup(line);
+        if(branch_split_fields(line, fields, BRANCH_TIMING_FIELDS) != BRANCH_TIMING_FIELDS ||
+           (strcmp(fields[0], ctx->test_name) == 0 && branch_timing_replaced(fields[1]))) {
+            free(kept);
+            continue;
+        }
+        timings->kept_lines = (char**)realloc(timings->kept_lines, (timings->num_kept_lines + 1) * sizeof(char*));
+        timings->kept_lines[timings->num_kept_lines++] = kept;
+    }
+    free(line);
+    fclose(timing_file);
+}
+
+/* Add the duration of the combination to the subtree of its first branch points */
+static void branch_timing_record(const uint64_t time_ns)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchTimings * const timings = &ctx->timings;
+    const unsigned int depth = ctx->path_starts < timings->active_depth ?
+                               ctx->path_starts : timings->active_depth;
+    char path[BRANCH_TIMING_MAX_DEPTH * 11 + 1];
+    size_t length = 0;
+    uint64_t hash;
+    BranchTimingEntry *entry;
+    unsigned int i;
+    path[0] = '\0';
+    for(i = 0; i < depth; i++) {
+        length += (size_t)sprintf(path + length, i == 0 ? "%u" : ".%u", timings->values[i]);
+    }
+    hash = branch_fnv1a(BRANCH_FNV_OFFSET_BASIS, path, length);
+    for(entry = timings->buckets[hash % BRANCH_TIMING_BUCKETS]; entry != NULL; entry = entry->next_in_bucket) {
+        if(entry->hash == hash && strcmp(entry->path, path) == 0) {
+            break;
+        }
+    }
+    if(entry == NULL) {
+        const BranchInformation * const branch_info = depth != 0 ? timings->branches[depth - 1] : NULL;
+        entry = (BranchTimingEntry*)malloc(sizeof(BranchTimingEntry));
+        entry->hash = hash;
+        entry->path = branch_strdup(path);
+        entry->name = branch_strdup(branch_info != NULL ? branch_info->name : "");
+        entry->file = branch_strdup(branch_info != NULL ? branch_info->file : "");
+        entry->line = branch_info != NULL ? branch_info->line : 0;
+        entry->time_ns = 0;
+        entry->combinations = 0;
+        entry->next_in_bucket = timings->buckets[hash % BRANCH_TIMING_BUCKETS];
+        timings->buckets[hash % BRANCH_TIMING_BUCKETS] = entry;
+        timings->num_entries++;
+    }
+    entry->time_ns += time_ns;
+    entry->combinations++;
+}
+
+/* Write the durations of a completed exploration, and free them */
+static void branch_timing_save(const int passed)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchTimings * const timings = &ctx->timings;
+    FILE *timing_file = NULL;
+    unsigned int i;
+    if(timings->active_file == NULL) {
+        return;
+    }
+    if(passed) {
+        timing_file = fopen(timings->active_file, "w");
+        if(timing_file == NULL) {
+            cm_print_error("ERROR: Could not write branch timings to %s\n", timings->active_file);
+        }
+    }
+    for(i = 0; i < timings->num_kept_lines; i++) {
+        if(timing_file != NULL) {
+            fprintf(timing_file, "%s\n", timings->kept_lines[i]);
+        }
+        free(timings->kept_lines[i]);
+    }
+    for(i = 0; i < BRANCH_TIMING_BUCKETS; i++) {
+        while(timings->buckets[i] != NULL) {
+            BranchTimingEntry * const entry = timings->buckets[i];
+            if(timing_file != NULL) {
+                fprintf(timing_file, "%s\t%s\t%llu\t%lu\t%s\t%s\t%d\n",
+                        ctx->test_name, entry->path, (unsigned long long)entry->time_ns,
+                        entry->combinations, entry->name, entry->file, entry->line);
+            }
+            timings->buckets[i] = entry->next_in_bucket;
+            free(entry->path);
+            free(entry->name);
+            free(entry->file);
+            free(entry);
+        }
+    }
+    if(timing_file != NULL) {
+        fclose(timing_file);
+    }
+    free(timings->kept_lines);
+    free(timings->buckets);
+    timings->kept_lines = NULL;
+    timings->buckets = NULL;
+    timings->active_file = NULL;
+    timings->active_depth = 0;
+}
+
+/*****************************************************************************/
+/**** Memoization                                                            ***/
+/*****************************************************************************/
+
+/* Environment variable with the memo size limit in bytes, used when branch_set_memo_limit is not called */
+#define BRANCH_MEMO_LIMIT_ENV "CMOCKA_BRANCHES_MEMO_LIMIT"
+#define BRANCH_MEMO_MIN_BUCKETS 64
+/* Alignment of the memoized data */
+#define BRANCH_MEMO_ALIGNMENT 16
+#define BRANCH_MEMO_ALIGN(size) (((size) + BRANCH_MEMO_ALIGNMENT - 1) & ~(size_t)(BRANCH_MEMO_ALIGNMENT - 1))
+
+void branch_set_memo_limit(const size_t bytes)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->memo.configured = 1;
+    ctx->memo.limit = bytes;
+}
+
+static void branch_memo_init(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchMemo * const memo = &ctx->memo;
+    const char * const limit = getenv(BRANCH_MEMO_LIMIT_ENV);
+    memo->active_limit = memo->configured || limit == NULL ? memo->limit : (size_t)strtoull(limit, NULL, 10);
+    memo->buckets = NULL;
+    memo->num_buckets = 0;
+    memo->num_entries = 0;
+    memo->lru.next = &memo->lru;
+    memo->lru.prev = &memo->lru;
+    memo->footprint = 0;
+    memo->pending = NULL;
+    memo->hits = 0;
+    memo->misses = 0;
+    memo->evictions = 0;
+}
+
+static void branch_memo_unlink(BranchMemoEntry *entry)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchMemo * const memo = &ctx->memo;
+    BranchMemoEntry **link = &memo->buckets[entry->hash % memo->num_buckets];
+    while(*link != entry) {
+        link = &(*link)->next_in_bucket;
+    }
+    *link = entry->next_in_bucket;
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    memo->num_entries--;
+    memo->footprint -= entry->footprint;
+}
+
+static void branch_memo_release(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchMemo * const memo = &ctx->memo;
+    BranchMemoEntry *entry = memo->lru.next;
+    const unsigned long hits = memo->hits, misses = memo->misses, evictions = memo->evictions;
+    if(memo->hits != 0 || memo->misses != 0) {
+        branch_print_message("Branch memo: %lu hits, %lu misses, %lu evictions, %lu entries of %lu bytes left\n",
+                             memo->hits, memo->misses, memo->evictions,
+                             (unsigned long)memo->num_entries, (unsigned long)memo->footprint);
+    }
+    while(entry != &memo->lru) {
+        BranchMemoEntry * const next = entry->next;
+        free(entry);
+        entry = next;
+    }
+    free(memo->buckets);
+    free(memo->pending);
+    branch_memo_init();
+    /* The statistics are kept for branch_context_status until the next exploration */
+    memo->hits = hits;
+    memo->misses = misses;
+    memo->evictions = evictions;
+}
+
+/* Evict the least recently used entries until size more bytes fit, entries used by the current combination stay */
+static void branch_memo_make_room(const size_t size)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchMemo * const memo = &ctx->memo;
+    BranchMemoEntry *entry = memo->lru.prev;
+    while(memo->footprint + size > memo->active_limit && entry != &memo->lru &&
+          entry->used_in != ctx->combinations) {
+        BranchMemoEntry * const more_recent = entry->prev;
+        branch_memo_unlink(entry);
+        free(entry);
+        memo->evictions++;
+        entry = more_recent;
+    }
+}
+
+static void branch_memo_grow(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchMemo * const memo = &ctx->memo;
+    const unsigned int num_buckets = memo->num_buckets != 0 ? 2 * memo->num_buckets : BRANCH_MEMO_MIN_BUCKETS;
+    BranchMemoEntry ** const buckets = (BranchMemoEntry**)calloc(num_buckets, sizeof(BranchMemoEntry*));
+    unsigned int i;
+    for(i = 0; i < memo->num_buckets; i++) {
+        BranchMemoEntry *entry = memo->buckets[i];
+        while(entry != NULL) {
+            BranchMemoEntry * const next = entry->next_in_bucket;
+            entry->next_in_bucket = buckets[entry->hash % num_buckets];
+            buckets[entry->hash % num_buckets] = entry;
+            entry = next;
+        }
+    }
+    free(memo->buckets);
+    memo->buckets = buckets;
+    memo->num_buckets = num_buckets;
+}
+
+void *_branch_memo(const char* const key, const size_t size, BranchMemoInit init, void *arg, const char* const file, const int line)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchMemo * const memo = &ctx->memo;
+    const size_t key_size = strlen(key) + 1;
+    const uint64_t hash = branch_fnv1a(BRANCH_FNV_OFFSET_BASIS, key, key_size);
+    const size_t data_offset = BRANCH_MEMO_ALIGN(sizeof(BranchMemoEntry));
+    BranchMemoEntry *entry;
+
+    if(!ctx->enabled) {
+        cm_print_error(SOURCE_LOCATION_FORMAT ": error: Memo %s requested outside a test.\n", file, line, key);
+        _fail(file, line);
+        return NULL;
+    }
+    for(entry = memo->num_buckets != 0 ? memo->buckets[hash % memo->num_buckets] : NULL; entry != NULL; entry = entry->next_in_bucket) {
+        if(entry->hash == hash && strcmp(entry->key, key) == 0) {
+            break;
+        }
+    }
+    if(entry != NULL) {
+        if(entry->size != size) {
+            cm_print_error(SOURCE_LOCATION_FORMAT ": error: Memo %s requested with %lu bytes, it was created with %lu bytes\n",
+                           file, line, key, (unsigned long)size, (unsigned long)entry->size);
+            _fail(file, line);
+            return NULL;
+        }
+        /* Taken out of the list, to be put back at the front */
+        entry->prev->next = entry->next;
+        entry->next->prev = entry->prev;
+        memo->hits++;
+    } else {
+        const size_t footprint = data_offset + BRANCH_MEMO_ALIGN(size) + key_size;
+        ctx->faults_suspended++;
+        if(memo->active_limit != 0) {
+            branch_memo_make_room(footprint);
+        }
+        entry = (BranchMemoEntry*)malloc(footprint);
+        entry->data = (unsigned char*)entry + data_offset;
+        entry->key = (char*)entry->data + BRANCH_MEMO_ALIGN(size);
+        memcpy((char*)entry->key, key, key_size);
+        entry->hash = hash;
+        entry->size = size;
+        entry->footprint = footprint;
+        memset(entry->data, 0, size);
+        /* The data is shared by later combinations, its initialization is not a fault point */
+        memo->pending = entry;
+        if(init != NULL) {
+            init(entry->data, size, arg);
+        }
+        memo->pending = NULL;
+        ctx->faults_suspended--;
+        if(memo->num_entries >= memo->num_buckets) {
+            branch_memo_grow();
+        }
+        entry->next_in_bucket = memo->buckets[hash % memo->num_buckets];
+        memo->buckets[hash % memo->num_buckets] = entry;
+        memo->num_entries++;
+        memo->footprint += footprint;
+        memo->misses++;
+    }
+    entry->used_in = ctx->combinations;
+    entry->next = memo->lru.next;
+    entry->prev = &memo->lru;
+    memo->lru.next->prev = entry;
+    memo->lru.next = entry;
+    return entry->data;
+}
+
+/*****************************************************************************/
+/**** Tree export                                                            ***/
+/*****************************************************************************/
+
+/* Environment variable with the path prefix of exported trees, used when branch_set_tree_export is not called */
+#define BRANCH_EXPORT_ENV "CMOCKA_BRANCHES_EXPORT"
+/* Environment variable with the nesting depth below which subtrees are collapsed */
+#define BRANCH_EXPORT_DEPTH_ENV "CMOCKA_BRANCHES_EXPORT_DEPTH"
+
+/* Memory used by the branch engine for a subtree */
+typedef struct
+{
+    unsigned long branches;
+    unsigned long twigs;
+    size_t bytes;
+} BranchFootprint;
+
+void branch_set_tree_export(const char *path_prefix, const unsigned int max_depth)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->export_path = path_prefix;
+    ctx->export_depth = max_depth;
+}
+
+static const char *branch_export_path(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->export_path != NULL) {
+        return ctx->export_path;
+    }
+    return getenv(BRANCH_EXPORT_ENV);
+}
+
+static unsigned int branch_export_depth(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const depth = getenv(BRANCH_EXPORT_DEPTH_ENV);
+    if(ctx->export_path != NULL || depth == NULL) {
+        return ctx->export_depth;
+    }
+    return (unsigned int)strtoul(depth, NULL, 10);
+}
+
+/* Add the memory used for the branches below twig, and the twig statistics, to footprint */
+static void branch_subtree_footprint(const BranchTwig *twig, BranchFootprint *footprint)
+{
+    const ListNode *node;
+    for(node = twig->subbranches.next; node != &twig->subbranches; node = node->next) {
+        const BranchInformation * const branch_info = (const BranchInformation*)node->value;
+        const BranchTwig *subtwig;
+        unsigned int position = 0;
+        footprint->branches++;
+        footprint->bytes += sizeof(ListNode) + sizeof(BranchInformation);
+        if(branch_info->twigs != NULL) {
+            footprint->twigs += branch_info->num_twigs;
+            footprint->bytes += branch_info->num_twigs * sizeof(BranchTwig);
+        } else {
+            footprint->twigs += branch_info->num_lazy_twigs;
+            footprint->bytes += branch_info->num_lazy_twigs * sizeof(BranchTwig) + branch_info->lazy_twigs_capacity * sizeof(BranchTwig*);
+        }
+        if(branch_info->folded != NULL) {
+            footprint->bytes += sizeof(BranchFoldedStats);
+        }
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            if(subtwig->stats != NULL) {
+                footprint->bytes += sizeof(BranchTwigStats);
+            }
+            branch_subtree_footprint(subtwig, footprint);
+        }
+    }
+}
+
+static void branch_export_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for(; *str != '\0'; str++) {
+        if(*str == '"' || *str == '\\') {
+            fputc('\\', file);
+            fputc(*str, file);
+        } else if((unsigned char)*str < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned int)(unsigned char)*str);
+        } else {
+            fputc(*str, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static const char *branch_twig_name(const BranchTwig *twig)
+{
+    if(twig->parent_branch == NULL || twig->parent_branch->twig_names == NULL) {
+        return "";
+    }
+    return twig->parent_branch->twig_names[twig->value];
+}
+
+/* Write the statistics fields of a twig, or of the folded twigs of a branch */
+static void branch_export_json_stats(FILE *file, const BranchTwigStats *stats)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    fprintf(file, "\"combinations\": %lu, \"passed\": %lu, \"failed\": %lu, \"pruned\": %lu, \"time_ns\": %llu"
+            ", \"heap_peak\": %lu, \"heap_leaked\": %lu",
+            stats->combinations, stats->combinations - stats->failures - stats->pruned, stats->failures, stats->pruned,
+            (unsigned long long)stats->time_ns,
+            (unsigned long)stats->heap_peak, (unsigned long)stats->heap_leaked);
+    if(ctx->perf_active) {
+        unsigned int i;
+        int first = 1;
+        fprintf(file, ", \"perf\": {");
+        for(i = 0; i < BRANCH_PERF_COUNTERS; i++) {
+            if(ctx->perf_available[i]) {
+                fprintf(file, "%s\"%s\": %llu", first ? "" : ", ", branch_perf_name(i), (unsigned long long)stats->perf[i]);
+                first = 0;
+            }
+        }
+        fprintf(file, "}");
+    }
+}
+
+static void branch_export_json_twig(FILE *file, const BranchTwig *twig, const unsigned int depth, const unsigned int max_depth)
+{
+    static const BranchTwigStats no_stats;
+    const ListNode *node;
+    fprintf(file, "{\"value\": %u, \"name\": ", twig->value);
+    branch_export_string(file, branch_twig_name(twig));
+    if(twig->equivalent) {
+        fprintf(file, ", \"equivalent_to\": %u", branch_class_representative(twig->parent_branch, twig->value));
+    }
+    fprintf(file, ", ");
+    branch_export_json_stats(file, twig->stats != NULL ? twig->stats : &no_stats);
+    if(max_depth != 0 && depth >= max_depth && !list_empty(&twig->subbranches)) {
+        BranchFootprint footprint = { 0, 0, 0 };
+        branch_subtree_footprint(twig, &footprint);
+        fprintf(file, ", \"collapsed\": {\"branches\": %lu, \"twigs\": %lu, \"bytes\": %lu}}",
+                footprint.branches, footprint.twigs, (unsigned long)footprint.bytes);
+        return;
+    }
+    fprintf(file, ", \"branches\": [");
+    for(node = twig->subbranches.next; node != &twig->subbranches; node = node->next) {
+        const BranchInformation * const branch_info = (const BranchInformation*)node->value;
+        const BranchTwig *subtwig;
+        unsigned int position = 0;
+        fprintf(file, "%s{\"name\": ", node == twig->subbranches.next ? "" : ", ");
+        branch_export_string(file, branch_info->name);
+        fprintf(file, ", \"file\": ");
+        branch_export_string(file, branch_info->file);
+        fprintf(file, ", \"line\": %u, \"function\": ", branch_info->line);
+        branch_export_string(file, branch_info->function_name);
+        fprintf(file, ", \"num_twigs\": %u, %s\"twigs\": [", branch_info->num_twigs,
+                branch_info->pinned ? "\"pinned\": true, " : "");
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            fprintf(file, "%s", position == 1 ? "" : ", ");
+            branch_export_json_twig(file, subtwig, depth + 1, max_depth);
+        }
+        fprintf(file, "]");
+        if(branch_info->folded != NULL) {
+            fprintf(file, ", \"other_twigs\": {");
+            branch_export_json_stats(file, &branch_info->folded->stats);
+            fprintf(file, "}");
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "]}");
+}
+
+static void branch_export_dot_twig(FILE *file, const BranchTwig *twig, const unsigned int depth, const unsigned int max_depth)
+{
+    const ListNode *node;
+    if(max_depth != 0 && depth >= max_depth && !list_empty(&twig->subbranches)) {
+        BranchFootprint footprint = { 0, 0, 0 };
+        branch_subtree_footprint(twig, &footprint);
+        fprintf(file, "  \"c%p\" [shape=note, label=\"%lu branches collapsed\\n%lu twigs, %lu bytes\"];\n",
+                (const void*)twig, footprint.branches, footprint.twigs, (unsigned long)footprint.bytes);
+        fprintf(file, "  \"t%p\" -> \"c%p\";\n", (const void*)twig, (const void*)twig);
+        return;
+    }
+    for(node = twig->subbranches.next; node != &twig->subbranches; node = node->next) {
+        const BranchInformation * const branch_info = (const BranchInformation*)node->value;
+        unsigned long combinations = 0;
+        uint64_t time_ns = 0;
+        unsigned int position = 0;
+        const BranchTwig *subtwig;
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            if(subtwig->stats != NULL) {
+                combinations += subtwig->stats->combinations;
+                time_ns += subtwig->stats->time_ns;
+            }
+        }
+        if(branch_info->folded != NULL) {
+            combinations += branch_info->folded->stats.combinations;
+            time_ns += branch_info->folded->stats.time_ns;
+        }
+        fprintf(file, "  \"b%p\" [shape=box, label=", (const void*)branch_info);
+        branch_export_string(file, branch_info->name);
+        fprintf(file, branch_is_fault_point(branch_info) ? " + \"\\n" MODULE_OFFSET_FORMAT : " + \"\\n" SOURCE_LOCATION_FORMAT,
+                branch_info->file, branch_info->line);
+        fprintf(file, "\\n%lu combinations, %.3f ms\"];\n", combinations, (double)time_ns / 1e6);
+        fprintf(file, "  \"t%p\" -> \"b%p\";\n", (const void*)twig, (const void*)branch_info);
+        position = 0;
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            const BranchTwigStats * const stats = subtwig->stats;
+            fprintf(file, "  \"t%p\" [label=", (const void*)subtwig);
+            branch_export_string(file, branch_twig_name(subtwig));
+            fprintf(file, " + \" (%u)\\n%lu passed, %lu failed, %lu pruned\\n%.3f ms\"%s%s];\n", subtwig->value,
+                    stats != NULL ? stats->combinations - stats->failures - stats->pruned : 0UL,
+                    stats != NULL ? stats->failures : 0UL,
+                    stats != NULL ? stats->pruned : 0UL,
+                    stats != NULL ? (double)stats->time_ns / 1e6 : 0.0,
+                    stats != NULL && stats->failures != 0 ? ", color=red" : "",
+                    subtwig->equivalent ? ", style=dashed" : "");
+            fprintf(file, "  \"b%p\" -> \"t%p\";\n", (const void*)branch_info, (const void*)subtwig);
+            branch_export_dot_twig(file, subtwig, depth + 1, max_depth);
+        }
+        if(branch_info->folded != NULL) {
+            const BranchTwigStats * const stats = &branch_info->folded->stats;
+            fprintf(file, "  \"f%p\" [label=\"other twigs\\n%lu passed, %lu pruned\\n%.3f ms\"];\n", (const void*)branch_info,
+                    stats->combinations - stats->pruned, stats->pruned, (double)stats->time_ns / 1e6);
+            fprintf(file, "  \"b%p\" -> \"f%p\";\n", (const void*)branch_info, (const void*)branch_info);
+        }
+    }
+}
+
+static FILE *branch_export_open(const char *path_prefix, const char *extension)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const test_name = ctx->test_name != NULL ? ctx->test_name : "branches";
+    const size_t size = strlen(path_prefix) + strlen(test_name) + strlen(extension) + 1;
+    char * const path = (char*)malloc(size);
+    FILE *file;
+    snprintf(path, size, "%s%s%s", path_prefix, test_name, extension);
+    file = fopen(path, "w");
+    if(file == NULL) {
+        cm_print_error("ERROR: Could not write branch tree to %s\n", path);
+    }
+    free(path);
+    return file;
+}
+
+/*
+ * Write the explored tree as <prefix><test name>.dot (Graphviz) and <prefix><test name>.json,
+ * with statistics for every twig and the memory used by the engine.
+ */
+static void branch_export_tree(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const path_prefix = branch_export_path();
+    const unsigned int max_depth = branch_export_depth();
+    BranchFootprint footprint = { 0, 0, 0 };
+    FILE *file;
+    if(path_prefix == NULL) {
+        return;
+    }
+    branch_subtree_footprint(&ctx->trunk, &footprint);
+
+    file = branch_export_open(path_prefix, ".dot");
+    if(file != NULL) {
+        fprintf(file, "digraph branches {\n");
+        fprintf(file, "  \"t%p\" [shape=doublecircle, label=", (const void*)&ctx->trunk);
+        branch_export_string(file, ctx->test_name != NULL ? ctx->test_name : "");
+        fprintf(file, " + \"\\n%lu passed, %lu failed, %lu pruned, %.3f ms\\n%lu branches, %lu twigs, %lu bytes\"];\n",
+                ctx->combinations - ctx->failed_combinations - ctx->pruned_combinations,
+                ctx->failed_combinations, ctx->pruned_combinations,
+                (double)ctx->time_ns / 1e6,
+                footprint.branches, footprint.twigs, (unsigned long)footprint.bytes);
+        branch_export_dot_twig(file, &ctx->trunk, 0, max_depth);
+        fprintf(file, "}\n");
+        fclose(file);
+    }
+
+    file = branch_export_open(path_prefix, ".json");
+    if(file != NULL) {
+        fprintf(file, "{\"test\": ");
+        branch_export_string(file, ctx->test_name != NULL ? ctx->test_name : "");
+        fprintf(file, ", \"combinations\": %lu, \"passed\": %lu, \"failed\": %lu, \"pruned\": %lu, \"time_ns\": %llu,\n",
+                ctx->combinations,
+                ctx->combinations - ctx->failed_combinations - ctx->pruned_combinations,
+                ctx->failed_combinations, ctx->pruned_combinations,
+                (unsigned long long)ctx->time_ns);
+        fprintf(file, " \"engine\": {\"branches\": %lu, \"twigs\": %lu, \"bytes\": %lu},\n \"trunk\": ",
+                footprint.branches, footprint.twigs, (unsigned long)footprint.bytes);
+        branch_export_json_twig(file, &ctx->trunk, 0, max_depth);
+        fprintf(file, "}\n");
+        fclose(file);
+    }
+}
+
+/*****************************************************************************/
+/**** Registered state                                                       ***/
+/*****************************************************************************/
+
+/* Regions with fewer whole pages are restored completely, without tracking writes */
+#define BRANCH_STATE_TRACK_MIN_PAGES 4
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MPROTECT) && defined(HAVE_SIGACTION) && defined(HAVE_UNISTD_H)
+#define BRANCH_STATE_TRACKING 1
+static struct sigaction branch_state_previous_segv;
+#ifdef SIGBUS
+static struct sigaction branch_state_previous_bus;
+#endif
+#endif
+
+void branch_set_state_tracking(const int enabled)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->state_tracking_disabled = !enabled;
+}
+
+#ifdef BRANCH_STATE_TRACKING
+
+static size_t branch_page_size(void)
+{
+    static size_t page_size = 0;
+    if(page_size == 0) {
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    return page_size;
+}
+
+static void branch_state_uninstall_handler(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->state_handler_installed) {
+        sigaction(SIGSEGV, &branch_state_previous_segv, NULL);
+#ifdef SIGBUS
+        sigaction(SIGBUS, &branch_state_previous_bus, NULL);
+#endif
+        ctx->state_handler_installed = 0;
+    }
+}
+
+/* Record the first write to a tracked page and allow further writes, other faults go to the previous handler */
+static void branch_state_fault_handler(int signal_number, siginfo_t *info, void *context)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned char * const address = (unsigned char*)info->si_addr;
+    const size_t page_size = branch_page_size();
+    unsigned int i;
+    (void)signal_number;
+    (void)context;
+    for(i = 0; i < ctx->num_state_regions; i++) {
+        BranchStateRegion * const region = &ctx->state_regions[i];
+        if(region->first_page != NULL && address >= region->first_page &&
+           address < region->first_page + region->num_pages * page_size) {
+            const size_t page = (size_t)(address - region->first_page) / page_size;
+            if(!region->dirty[page]) {
+                region->dirty[page] = 1;
+                mprotect(region->first_page + page * page_size, page_size, PROT_READ | PROT_WRITE);
+                return;
+            }
+        }
+    }
+    /* Not ours, the faulting instruction is executed again with the previous handler */
+    branch_state_uninstall_handler();
+}
+
+static void branch_state_install_handler(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    struct sigaction action;
+    if(ctx->state_handler_installed) {
+        return;
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = branch_state_fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &branch_state_previous_segv);
+#ifdef SIGBUS
+    sigaction(SIGBUS, &action, &branch_state_previous_bus);
+#endif
+    ctx->state_handler_installed = 1;
+}
+
+/* Mark the whole pages of a region clean and write protect them */
+static void branch_state_protect(BranchStateRegion *region)
+{
+    if(region->first_page != NULL) {
+        memset(region->dirty, 0, region->num_pages);
+        mprotect(region->first_page, region->num_pages * branch_page_size(), PROT_READ);
+    }
+}
+
+static void branch_state_unprotect(BranchStateRegion *region)
+{
+    if(region->first_page != NULL) {
+        mprotect(region->first_page, region->num_pages * branch_page_size(), PROT_READ | PROT_WRITE);
+        memset(region->dirty, 1, region->num_pages);
+    }
+}
+
+static void branch_state_setup_tracking(BranchStateRegion *region)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const size_t page_size = branch_page_size();
+    const uintptr_t start = ((uintptr_t)region->address + page_size - 1) / page_size * page_size;
+    const uintptr_t end = ((uintptr_t)region->address + region->size) / page_size * page_size;
+    region->first_page = NULL;
+    region->num_pages = 0;
+    region->dirty = NULL;
+    if(ctx->state_tracking_disabled || end <= start ||
+       (end - start) / page_size < BRANCH_STATE_TRACK_MIN_PAGES) {
+        return;
+    }
+    region->first_page = (unsigned char*)start;
+    region->num_pages = (end - start) / page_size;
+    region->dirty = (unsigned char*)malloc(region->num_pages);
+    memset(region->dirty, 1, region->num_pages);
+}
+
+/* Restore a region, copying only the whole pages written since the last restore */
+static void branch_state_restore_region(BranchStateRegion *region)
+{
+    const size_t page_size = branch_page_size();
+    unsigned char *region_end;
+    size_t head;
+    size_t page;
+    if(region->first_page == NULL) {
+        memcpy(region->address, region->snapshot, region->size);
+        return;
+    }
+    head = (size_t)(region->first_page - region->address);
+    region_end = region->first_page + region->num_pages * page_size;
+    memcpy(region->address, region->snapshot, head);
+    memcpy(region_end, region->snapshot + (region_end - region->address), (size_t)(region->address + region->size - region_end));
+    for(page = 0; page < region->num_pages; page++) {
+        if(region->dirty[page]) {
+            memcpy(region->first_page + page * page_size, region->snapshot + head + page * page_size, page_size);
+            region->dirty[page] = 0;
+            mprotect(region->first_page + page * page_size, page_size, PROT_READ);
+        }
+    }
+}
+
+#else /* BRANCH_STATE_TRACKING */
+
+static void branch_state_install_handler(void)
+{
+}
+
+static void branch_state_uninstall_handler(void)
+{
+}
+
+static void branch_state_protect(BranchStateRegion *region)
+{
+    (void)region;
+}
+
+static void branch_state_unprotect(BranchStateRegion *region)
+{
+    (void)region;
+}
+
+static void branch_state_setup_tracking(BranchStateRegion *region)
+{
+    region->first_page = NULL;
+    region->num_pages = 0;
+    region->dirty = NULL;
+}
+
+static void branch_state_restore_region(BranchStateRegion *region)
+{
+    memcpy(region->address, region->snapshot, region->size);
+}
+
+#endif /* BRANCH_STATE_TRACKING */
+
+void branch_register_state(void *address, const size_t size)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchStateRegion *region;
+    ctx->state_regions = (BranchStateRegion*)realloc(ctx->state_regions,
+            (ctx->num_state_regions + 1) * sizeof(BranchStateRegion));
+    region = &ctx->state_regions[ctx->num_state_regions++];
+    region->address = (unsigned char*)address;
+    region->size = size;
+    region->snapshot = (unsigned char*)malloc(size);
+    memcpy(region->snapshot, address, size);
+    branch_state_setup_tracking(region);
+}
+
+void branch_unregister_state(void *address)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    for(i = 0; i < ctx->num_state_regions; i++) {
+        BranchStateRegion * const region = &ctx->state_regions[i];
+        if(region->address == (unsigned char*)address) {
+            branch_state_unprotect(region);
+            free(region->snapshot);
+            free(region->dirty);
+            ctx->state_regions[i] =
+                    ctx->state_regions[--ctx->num_state_regions];
+            return;
+        }
+    }
+}
+
+/* Take the snapshot of all registered regions that every combination starts from */
+static void branch_state_snapshot(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    if(ctx->num_state_regions == 0) {
+        return;
+    }
+    branch_state_install_handler();
+    for(i = 0; i < ctx->num_state_regions; i++) {
+        BranchStateRegion * const region = &ctx->state_regions[i];
+        branch_state_unprotect(region);
+        memcpy(region->snapshot, region->address, region->size);
+        branch_state_protect(region);
+    }
+}
+
+static void branch_state_restore(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    if(ctx->num_state_regions == 0) {
+        return;
+    }
+    for(i = 0; i < ctx->num_state_regions; i++) {
+        branch_state_restore_region(&ctx->state_regions[i]);
+    }
+    /* The handler is reinstalled if a foreign fault or a child process removed it */
+    branch_state_install_handler();
+}
+
+/* Leave the registered regions writable when the exploration ends */
+static void branch_state_release(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    for(i = 0; i < ctx->num_state_regions; i++) {
+        branch_state_unprotect(&ctx->state_regions[i]);
+    }
+    branch_state_uninstall_handler();
+}
+
+/*****************************************************************************/
+/**** Fault injection                                                        ***/
+/*****************************************************************************/
+
+/* Environment variable with the comma separated functions to inject faults into, "*" for all */
+#define BRANCH_FAULTS_ENV "CMOCKA_BRANCHES_FAULTS"
+/* File of fault points whose caller can't be resolved to a module */
+#define BRANCH_FAULT_FILE "<fault injection>"
+
+static const char * const branch_fault_twig_names[] = { "succeed", "fail" };
+
+/* Fault points are keyed by the module of their caller and the offset in it, stored as file and line */
+static int branch_is_fault_point(const BranchInformation *branch_info)
+{
+    return branch_info->twig_names == branch_fault_twig_names;
+}
+
+/* Read by the wrapper libraries before anything else, set only while a combination runs */
+int _branch_fault_injection_active = 0;
+
+void branch_set_fault_filter(BranchFaultFilter filter, void *data)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->fault_filter = filter;
+    ctx->fault_filter_data = data;
+}
+
+static int branch_faults_configured(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    return ctx->fault_filter != NULL || getenv(BRANCH_FAULTS_ENV) != NULL;
+}
+
+/* Filter used without branch_set_fault_filter, accepts the functions listed in the environment */
+static int branch_fault_default_filter(const char *function, const void *caller, int *error, void *data)
+{
+    const char *functions = getenv(BRANCH_FAULTS_ENV);
+    const size_t length = strlen(function);
+    (void)caller;
+    (void)error;
+    (void)data;
+    while(functions != NULL && *functions != '\0') {
+        const char * const end = strchr(functions, ',');
+        const size_t item_length = end != NULL ? (size_t)(end - functions) : strlen(functions);
+        if((item_length == 1 && functions[0] == '*') ||
+           (item_length == length && strncmp(functions, function, length) == 0)) {
+            return 1;
+        }
+        functions = end != NULL ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+/*
+ * Branch point of a wrapped call, returns 1 if the call shall fail with *error. The caller is
+ * identified by its module and offset in it, which stay the same between runs.
+ */
+int _branch_fault_point(const char *function, const void *caller, int *error)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchFaultFilter filter = ctx->fault_filter != NULL ?
+                               ctx->fault_filter : branch_fault_default_filter;
+    const char *file = BRANCH_FAULT_FILE;
+    unsigned int offset = (unsigned int)(uintptr_t)caller;
+    unsigned int value;
+#ifdef HAVE_DLADDR
+    Dl_info info;
+#endif
+    if(!ctx->enabled || ctx->faults_suspended != 0) {
+        return 0;
+    }
+    ctx->faults_suspended++;
+    if(!filter(function, caller, error, ctx->fault_filter_data)) {
+        ctx->faults_suspended--;
+        return 0;
+    }
+#ifdef HAVE_DLADDR
+    if(caller != NULL && dladdr(caller, &info) != 0 && info.dli_fname != NULL) {
+        file = info.dli_fname;
+        offset = (unsigned int)((uintptr_t)caller - (uintptr_t)info.dli_fbase);
+    }
+#endif
+    value = branch_start_point(function, 2, branch_fault_twig_names, NULL, NULL, NULL, file, (int)offset, function);
+    branch_end_point(function, NULL, file, (int)offset, function);
+    ctx->faults_suspended--;
+    return value == 1;
+}
+
+/*****************************************************************************/
+/**** Performance counters                                                   ***/
+/*****************************************************************************/
+
+/* Environment variable enabling the performance counters, used when branch_set_perf_counters is not called */
+#define BRANCH_PERF_ENV "CMOCKA_BRANCHES_PERF"
+/* A twig is reported when its average count is this many times larger than the average of its siblings */
+#define BRANCH_PERF_OUTLIER_FACTOR 4
+
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(HAVE_SYS_SYSCALL_H) && defined(HAVE_UNISTD_H) && defined(__NR_perf_event_open)
+#define BRANCH_PERF_SUPPORTED 1
+#endif
+
+/* Names of the counters, and averages per combination below which a twig is never reported */
+static const char * const branch_perf_names[BRANCH_PERF_COUNTERS] = {
+    "instructions", "cycles", "cache_misses", "page_faults", "context_switches"
+};
+static const char * const branch_perf_software_names[BRANCH_PERF_COUNTERS] = {
+    "instructions", "task_clock_ns", "cache_misses", "page_faults", "context_switches"
+};
+static const uint64_t branch_perf_outlier_min[BRANCH_PERF_COUNTERS] = {
+    100000, 100000, 1000, 16, 2
+};
+
+void branch_set_perf_counters(const int enabled)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->perf = enabled;
+}
+
+static int branch_perf_enabled(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const perf = getenv(BRANCH_PERF_ENV);
+    return ctx->perf || (perf != NULL && perf[0] == '1');
+}
+
+static const char *branch_perf_name(const unsigned int counter)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    return ctx->perf_software[counter] ? branch_perf_software_names[counter] : branch_perf_names[counter];
+}
+
+#ifdef BRANCH_PERF_SUPPORTED
+
+/* Count an event of the calling thread, excluding the kernel if the system does not allow counting it */
+static int branch_perf_open_event(const uint32_t type, const uint64_t config)
+{
+    struct perf_event_attr attr;
+    int fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_hv = 1;
+    fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if(fd < 0) {
+        attr.exclude_kernel = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+/* Open the counters for this process, falling back to software counters where hardware ones are missing */
+static void branch_perf_open(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    static const uint64_t hardware[BRANCH_PERF_COUNTERS] = {
+        PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, 0, 0
+    };
+    static const uint64_t software[BRANCH_PERF_COUNTERS] = {
+        0, PERF_COUNT_SW_TASK_CLOCK, 0, PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_CONTEXT_SWITCHES
+    };
+    static const int has_hardware[BRANCH_PERF_COUNTERS] = { 1, 1, 1, 0, 0 };
+    static const int has_software[BRANCH_PERF_COUNTERS] = { 0, 1, 0, 1, 1 };
+    unsigned int i, available = 0;
+    for(i = 0; i < BRANCH_PERF_COUNTERS; i++) {
+        int fd = -1;
+        ctx->perf_software[i] = 0;
+        if(has_hardware[i]) {
+            fd = branch_perf_open_event(PERF_TYPE_HARDWARE, hardware[i]);
+        }
+        if(fd < 0 && has_software[i]) {
+            fd = branch_perf_open_event(PERF_TYPE_SOFTWARE, software[i]);
+            ctx->perf_software[i] = has_hardware[i];
+        }
+        ctx->perf_fds[i] = fd;
+        ctx->perf_available[i] = fd >= 0;
+        available += fd >= 0;
+    }
+    ctx->perf_open = 1;
+    if(available == 0) {
+        branch_print_message("Branch perf: no performance counters available\n");
+    }
+}
+
+static void branch_perf_close(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    if(!ctx->perf_open) {
+        return;
+    }
+    for(i = 0; i < BRANCH_PERF_COUNTERS; i++) {
+        if(ctx->perf_available[i]) {
+            close(ctx->perf_fds[i]);
+        }
+    }
+    ctx->perf_open = 0;
+}
+
+static void branch_perf_read(uint64_t *values)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    for(i = 0; i < BRANCH_PERF_COUNTERS; i++) {
+        values[i] = 0;
+        if(ctx->perf_available[i] &&
+           read(ctx->perf_fds[i], &values[i], sizeof(values[i])) != (ssize_t)sizeof(values[i])) {
+            values[i] = 0;
+        }
+    }
+}
+
+#else /* BRANCH_PERF_SUPPORTED */
+
+static void branch_perf_open(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int i;
+    for(i = 0; i < BRANCH_PERF_COUNTERS; i++) {
+        ctx->perf_available[i] = 0;
+        ctx->perf_software[i] = 0;
+    }
+    branch_print_message("Branch perf: performance counters are not supported on this platform\n");
+}
+
+static void branch_perf_close(void)
+{
+}
+
+static void branch_perf_read(uint64_t *values)
+{
+    memset(values, 0, BRANCH_PERF_COUNTERS * sizeof(values[0]));
+}
+
+#endif /* BRANCH_PERF_SUPPORTED */
+
+static void branch_perf_begin(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    memset(ctx->perf_combination, 0, sizeof(ctx->perf_combination));
+    if(ctx->perf_open) {
+        branch_perf_read(ctx->perf_start);
+    }
+}
+
+static void branch_perf_end(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    uint64_t now[BRANCH_PERF_COUNTERS];
+    unsigned int i;
+    if(!ctx->perf_open) {
+        return;
+    }
+    branch_perf_read(now);
+    for(i = 0; i < BRANCH_PERF_COUNTERS; i++) {
+        ctx->perf_combination[i] = now[i] - ctx->perf_start[i];
+    }
+}
+
+/* Report twigs whose average counts stand out from their siblings, recursively below twig */
+static void branch_perf_report(const BranchTwig *twig)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ListNode *subbranch_node;
+    for(subbranch_node = twig->subbranches.next; subbranch_node != &twig->subbranches; subbranch_node = subbranch_node->next) {
+        const BranchInformation * const branch_info = (const BranchInformation*)subbranch_node->value;
+        uint64_t average_sum[BRANCH_PERF_COUNTERS];
+        unsigned int position = 0, counter;
+        const BranchTwig *subtwig;
+        memset(average_sum, 0, sizeof(average_sum));
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            const BranchTwigStats * const stats = subtwig->stats;
+            if(stats != NULL && stats->combinations != 0) {
+                for(counter = 0; counter < BRANCH_PERF_COUNTERS; counter++) {
+                    average_sum[counter] += stats->perf[counter] / stats->combinations;
+                }
+            }
+        }
+        for(counter = 0; branch_info->folded != NULL && counter < BRANCH_PERF_COUNTERS; counter++) {
+            average_sum[counter] += branch_info->folded->perf_average_sum[counter];
+        }
+        position = 0;
+        while((subtwig = branch_twig_next(branch_info, &position)) != NULL) {
+            const BranchTwigStats * const stats = subtwig->stats;
+            if(stats == NULL || stats->combinations == 0) {
+                continue;
+            }
+            for(counter = 0; counter < BRANCH_PERF_COUNTERS; counter++) {
+                const uint64_t average = stats->perf[counter] / stats->combinations;
+                const uint64_t siblings_average = (average_sum[counter] - average) / (branch_info->num_twigs - 1);
+                if(ctx->perf_available[counter] &&
+                   average >= branch_perf_outlier_min[counter] &&
+                   average > BRANCH_PERF_OUTLIER_FACTOR * siblings_average) {
+                    branch_print_message("Branch perf: %llu %s per combination, siblings average %llu, in:\n",
+                                         (unsigned long long)average, branch_perf_name(counter),
+                                         (unsigned long long)siblings_average);
+                    branch_print_twig_ancestry(subtwig);
+                }
+            }
+            branch_perf_report(subtwig);
+        }
+    }
+}
+
+/*****************************************************************************/
+/**** Combination statistics                                                 ***/
+/*****************************************************************************/
+
+typedef enum
+{
+    BRANCH_COMBINATION_PASSED,
+    BRANCH_COMBINATION_FAILED,
+    BRANCH_COMBINATION_PRUNED,
+} BranchCombinationOutcome;
+
+/* Information about a finished combination, attributed to each of its twigs */
+typedef struct
+{
+    BranchCombinationOutcome outcome;
+    uint64_t time_ns;
+    size_t heap_leaked;
+} BranchCombinationResult;
+
+static uint64_t branch_time_ns(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_STRUCT_TIMESPEC)
+    struct timespec now;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    clock_gettime(CLOCK_REALTIME, &now);
+#endif
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#else
+    return (uint64_t)clock() * (1000000000ULL / CLOCKS_PER_SEC);
+#endif
+}
+
+static BranchTwigStats* branch_twig_stats(BranchTwig *twig)
+{
+    if(twig->stats == NULL) {
+        twig->stats = (BranchTwigStats*)calloc(1, sizeof(BranchTwigStats));
+    }
+    return twig->stats;
+}
+
+/*
+ * Fold the statistics of a lazy twig that is left into its branch and free them, so the twig can be
+ * freed. Twigs with failures or leaks, or whose heap peak or counters could make them an outlier of
+ * the reports, keep their own statistics. Returns 1 if the statistics were folded.
+ */
+static int branch_twig_stats_fold(BranchTwig *twig)
+{
+    BranchInformation * const branch_info = twig->parent_branch;
+    const BranchTwigStats * const stats = twig->stats;
+    BranchFoldedStats *folded;
+    unsigned int i;
+    if(stats->failures != 0 || stats->heap_leaked != 0 || stats->heap_peak >= BRANCH_HEAP_OUTLIER_MIN_BYTES) {
+        return 0;
+    }
+    for(i = 0; i < BRANCH_PERF_COUNTERS; i++) {
+        if(stats->combinations != 0 && stats->perf[i] / stats->combinations >= branch_perf_outlier_min[i]) {
+            return 0;
+        }
+    }
+    if(branch_info->folded == NULL) {
+        branch_info->folded = (BranchFoldedStats*)calloc(1, sizeof(BranchFoldedStats));
+    }
+    folded = branch_info->folded;
+    folded->stats.combinations += stats->combinations;
+    folded->stats.pruned += stats->pruned;
+    folded->stats.time_ns += stats->time_ns;
+    folded->stats.heap_allocated += stats->heap_allocated;
+    if(stats->heap_peak > folded->stats.heap_peak) {
+        folded->stats.heap_peak = stats->heap_peak;
+    }
+    folded->heap_peak_sum += stats->heap_peak;
+    for(i = 0; i < BRANCH_PERF_COUNTERS; i++) {
+        folded->stats.perf[i] += stats->perf[i];
+        if(stats->combinations != 0) {
+            folded->perf_average_sum[i] += stats->perf[i] / stats->combinations;
+        }
+    }
+    free(twig->stats);
+    twig->stats = NULL;
+    return 1;
+}
+
+static void branch_stats_visitor(BranchTwig *twig, unsigned int nesting, void *data)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const BranchCombinationResult * const result = (const BranchCombinationResult*)data;
+    BranchTwigStats * const stats = branch_twig_stats(twig);
+    (void)nesting;
+    stats->combinations++;
+    stats->failures += result->outcome == BRANCH_COMBINATION_FAILED;
+    stats->pruned += result->outcome == BRANCH_COMBINATION_PRUNED;
+    stats->time_ns += result->time_ns;
+    stats->heap_allocated += ctx->heap_combination_allocated;
+    stats->heap_leaked += result->heap_leaked;
+    if(ctx->perf_active) {
+        unsigned int i;
+        for(i = 0; i < BRANCH_PERF_COUNTERS; i++) {
+            stats->perf[i] += ctx->perf_combination[i];
+        }
+    }
+    if(ctx->heap_combination_peak > stats->heap_peak) {
+        stats->heap_peak = ctx->heap_combination_peak;
+    }
+}
+
+/* Account a finished or failed combination, and attribute it to its twigs if statistics are collected */
+static void branch_stats_record(const BranchCombinationOutcome outcome)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchCombinationResult result;
+    result.outcome = outcome;
+    result.time_ns = branch_time_ns() - ctx->combination_start_ns;
+    result.heap_leaked = 0;
+    if(ctx->heap_live > ctx->heap_combination_start) {
+        result.heap_leaked = ctx->heap_live - ctx->heap_combination_start;
+    }
+    ctx->combinations++;
+    ctx->failed_combinations += outcome == BRANCH_COMBINATION_FAILED;
+    ctx->pruned_combinations += outcome == BRANCH_COMBINATION_PRUNED;
+    ctx->time_ns += result.time_ns;
+    if(ctx->timings.active_file != NULL) {
+        branch_timing_record(result.time_ns);
+    }
+    if(ctx->collect_twig_stats || ctx->heap_accounting_active) {
+        branch_visit_current_path(branch_stats_visitor, &result);
+    }
+    if(branch_trace.active) {
+        if(outcome == BRANCH_COMBINATION_FAILED) {
+            branch_trace_record(BRANCH_TRACE_FAILURE, 0, 0);
+        }
+        branch_trace_record(BRANCH_TRACE_COMBINATION_END, 0, (uint32_t)outcome);
+    }
+}
+
+static void branch_combination_begin(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->combinations > 0) {
+        branch_state_restore();
+    }
+    ctx->heap_combination_start = ctx->heap_live;
+    ctx->heap_combination_allocated = 0;
+    ctx->heap_combination_peak = 0;
+    ctx->combination_start_ns = branch_time_ns();
+    ctx->combination_pruned = 0;
+    ctx->monitor_path_id = BRANCH_MONITOR_PATH_ID_BASIS;
+    ctx->path_starts = 0;
+    branch_threads_release();
+    ctx->monitor_depth = 0;
+    if(ctx->num_exclusions != 0) {
+        memset(ctx->exclusion_marks, 0, 2 * ctx->num_exclusions * sizeof(unsigned int));
+    }
+    BRANCH_TRACE_EVENT(BRANCH_TRACE_COMBINATION_BEGIN, 0, 0);
+    branch_perf_begin();
+    _branch_fault_injection_active = ctx->faults_configured;
+}
+
+static void branch_combination_end(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    _branch_fault_injection_active = 0;
+    branch_perf_end();
+    if(!ctx->combination_pruned) {
+        branch_stats_record(BRANCH_COMBINATION_PASSED);
+    }
+    branch_cache_combination_end();
+}
+
+/*****************************************************************************/
+/**** Live progress monitor                                                  ***/
+/*****************************************************************************/
+
+/* Environment variable with the path of the progress block, used when branch_set_monitor_file is not called */
+#define BRANCH_MONITOR_ENV "CMOCKA_BRANCHES_MONITOR"
+/* Length of the window the combination rate is measured over */
+#define BRANCH_MONITOR_RATE_WINDOW_NS 1000000000ULL
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_FTRUNCATE) && defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H)
+#define BRANCH_MONITOR_SUPPORTED 1
+#endif
+
+/* Readers poll the block concurrently, fields are stored without tearing where the compiler can */
+#if defined(__ATOMIC_RELAXED) && defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define BRANCH_MONITOR_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define BRANCH_MONITOR_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+#define BRANCH_MONITOR_STORE(field, value) ((field) = (value))
+#define BRANCH_MONITOR_FENCE()
+#endif
+
+void branch_set_monitor_file(const char *path)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->monitor_file = path;
+}
+
+static const char *branch_monitor_file(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->monitor_file != NULL) {
+        return ctx->monitor_file;
+    }
+    return getenv(BRANCH_MONITOR_ENV);
+}
+
+static void branch_monitor_set_test_name(volatile BranchMonitorBlock *monitor, const char *test_name)
+{
+    unsigned int i;
+    BRANCH_MONITOR_STORE(monitor->sequence, monitor->sequence + 1);
+    BRANCH_MONITOR_FENCE();
+    for(i = 0; i + 1 < BRANCH_MONITOR_TEST_NAME_SIZE && test_name[i] != '\0'; i++) {
+        monitor->test_name[i] = test_name[i];
+    }
+    monitor->test_name[i] = '\0';
+    BRANCH_MONITOR_FENCE();
+    BRANCH_MONITOR_STORE(monitor->sequence, monitor->sequence + 1);
+}
+
+/* Map the progress block if monitoring is configured, and reset it for the new exploration */
+static void branch_monitor_open(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+#ifdef BRANCH_MONITOR_SUPPORTED
+    const char * const path = branch_monitor_file();
+    volatile BranchMonitorBlock *monitor;
+    void *mapping;
+    int fd;
+    ctx->monitor = NULL;
+    if(path == NULL || path[0] == '\0') {
+        return;
+    }
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0 || ftruncate(fd, sizeof(BranchMonitorBlock)) != 0 ||
+       (mapping = mmap(NULL, sizeof(BranchMonitorBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        cm_print_error("ERROR: Could not map branch progress block %s\n", path);
+        if(fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    close(fd);
+    monitor = (volatile BranchMonitorBlock*)mapping;
+    BRANCH_MONITOR_STORE(monitor->running, 0);
+    BRANCH_MONITOR_STORE(monitor->combinations, 0);
+    BRANCH_MONITOR_STORE(monitor->failures, 0);
+    BRANCH_MONITOR_STORE(monitor->pruned, 0);
+    BRANCH_MONITOR_STORE(monitor->path_id, 0);
+    BRANCH_MONITOR_STORE(monitor->nodes, 0);
+    BRANCH_MONITOR_STORE(monitor->nesting_depth, 0);
+    BRANCH_MONITOR_STORE(monitor->combinations_per_second, 0);
+    branch_monitor_set_test_name(monitor, ctx->test_name != NULL ? ctx->test_name : "");
+    BRANCH_MONITOR_STORE(monitor->pid, (uint32_t)getpid());
+    BRANCH_MONITOR_STORE(monitor->start_ns, branch_time_ns());
+    BRANCH_MONITOR_STORE(monitor->update_ns, monitor->start_ns);
+    BRANCH_MONITOR_STORE(monitor->version, BRANCH_MONITOR_VERSION);
+    BRANCH_MONITOR_STORE(monitor->magic, BRANCH_MONITOR_MAGIC);
+    BRANCH_MONITOR_FENCE();
+    BRANCH_MONITOR_STORE(monitor->running, 1);
+    ctx->monitor = monitor;
+    ctx->monitor_window_ns = monitor->start_ns;
+    ctx->monitor_window_combinations = 0;
+#endif
+}
+
+/* Publish the progress after a combination, called from branches_restart */
+static void branch_monitor_update(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    volatile BranchMonitorBlock * const monitor = ctx->monitor;
+    const uint64_t now = branch_time_ns();
+    BRANCH_MONITOR_STORE(monitor->combinations, ctx->combinations);
+    BRANCH_MONITOR_STORE(monitor->failures, ctx->failed_combinations);
+    BRANCH_MONITOR_STORE(monitor->pruned, ctx->pruned_combinations);
+    BRANCH_MONITOR_STORE(monitor->path_id, ctx->monitor_path_id);
+    BRANCH_MONITOR_STORE(monitor->nesting_depth, ctx->monitor_depth);
+    BRANCH_MONITOR_STORE(monitor->nodes, ctx->discovered_nodes);
+    BRANCH_MONITOR_STORE(monitor->update_ns, now);
+    if(now - ctx->monitor_window_ns >= BRANCH_MONITOR_RATE_WINDOW_NS) {
+        const unsigned long window_combinations = ctx->combinations - ctx->monitor_window_combinations;
+        BRANCH_MONITOR_STORE(monitor->combinations_per_second,
+                             (uint64_t)window_combinations * 1000000000ULL / (now - ctx->monitor_window_ns));
+        ctx->monitor_window_ns = now;
+        ctx->monitor_window_combinations = ctx->combinations;
+    }
+}
+
+static void branch_monitor_close(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+#ifdef BRANCH_MONITOR_SUPPORTED
+    volatile BranchMonitorBlock * const monitor = ctx->monitor;
+    if(monitor == NULL) {
+        return;
+    }
+    branch_monitor_update();
+    if(ctx->combinations > ctx->monitor_window_combinations &&
+       monitor->update_ns > ctx->monitor_window_ns) {
+        /* Explorations shorter than the rate window get their average rate */
+        BRANCH_MONITOR_STORE(monitor->combinations_per_second,
+                             (uint64_t)(ctx->combinations - ctx->monitor_window_combinations) *
+                             1000000000ULL / (monitor->update_ns - ctx->monitor_window_ns));
+    }
+    BRANCH_MONITOR_FENCE();
+    BRANCH_MONITOR_STORE(monitor->running, 0);
+    munmap((void*)monitor, sizeof(BranchMonitorBlock));
+    ctx->monitor = NULL;
+#endif
+}
+
+/*****************************************************************************/
+/**** Event trace                                                            ***/
+/*****************************************************************************/
+
+/* Environment variable with the path of the trace, used when branch_set_trace_file is not called */
+#define BRANCH_TRACE_ENV "CMOCKA_BRANCHES_TRACE"
+/* Records buffered by a thread before they are appended to the trace */
+#define BRANCH_TRACE_BUFFER_RECORDS 4096
+
+#if defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H)
+#define BRANCH_TRACE_SUPPORTED 1
+#endif
+
+void branch_set_trace_file(const char *path)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->trace_file = path;
+}
+
+static const char *branch_trace_file(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->trace_file != NULL) {
+        return ctx->trace_file;
+    }
+    return getenv(BRANCH_TRACE_ENV);
+}
+
+#ifdef BRANCH_TRACE_SUPPORTED
+
+/* Site and thread numbers are shared by the threads of the process */
+#if defined(__ATOMIC_RELAXED)
+#define BRANCH_TRACE_NEXT(counter) __atomic_add_fetch(&(counter), 1, __ATOMIC_RELAXED)
+#else
+#define BRANCH_TRACE_NEXT(counter) (++(counter))
+#endif
+
+static uint32_t branch_trace_last_site;
+static uint32_t branch_trace_last_thread;
+/* The first trace opened by the process replaces the file of an earlier run */
+static uint32_t branch_trace_files_opened;
+
+/* Append a chunk to the trace in a single write, so chunks of other threads and processes don't interleave with it */
+static void branch_trace_write(const uint16_t kind, char *chunk, const uint32_t size)
+{
+    BranchTraceChunk * const header = (BranchTraceChunk*)chunk;
+    const char *data = chunk;
+    size_t left = sizeof(BranchTraceChunk) + size;
+    header->magic = BRANCH_TRACE_MAGIC;
+    header->version = BRANCH_TRACE_VERSION;
+    header->kind = kind;
+    header->pid = (uint32_t)getpid();
+    header->thread = branch_trace.thread;
+    header->size = size;
+    header->reserved = 0;
+    while(left > 0) {
+        const ssize_t written = write(branch_trace.fd, data, left);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            cm_print_error("ERROR: Could not write the branch trace, tracing stopped\n");
+            branch_trace.active = 0;
+            return;
+        }
+        data += written;
+        left -= (size_t)written;
+    }
+}
+
+static void branch_trace_flush(void)
+{
+    if(branch_trace.users == 0 || branch_trace.num_records == 0) {
+        return;
+    }
+    branch_trace_write(BRANCH_TRACE_CHUNK_RECORDS, branch_trace.buffer, branch_trace.num_records * (uint32_t)sizeof(BranchTraceRecord));
+    branch_trace.num_records = 0;
+}
+
+static void branch_trace_record(const uint32_t type, const uint32_t site, const uint32_t value)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchTraceRecord * const record = &branch_trace.records[branch_trace.num_records];
+    record->time_ns = branch_time_ns();
+    record->type = type;
+    record->site = site;
+    record->value = value;
+    record->depth = ctx->nesting_level;
+    if(++branch_trace.num_records == BRANCH_TRACE_BUFFER_RECORDS) {
+        branch_trace_flush();
+    }
+}
+
+static unsigned int branch_trace_site_hash(const char *name, const char *file, const int line, const unsigned int mask)
+{
+    const uintptr_t hash = ((uintptr_t)file >> 3) ^ ((uintptr_t)name >> 1) ^ ((uintptr_t)line * 0x9e3779b1u);
+    return (unsigned int)(hash ^ (hash >> 16)) & mask;
+}
+
+/* Write the site chunk describing the branch point */
+static void branch_trace_write_site(const BranchInformation *branch_info, const uint32_t id)
+{
+    const unsigned int num_names = branch_info->twig_names != NULL ? branch_info->num_twigs : 0;
+    size_t size = sizeof(BranchTraceSite) + strlen(branch_info->name) + strlen(branch_info->file) +
+                  strlen(branch_info->function_name) + 3;
+    BranchTraceSite *site;
+    char *chunk;
+    char *strings;
+    unsigned int i;
+    for(i = 0; i < num_names; i++) {
+        size += strlen(branch_info->twig_names[i]) + 1;
+    }
+    chunk = (char*)malloc(sizeof(BranchTraceChunk) + size);
+    site = (BranchTraceSite*)(chunk + sizeof(BranchTraceChunk));
+    site->id = id;
+    site->line = (int32_t)branch_info->line;
+    site->num_twigs = branch_info->num_twigs;
+    site->num_names = num_names;
+    strings = (char*)(site + 1);
+    strings = strcpy(strings, branch_info->name) + strlen(branch_info->name) + 1;
+    strings = strcpy(strings, branch_info->file) + strlen(branch_info->file) + 1;
+    strings = strcpy(strings, branch_info->function_name) + strlen(branch_info->function_name) + 1;
+    for(i = 0; i < num_names; i++) {
+        strings = strcpy(strings, branch_info->twig_names[i]) + strlen(branch_info->twig_names[i]) + 1;
+    }
+    branch_trace_write(BRANCH_TRACE_CHUNK_SITE, chunk, (uint32_t)size);
+    free(chunk);
+}
+
+/* Site id of the branch, describing its branch point in the trace the first time the thread sees it */
+static uint32_t branch_trace_site(BranchInformation *branch_info)
+{
+    unsigned int mask;
+    unsigned int i;
+    if(branch_info->trace_site != 0) {
+        return branch_info->trace_site;
+    }
+    if(2 * (branch_trace.num_sites + 1) > branch_trace.sites_capacity) {
+        BranchTraceSiteEntry * const old_sites = branch_trace.sites;
+        const unsigned int old_capacity = branch_trace.sites_capacity;
+        branch_trace.sites_capacity = old_capacity != 0 ? 2 * old_capacity : 64;
+        branch_trace.sites = (BranchTraceSiteEntry*)calloc(branch_trace.sites_capacity, sizeof(BranchTraceSiteEntry));
+        mask = branch_trace.sites_capacity - 1;
+        for(i = 0; i < old_capacity; i++) {
+            if(old_sites[i].id != 0) {
+                unsigned int position = branch_trace_site_hash(old_sites[i].name, old_sites[i].file, old_sites[i].line, mask);
+                while(branch_trace.sites[position].id != 0) {
+                    position = (position + 1) & mask;
+                }
+                branch_trace.sites[position] = old_sites[i];
+            }
+        }
+        free(old_sites);
+    }
+    mask = branch_trace.sites_capacity - 1;
+    /* Branch points are identified by the addresses of their strings, as they are literals of the call site */
+    for(i = branch_trace_site_hash(branch_info->name, branch_info->file, (int)branch_info->line, mask); branch_trace.sites[i].id != 0; i = (i + 1) & mask) {
+        const BranchTraceSiteEntry * const entry = &branch_trace.sites[i];
+        if(entry->name == branch_info->name && entry->file == branch_info->file &&
+           entry->function_name == branch_info->function_name && entry->line == (int)branch_info->line) {
+            branch_info->trace_site = entry->id;
+            return entry->id;
+        }
+    }
+    branch_trace.sites[i].name = branch_info->name;
+    branch_trace.sites[i].file = branch_info->file;
+    branch_trace.sites[i].function_name = branch_info->function_name;
+    branch_trace.sites[i].line = (int)branch_info->line;
+    branch_trace.sites[i].id = BRANCH_TRACE_NEXT(branch_trace_last_site);
+    branch_trace.num_sites++;
+    branch_info->trace_site = branch_trace.sites[i].id;
+    branch_trace_write_site(branch_info, branch_info->trace_site);
+    return branch_info->trace_site;
+}
+
+/* Start tracing if a trace file is configured, the thread opens the file for its first exploration */
+static void branch_trace_open(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const path = branch_trace_file();
+    if(path == NULL || path[0] == '\0') {
+        return;
+    }
+    if(branch_trace.users == 0) {
+        const int truncate = BRANCH_TRACE_NEXT(branch_trace_files_opened) == 1;
+        branch_trace.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0644);
+        if(branch_trace.fd < 0) {
+            cm_print_error("ERROR: Could not open branch trace %s\n", path);
+            return;
+        }
+        if(branch_trace.thread == 0) {
+            branch_trace.thread = BRANCH_TRACE_NEXT(branch_trace_last_thread);
+        }
+        branch_trace.buffer = (char*)malloc(sizeof(BranchTraceChunk) + BRANCH_TRACE_BUFFER_RECORDS * sizeof(BranchTraceRecord));
+        branch_trace.records = (BranchTraceRecord*)(branch_trace.buffer + sizeof(BranchTraceChunk));
+        branch_trace.num_records = 0;
+    }
+    branch_trace.users++;
+    branch_trace.active = 1;
+    ctx->trace_opened = 1;
+}
+
+static void branch_trace_close(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(!ctx->trace_opened) {
+        return;
+    }
+    ctx->trace_opened = 0;
+    branch_trace_flush();
+    if(--branch_trace.users != 0) {
+        /* Back to the exploration this one was run from */
+        branch_trace.active = 1;
+        return;
+    }
+    close(branch_trace.fd);
+    free(branch_trace.buffer);
+    free(branch_trace.sites);
+    branch_trace.buffer = NULL;
+    branch_trace.records = NULL;
+    branch_trace.sites = NULL;
+    branch_trace.sites_capacity = 0;
+    branch_trace.num_sites = 0;
+    branch_trace.active = 0;
+}
+
+#if defined(HAVE_FORK) && defined(HAVE_UNISTD_H) && defined(HAVE_SYS_WAIT_H) && defined(HAVE_POLL_H)
+/* Stop recording in the parent of isolated combinations, flushing first so the children don't inherit the records */
+static void branch_trace_suspend(void)
+{
+    branch_trace_flush();
+    branch_trace.active = 0;
+}
+
+/* Record the combinations of an isolated child, describing the sites again under its own process id */
+static void branch_trace_resume_child(void)
+{
+    if(branch_trace.users == 0) {
+        return;
+    }
+    if(branch_trace.sites != NULL) {
+        memset(branch_trace.sites, 0, branch_trace.sites_capacity * sizeof(BranchTraceSiteEntry));
+    }
+    branch_trace.num_sites = 0;
+    branch_trace.active = 1;
+}
+#endif
+
+#else /* BRANCH_TRACE_SUPPORTED */
+
+static void branch_trace_flush(void)
+{
+}
+
+static void branch_trace_record(const uint32_t type, const uint32_t site, const uint32_t value)
+{
+    (void)type;
+    (void)site;
+    (void)value;
+}
+
+static uint32_t branch_trace_site(BranchInformation *branch_info)
+{
+    (void)branch_info;
+    return 0;
+}
+
+static void branch_trace_open(void)
+{
+    const char * const path = branch_trace_file();
+    if(path != NULL && path[0] != '\0') {
+        cm_print_error("ERROR: Branch traces are not supported on this platform\n");
+    }
+}
+
+static void branch_trace_close(void)
+{
+}
+
+#if defined(HAVE_FORK) && defined(HAVE_UNISTD_H) && defined(HAVE_SYS_WAIT_H) && defined(HAVE_POLL_H)
+static void branch_trace_suspend(void)
+{
+}
+
+static void branch_trace_resume_child(void)
+{
+}
+#endif
+
+#endif /* BRANCH_TRACE_SUPPORTED */
+
+/*****************************************************************************/
+/**** Pruning                                                                ***/
+/*****************************************************************************/
+
+void branch_set_exclusions(const BranchExclusion *exclusions, const unsigned int num_exclusions)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    free(ctx->exclusion_marks);
+    ctx->exclusions = exclusions;
+    ctx->num_exclusions = exclusions != NULL ? num_exclusions : 0;
+    ctx->exclusion_marks = NULL;
+    if(ctx->num_exclusions != 0) {
+        ctx->exclusion_marks = (unsigned int*)calloc(2 * ctx->num_exclusions, sizeof(unsigned int));
+    }
+}
+
+/* A side of an exclusion applies to the branches with its name, and only at its call site if it has a file */
+static int branch_exclusion_applies(const char *name, const char *file, const int line, const BranchInformation *branch_info)
+{
+    size_t file_length, info_length;
+    if(strcmp(name, branch_info->name) != 0) {
+        return 0;
+    }
+    if(file == NULL) {
+        return 1;
+    }
+    file_length = strlen(file);
+    info_length = strlen(branch_info->file);
+    return branch_info->line == (unsigned int)line && info_length >= file_length &&
+           strcmp(branch_info->file + info_length - file_length, file) == 0;
+}
+
+/* Returns 1 if twig value of the branch is excluded by a twig taken before position in the combination */
+static int branch_twig_excluded(const BranchInformation *branch_info, const unsigned int value, const unsigned int position)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const unsigned int * const marks = ctx->exclusion_marks;
+    unsigned int i;
+    for(i = 0; i < ctx->num_exclusions; i++) {
+        const BranchExclusion * const exclusion = &ctx->exclusions[i];
+        if(exclusion->twig == value && marks[2 * i + 1] != 0 && marks[2 * i + 1] <= position &&
+           branch_exclusion_applies(exclusion->branch, exclusion->file, exclusion->line, branch_info)) {
+            return 1;
+        }
+        if(exclusion->excluded_twig == value && marks[2 * i] != 0 && marks[2 * i] <= position &&
+           branch_exclusion_applies(exclusion->excluded_branch, exclusion->excluded_file, exclusion->excluded_line, branch_info)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Mark the exclusions involving twig value of the branch, taken at position in the combination */
+static void branch_exclusions_mark(const BranchInformation *branch_info, const unsigned int value, const unsigned int position)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int * const marks = ctx->exclusion_marks;
+    unsigned int i;
+    for(i = 0; i < ctx->num_exclusions; i++) {
+        const BranchExclusion * const exclusion = &ctx->exclusions[i];
+        if(exclusion->twig == value && marks[2 * i] == 0 &&
+           branch_exclusion_applies(exclusion->branch, exclusion->file, exclusion->line, branch_info)) {
+            marks[2 * i] = position + 1;
+        }
+        if(exclusion->excluded_twig == value && marks[2 * i + 1] == 0 &&
+           branch_exclusion_applies(exclusion->excluded_branch, exclusion->excluded_file, exclusion->excluded_line, branch_info)) {
+            marks[2 * i + 1] = position + 1;
+        }
+    }
+}
+
+/* Twigs are passed over for exclusions, or for the paths of other shards */
+static int branch_skips_twigs(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    return ctx->num_exclusions != 0 || ctx->complement_active;
+}
+
+/* Returns 1 if twig value of the branch is excluded by the twigs taken before it, or planned for a shard */
+static int branch_twig_skipped(const BranchInformation *branch_info, const unsigned int value)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    return (ctx->num_exclusions != 0 && branch_twig_excluded(branch_info, value, branch_info->path_start)) ||
+           branch_complement_planned(value, branch_info->path_start);
+}
+
+/* Move the branch past the twigs it skips, up to its last twig */
+static void branch_twigs_skip(BranchInformation *branch_info)
+{
+    while(branch_info->current_twig_idx + 1 < branch_info->num_twigs &&
+          branch_twig_skipped(branch_info, branch_twig_value(branch_info, branch_info->current_twig_idx))) {
+        branch_leave_twig(branch_info);
+        branch_info->current_twig_idx++;
+    }
+}
+
+/* Returns 1 if the branch has a twig after the current one that it doesn't skip */
+static int branch_twigs_remaining(const BranchInformation *branch_info)
+{
+    unsigned int idx;
+    for(idx = branch_info->current_twig_idx + 1; idx < branch_info->num_twigs; idx++) {
+        if(!branch_twig_skipped(branch_info, branch_twig_value(branch_info, idx))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Account the current combination as pruned and end it at the current branch point */
+static void branch_prune_record(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    branch_perf_end();
+    branch_stats_record(BRANCH_COMBINATION_PRUNED);
+    ctx->combination_pruned = 1;
+    /* The recorded path of a pruned combination is incomplete, it can't be replayed */
+    ctx->cache.in_sync = 0;
+    branch_truncate_combination();
+}
+
+static void branch_prune(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    branch_isolation_send_prune();
+    branch_prune_record();
+    longjmp(*ctx->prune_env, 1);
+}
+
+/*
+ * Run the combination, or replay it from the cache. Returns 1 if it was replayed. Faults are
+ * suspended during the exploration except while the test function runs, so only its calls are
+ * fault points, not those the engine makes itself.
+ */
+static int branch_run_combination(BranchInnerFunction func, void *state)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const int faults_suspended = ctx->faults_suspended;
+    jmp_buf prune_env;
+    volatile int replayed = 0;
+    ctx->prune_env = &prune_env;
+    if(setjmp(prune_env) == 0) {
+        replayed = branch_cache_replay_combination();
+        if(!replayed) {
+            ctx->faults_suspended--;
+            func(state);
+        }
+    }
+    /* Also after a prune, which jumps here from inside the engine */
+    ctx->faults_suspended = faults_suspended;
+    ctx->prune_env = NULL;
+    return replayed;
+}
+
+void _branch_assume(const int condition, const char *expression, const char *file, const int line)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const BranchTwig *twig;
+    if(condition) {
+        return;
+    }
+    ctx->faults_suspended++;
+    if(!ctx->enabled || ctx->prune_env == NULL) {
+        cm_print_error(SOURCE_LOCATION_FORMAT ": error: Branch assumption %s checked outside a branch combination\n",
+                       file, line, expression);
+        _fail(file, line);
+        return;
+    }
+    /* A prune jumps over the frames of the open C++ branch scopes, which must be unwound instead */
+    for(twig = ctx->current_twig; twig->parent_branch != NULL; twig = twig->parent_branch->parent_twig) {
+        if(twig->parent_branch->site != NULL) {
+            cm_print_error(SOURCE_LOCATION_FORMAT ": error: Branch assumption %s checked inside the C++ branch scope %s,"
+                           " check it before the scope starts\n", file, line, expression, twig->parent_branch->name);
+            _fail(file, line);
+            return;
+        }
+    }
+    branch_prune();
+}
+
+/*****************************************************************************/
+/**** Crash isolation                                                        ***/
+/*****************************************************************************/
+
+/* Environment variable with the number of combinations per child process, used when branch_set_isolation is not called */
+#define BRANCH_ISOLATION_ENV "CMOCKA_BRANCHES_ISOLATION"
+/* Environment variable with the timeout of one combination in milliseconds */
+#define BRANCH_TIMEOUT_ENV "CMOCKA_BRANCHES_TIMEOUT"
+
+typedef enum
+{
+    BRANCH_EVENT_START = 0,
+    BRANCH_EVENT_END = 1,
+    BRANCH_EVENT_DONE = 2,      /* The combination passed or was pruned */
+    BRANCH_EVENT_PRUNE = 3,     /* The combination was pruned at the current branch point */
+} BranchEventType;
+
+/*
+ * A branch point executed by a child process, replayed by the parent. The child is a fork of the
+ * parent, so the name and twig name pointers, which have to outlive the test, are valid in both.
+ */
+typedef struct
+{
+    BranchEventType type;
+    char const *name;
+    char const *file;
+    char const *function_name;
+    char const * const * twig_names;
+    const unsigned int *twig_classes;   /* START: valid in the parent as it is forked from it */
+    int line;
+    unsigned int num_twigs;
+    int replayed;               /* DONE: the combination was replayed from the incremental cache */
+    int last;                   /* DONE: the child exits after this combination */
+    BranchDomain domain;        /* START: values of a value domain branch point */
+    int has_domain;
+    const BranchSite *site;     /* START: call site descriptor, valid in the parent as it is forked from it */
+    uint64_t perf[BRANCH_PERF_COUNTERS];    /* DONE: performance counters of the combination */
+} BranchEvent;
+
+void branch_set_isolation(const unsigned int batch_size, const unsigned int timeout_ms)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->isolation.configured = 1;
+    ctx->isolation.batch_size = batch_size;
+    ctx->isolation.timeout_ms = timeout_ms;
+}
+
+static unsigned int branch_isolation_setting(const unsigned int value, const char *env)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const env_value = getenv(env);
+    if(ctx->isolation.configured || env_value == NULL) {
+        return value;
+    }
+    return (unsigned int)strtoul(env_value, NULL, 10);
+}
+
+#if defined(HAVE_FORK) && defined(HAVE_UNISTD_H) && defined(HAVE_SYS_WAIT_H) && defined(HAVE_POLL_H)
+
+static void branch_isolation_send(const BranchEvent *event)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char *data = (const char*)event;
+    size_t left = sizeof(*event);
+    ctx->faults_suspended++;
+    while(left > 0) {
+        const ssize_t written = write(ctx->isolation.fd, data, left);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            /* The parent is gone */
+            _exit(1);
+        }
+        data += written;
+        left -= (size_t)written;
+    }
+    ctx->faults_suspended--;
+}
+
+static void branch_isolation_send_start(const char* const name, const unsigned int num_twigs, char const * const * const twig_names, const unsigned int *twig_classes, const BranchDomain *domain, const BranchSite *site, const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchEvent event;
+    if(!ctx->isolation.child) {
+        return;
+    }
+    memset(&event, 0, sizeof(event));
+    event.type = BRANCH_EVENT_START;
+    event.name = name;
+    event.num_twigs = num_twigs;
+    event.twig_names = twig_names;
+    event.twig_classes = twig_classes;
+    if(domain != NULL) {
+        event.domain = *domain;
+        event.has_domain = 1;
+    }
+    event.site = site;
+    event.file = file;
+    event.line = line;
+    event.function_name = function_name;
+    branch_isolation_send(&event);
+}
+
+static void branch_isolation_send_end(const char* const name, const char* const file, const int line, const char* const function_name)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchEvent event;
+    if(!ctx->isolation.child) {
+        return;
+    }
+    memset(&event, 0, sizeof(event));
+    event.type = BRANCH_EVENT_END;
+    event.name = name;
+    event.file = file;
+    event.line = line;
+    event.function_name = function_name;
+    branch_isolation_send(&event);
+}
+
+static void branch_isolation_send_prune(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    BranchEvent event;
+    if(!ctx->isolation.child) {
+        return;
+    }
+    memset(&event, 0, sizeof(event));
+    event.type = BRANCH_EVENT_PRUNE;
+    branch_isolation_send(&event);
+}
+
+/* Run a batch of combinations in the child process and report their branch points to the parent */
+static void branch_isolation_child(const int fd, const unsigned int batch_size, BranchInnerFunction func, void *state)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    unsigned int combinations = 0;
+    BranchEvent event;
+
+    /* Failures abort the child instead of jumping back into the test runner of the parent */
+    setenv("CMOCKA_TEST_ABORT", "1", 1);
+#ifdef SIGSEGV
+    signal(SIGSEGV, SIG_DFL);
+#endif
+#ifdef SIGBUS
+    signal(SIGBUS, SIG_DFL);
+#endif
+#ifdef SIGILL
+    signal(SIGILL, SIG_DFL);
+#endif
+#ifdef SIGFPE
+    signal(SIGFPE, SIG_DFL);
+#endif
+#ifdef SIGSYS
+    signal(SIGSYS, SIG_DFL);
+#endif
+    /* The write tracking handler of registered state was reset with the signals above */
+    ctx->state_handler_installed = 0;
+    if(ctx->num_state_regions != 0) {
+        branch_state_install_handler();
+    }
+    ctx->isolation.child = 1;
+    ctx->isolation.fd = fd;
+    /* Progress is published by the parent */
+    ctx->monitor = NULL;
+    if(ctx->perf_active) {
+        branch_perf_open();
+    }
+    branch_trace_resume_child();
+    ctx->faults_suspended = 1;
+
+    memset(&event, 0, sizeof(event));
+    event.type = BRANCH_EVENT_DONE;
+    do {
+        branch_combination_begin();
+        event.replayed = branch_run_combination(func, state);
+        branch_combination_end();
+        memcpy(event.perf, ctx->perf_combination, sizeof(event.perf));
+        combinations++;
+        event.last = branches_restart() != FORK_RESTART_CODE_RESTART || combinations >= batch_size;
+        branch_isolation_send(&event);
+    } while(!event.last);
+    branch_trace_flush();
+    fflush(stdout);
+    fflush(stderr);
+    _exit(0);
+}
+
+/* Read the next event from the child, returns 1 on success, 0 when the child closed the pipe and -1 on timeout */
+static int branch_isolation_read(const int fd, BranchEvent *event, const uint64_t deadline_ns)
+{
+    char *data = (char*)event;
+    size_t left = sizeof(*event);
+    while(left > 0) {
+        struct pollfd poll_fd;
+        ssize_t bytes_read;
+        int timeout_ms = -1;
+        if(deadline_ns != 0) {
+            const uint64_t now = branch_time_ns();
+            if(now >= deadline_ns) {
+                return -1;
+            }
+            timeout_ms = (int)((deadline_ns - now + 999999) / 1000000);
         }
-        else {
-            branch_print_error("- %s (%d)\n", twig->parent_branch->name, twig->value);
+        poll_fd.fd = fd;
+        poll_fd.events = POLLIN;
+        poll_fd.revents = 0;
+        if(poll(&poll_fd, 1, timeout_ms) == 0) {
+            return -1;
         }
-    } else
-    {
-        branch_print_error("- ????\n");
+        bytes_read = read(fd, data, left);
+        if(bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if(bytes_read <= 0) {
+            return 0;
+        }
+        data += bytes_read;
+        left -= (size_t)bytes_read;
     }
+    return 1;
 }
 
-void _branch_print_current_path( void )
+/* Record a combination that did not finish in its child process, and unwind its open branches */
+static void branch_isolation_combination_failed(const int timed_out, const int status, const unsigned int timeout_ms)
 {
-    unsigned int nesting;
-    ListNode branch_path;
-    ListNode* current_path_element;
-    BranchTwig *current_twig = global_branch_information.current_twig;
-    list_initialize(&branch_path);
-    while(current_twig->parent_branch != NULL) {
-        list_add_value(&branch_path, current_twig, 0);
-        current_twig = current_twig->parent_branch->parent_twig;
-    }
-    current_path_element = branch_path.prev;
-    branch_print_error("\n");
-    nesting = 0;
-    while(current_path_element != &branch_path) {
-        ListNode *current_branch_node;
-        current_twig = (BranchTwig*)current_path_element->value;
-        current_branch_node = current_twig->parent_branch->parent_twig->subbranches.next;
+    BranchesInformation * const ctx = branch_current_context();
+    if(timed_out) {
+        cm_print_error("ERROR: Branch combination timed out after %u ms\n", timeout_ms);
+    } else if(WIFSIGNALED(status)) {
+#ifdef HAVE_STRSIGNAL
+        cm_print_error("ERROR: Branch combination crashed with signal %d (%s)\n", WTERMSIG(status), strsignal(WTERMSIG(status)));
+#else
+        cm_print_error("ERROR: Branch combination crashed with signal %d\n", WTERMSIG(status));
+#endif
+    } else {
+        cm_print_error("ERROR: Branch combination exited with status %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    }
+    branch_print_error("Branch path: ");
+    _branch_print_current_path();
+    branch_print_path_id();
+    branch_history_record_failure();
+    branch_stats_record(BRANCH_COMBINATION_FAILED);
+    ctx->isolation.failures++;
+    branch_truncate_combination();
+}
 
-        while(current_branch_node->value != current_twig->parent_branch) {
-            BranchInformation *branch_info = (BranchInformation*)current_branch_node->value;
-            branch_print_twig_name(&branch_info->twigs[branch_info->current_twig_idx], nesting);
-            current_branch_node = current_branch_node->next;
+/*
+ * Explore all combinations in forked child processes, batch_size combinations per child. The
+ * enumeration state stays in this process, which replays the branch points of the children.
+ */
+static BranchRestartCode branch_isolation_explore(const unsigned int batch_size, BranchInnerFunction func, void *state)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const unsigned int timeout_ms = branch_isolation_setting(ctx->isolation.timeout_ms, BRANCH_TIMEOUT_ENV);
+    const uint64_t timeout_ns = (uint64_t)timeout_ms * 1000000ULL;
+    BranchRestartCode restart = FORK_RESTART_CODE_RESTART;
+    /* Fault points only exist in the children, and the children count their own combinations */
+    ctx->faults_suspended++;
+    branch_perf_close();
+    /* The parent only replays the branch points, the children trace the combinations they run */
+    branch_trace_suspend();
+    while(restart == FORK_RESTART_CODE_RESTART) {
+        int fds[2];
+        int combination_open = 1;
+        int result;
+        int status = 0;
+        pid_t pid;
+        BranchEvent event;
+        uint64_t deadline_ns;
+
+        if(pipe(fds) != 0) {
+            cm_print_error("ERROR: Could not create a pipe for isolated branch combinations\n");
+            fail();
+            return FORK_RESTART_CODE_ERROR;
+        }
+        fflush(stdout);
+        fflush(stderr);
+        pid = fork();
+        if(pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            cm_print_error("ERROR: Could not fork for isolated branch combinations\n");
+            fail();
+            return FORK_RESTART_CODE_ERROR;
+        }
+        if(pid == 0) {
+            close(fds[0]);
+            branch_isolation_child(fds[1], batch_size, func, state);
+        }
+        close(fds[1]);
+
+        branch_combination_begin();
+        deadline_ns = timeout_ns != 0 ? branch_time_ns() + timeout_ns : 0;
+        while((result = branch_isolation_read(fds[0], &event, deadline_ns)) > 0) {
+            switch(event.type) {
+                case BRANCH_EVENT_START:
+                    branch_start_domain(event.name, event.num_twigs, event.twig_names, event.twig_classes, event.has_domain ? &event.domain : NULL,
+                                        event.site, event.file, event.line, event.function_name);
+                break;
+                case BRANCH_EVENT_END:
+                    _branch_end(event.name, event.file, event.line, event.function_name);
+                break;
+                case BRANCH_EVENT_PRUNE:
+                    branch_prune_record();
+                break;
+                case BRANCH_EVENT_DONE:
+                    if(event.replayed) {
+                        ctx->cache.replaying = 1;
+                        ctx->cache.replayed++;
+                    }
+                    memcpy(ctx->perf_combination, event.perf, sizeof(event.perf));
+                    branch_combination_end();
+                    restart = branches_restart();
+                    combination_open = restart == FORK_RESTART_CODE_RESTART && !event.last;
+                    if(combination_open) {
+                        branch_combination_begin();
+                        deadline_ns = timeout_ns != 0 ? branch_time_ns() + timeout_ns : 0;
+                    }
+                break;
+            }
+        }
+        if(result < 0) {
+            kill(pid, SIGKILL);
+        }
+        close(fds[0]);
+        while(waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        if(combination_open) {
+            branch_isolation_combination_failed(result < 0, status, timeout_ms);
+            restart = branches_restart();
         }
-        branch_print_twig_name(current_twig, nesting);
-        current_path_element = current_path_element->prev;
-        nesting++;
     }
-    list_free(&branch_path, NULL, NULL);
+    ctx->faults_suspended--;
+    return restart;
 }
 
-static void branch_post_cleanup(void)
+#else /* HAVE_FORK */
+
+static void branch_isolation_send_start(const char* const name, const unsigned int num_twigs, char const * const * const twig_names, const unsigned int *twig_classes, const BranchDomain *domain, const BranchSite *site, const char* const file, const int line, const char* const function_name)
 {
-    list_free(&global_branch_information.trunk.subbranches, free_branch, (void*)0);
-    global_branch_information.current_branch = NULL;
-    global_branches_enabled = 0;
+    (void)name;
+    (void)num_twigs;
+    (void)twig_names;
+    (void)twig_classes;
+    (void)domain;
+    (void)site;
+    (void)file;
+    (void)line;
+    (void)function_name;
 }
 
-void _branch_custom_func_wrapper(BranchInnerFunction func, void *state)
+static void branch_isolation_send_end(const char* const name, const char* const file, const int line, const char* const function_name)
+{
+    (void)name;
+    (void)file;
+    (void)line;
+    (void)function_name;
+}
+
+static void branch_isolation_send_prune(void)
+{
+}
+
+static BranchRestartCode branch_isolation_explore(const unsigned int batch_size, BranchInnerFunction func, void *state)
+{
+    BranchRestartCode restart;
+    (void)batch_size;
+    branch_print_message("Branch isolation is not supported on this platform, combinations run in the test process\n");
+    do {
+        branch_combination_begin();
+        branch_run_combination(func, state);
+        branch_combination_end();
+    } while((restart = branches_restart()) == FORK_RESTART_CODE_RESTART);
+    return restart;
+}
+
+#endif /* HAVE_FORK */
+
+static void branch_post_cleanup(const int passed)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    _branch_fault_injection_active = 0;
+    if(ctx->pruned_combinations != 0) {
+        branch_print_message("Branch pruning: %lu of %lu combinations pruned\n",
+                             ctx->pruned_combinations, ctx->combinations);
+    }
+    if(ctx->equivalent_twigs != 0) {
+        branch_print_message("Branch equivalence: %lu twigs covered by their class representative, %lu branch points pinned below them\n",
+                             ctx->equivalent_twigs, ctx->equivalence_pins);
+    }
+    if(ctx->heap_accounting_active) {
+        branch_heap_report(&ctx->trunk);
+    }
+    ctx->heap_limit = 0;
+    if(ctx->perf_active) {
+        branch_perf_report(&ctx->trunk);
+        branch_perf_close();
+    }
+    branch_monitor_close();
+    branch_trace_close();
+    branch_path_unload();
+    branch_threads_release();
+    branch_memo_release();
+    branch_export_tree();
+    branch_state_release();
+    branch_history_save();
+    list_free(&ctx->history, free_history_entry, NULL);
+    branch_timing_save(passed);
+    branch_cache_save(passed);
+    list_free(&ctx->trunk.subbranches, free_branch, (void*)0);
+    branch_cache_cleanup();
+    ctx->current_branch = NULL;
+    ctx->enabled = 0;
+}
+
+void _branch_custom_func_wrapper_named(const char *test_name, BranchInnerFunction func, void *state)
 {
+    BranchesInformation * const ctx = branch_current_context();
     unsigned int branch_restart_code;
+    unsigned int batch_size;
+    unsigned long failures;
+    ctx->test_name = test_name;
     branches_init();
-    do {
-        func(state);
-    } while((branch_restart_code = branches_restart()) == FORK_RESTART_CODE_RESTART);
-    branch_post_cleanup();
+    batch_size = branch_isolation_setting(ctx->isolation.batch_size, BRANCH_ISOLATION_ENV);
+    if(ctx->path_restricted && ctx->num_paths == 0) {
+        /* Another shard explores the test */
+        branch_restart_code = FORK_RESTART_CODE_COMPLETE;
+    } else if(batch_size != 0) {
+        branch_restart_code = branch_isolation_explore(batch_size, func, state);
+    } else {
+        do {
+            branch_combination_begin();
+            branch_run_combination(func, state);
+            branch_combination_end();
+        } while((branch_restart_code = branches_restart()) == FORK_RESTART_CODE_RESTART);
+    }
+    failures = ctx->isolation.failures;
+    if(branch_restart_code == FORK_RESTART_CODE_COMPLETE && failures == 0 && test_name != NULL &&
+       !ctx->path_restricted) {
+        branch_history_record_success();
+    }
+    branch_post_cleanup(branch_restart_code == FORK_RESTART_CODE_COMPLETE && failures == 0);
+    if(failures != 0) {
+        cm_print_error("ERROR: %lu of %lu branch combinations failed in isolation\n",
+                       failures, ctx->combinations);
+        fail();
+    }
+}
+
+void _branch_custom_func_wrapper(BranchInnerFunction func, void *state)
+{
+    _branch_custom_func_wrapper_named(NULL, func, state);
 }
 
 void _branch_test_wrapper(void **state)
@@ -573,21 +5712,50 @@ void _branch_test_wrapper(void **state)
     struct CMBUnitTestWrapper *wrap_state = (struct CMBUnitTestWrapper*)*state;
     /* wrap_state is const, so we put the void here in a stack variable in case the test tries to assign to it */
     void *initial_state = wrap_state->initial_inner_state;
-    _branch_custom_func_wrapper((BranchInnerFunction)(wrap_state->test_func), (void*)&initial_state);
+    _branch_custom_func_wrapper_named(wrap_state->test_name, (BranchInnerFunction)(wrap_state->test_func), (void*)&initial_state);
+}
+
+/* End the exploration of the current context after a failure, printing the combination that failed */
+static void branch_abort_exploration(void)
+{
+    _branch_fault_injection_active = 0;
+    branch_perf_end();
+    branch_print_error("Branch path: ");
+    _branch_print_current_path();
+    branch_print_path_id();
+    branch_history_record_failure();
+    branch_stats_record(BRANCH_COMBINATION_FAILED);
+    branch_post_cleanup(0);
+}
+
+/* Make the context that was current when the current one was run current again, returns 0 if there is none */
+static int branch_context_pop(void)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    if(ctx->outer == NULL) {
+        return 0;
+    }
+    current_branch_context = ctx->outer;
+    ctx->outer = NULL;
+    return 1;
 }
 
 int _branch_teardown_wrapper(void **state)
 {
+    BranchesInformation * const ctx = branch_current_context();
     unsigned int rc = 0;
     struct CMBUnitTestWrapper *wrap_state = (struct CMBUnitTestWrapper*)*state;
     /* wrap_state is const, so we put the void here in a stack variable in case the test tries to assign to it */
     void *initial_state = wrap_state->initial_inner_state;
 
-    /* If global_branches_enabled we did not exit cleanly, print the current branch for tracing errors */
-    if(global_branches_enabled) {
-        branch_print_error("Branch path: ");
-        _branch_print_current_path();
-        branch_post_cleanup();
+    /* If the exploration is still enabled we did not exit cleanly, print the current branch for tracing errors */
+    if(ctx->enabled || ctx->outer != NULL) {
+        /* A failure in a nested exploration also ends the explorations it was run from */
+        do {
+            if(branch_current_context()->enabled) {
+                branch_abort_exploration();
+            }
+        } while(branch_context_pop());
         return 0;
     }
 
@@ -598,3 +5766,599 @@ int _branch_teardown_wrapper(void **state)
     return rc;
 }
 
+/*****************************************************************************/
+/**** Exploration contexts                                                   ***/
+/*****************************************************************************/
+
+BranchContext *branch_context_create(void)
+{
+    return (BranchContext*)calloc(1, sizeof(BranchContext));
+}
+
+void branch_context_destroy(BranchContext *context)
+{
+    BranchContext *previous;
+    unsigned int i;
+    if(context == NULL || context == &default_branch_context) {
+        return;
+    }
+    previous = branch_context_switch(context);
+    if(context->enabled) {
+        branch_post_cleanup(0);
+    }
+    for(i = 0; i < context->num_state_regions; i++) {
+        free(context->state_regions[i].snapshot);
+        free(context->state_regions[i].dirty);
+    }
+    free(context->state_regions);
+    free(context->exclusion_marks);
+    branch_context_switch(previous != context ? previous : NULL);
+    free(context);
+}
+
+BranchContext *branch_context_switch(BranchContext *context)
+{
+    BranchContext * const previous = branch_current_context();
+    current_branch_context = context;
+    return previous;
+}
+
+void branch_context_run(BranchContext *context, const char *test_name, BranchInnerFunction func, void *state)
+{
+    BranchContext * const previous = branch_context_switch(context);
+    BranchesInformation * const ctx = branch_current_context();
+    ctx->outer = previous;
+    _branch_custom_func_wrapper_named(test_name, func, state);
+    ctx->outer = NULL;
+    branch_context_switch(previous);
+}
+
+int branch_context_run_one(BranchContext *context, const char *test_name, BranchInnerFunction func, void *state)
+{
+    BranchContext * const previous = branch_context_switch(context);
+    BranchesInformation * const ctx = branch_current_context();
+    BranchRestartCode restart;
+    ctx->outer = previous;
+    if(!ctx->enabled) {
+        ctx->test_name = test_name;
+        branches_init();
+    }
+    branch_combination_begin();
+    branch_run_combination(func, state);
+    branch_combination_end();
+    restart = branches_restart();
+    if(restart != FORK_RESTART_CODE_RESTART) {
+        if(restart == FORK_RESTART_CODE_COMPLETE && test_name != NULL) {
+            branch_history_record_success();
+        }
+        branch_post_cleanup(restart == FORK_RESTART_CODE_COMPLETE);
+    }
+    ctx->outer = NULL;
+    branch_context_switch(previous);
+    return restart == FORK_RESTART_CODE_RESTART;
+}
+
+void branch_context_status(BranchContext *context, BranchContextStatus *status)
+{
+    const BranchContext * const query = context != NULL ? context : &default_branch_context;
+    status->running = query->enabled;
+    status->combinations = query->combinations;
+    status->failed_combinations = query->failed_combinations;
+    status->pruned_combinations = query->pruned_combinations;
+    status->nesting_level = query->nesting_level;
+    status->memo_hits = query->memo.hits;
+    status->memo_misses = query->memo.misses;
+    status->memo_evictions = query->memo.evictions;
+}
+
+unsigned int _branch_start_context(BranchContext *context, const char* const name, unsigned int num_twigs, char const * const * const twig_names, const char* const file, const int line, const char* const function_name)
+{
+    BranchContext * const previous = branch_context_switch(context);
+    const unsigned int value = _branch_start(name, num_twigs, twig_names, file, line, function_name);
+    branch_context_switch(previous);
+    return value;
+}
+
+void _branch_end_context(BranchContext *context, const char* const name, const char* const file, const int line, const char* const function_name)
+{
+    BranchContext * const previous = branch_context_switch(context);
+    _branch_end(name, file, line, function_name);
+    branch_context_switch(previous);
+}
+
+/*****************************************************************************/
+/**** Branch schemas                                                         ***/
+/*****************************************************************************/
+
+struct BranchSchema {
+    BranchSchemaPoint *points;
+    unsigned int num_points;
+    unsigned int *first_child;          /* Per point, BRANCH_SCHEMA_ROOT if it has no children */
+    unsigned int *next_sibling;         /* Per point, BRANCH_SCHEMA_ROOT for the last one */
+    unsigned int first_root;
+    unsigned int *depth;
+    uint64_t *twig_counts;              /* Combinations below each twig, twig_offsets[point] + twig */
+    unsigned int *twig_offsets;
+    uint64_t *point_counts;             /* Combinations of the subtree of each point */
+    uint64_t count;
+};
+
+/* The child is taken when its parent is taken with twig */
+static int branch_schema_applies(const BranchSchemaPoint *child, const unsigned int twig)
+{
+    return child->parent_twig == BRANCH_SCHEMA_ANY_TWIG || child->parent_twig == twig;
+}
+
+/* Multiply *count by factor, returns 0 on overflow */
+static int branch_schema_multiply(uint64_t *count, const uint64_t factor)
+{
+    if(factor != 0 && *count > UINT64_MAX / factor) {
+        return 0;
+    }
+    *count *= factor;
+    return 1;
+}
+
+static int branch_schema_validate(const BranchSchemaPoint *points, const unsigned int num_points)
+{
+    unsigned int * const chain = (unsigned int*)malloc((num_points + 1) * sizeof(unsigned int));
+    unsigned int chain_length = 0;
+    unsigned int i;
+    int valid = 1;
+    for(i = 0; i < num_points && valid; i++) {
+        const BranchSchemaPoint * const point = &points[i];
+        if(point->num_twigs == 0) {
+            cm_print_error("ERROR: Branch schema point %u (%s) has no twigs\n", i, point->name);
+            valid = 0;
+        } else if(point->parent != BRANCH_SCHEMA_ROOT && point->parent >= i) {
+            cm_print_error("ERROR: Branch schema point %u (%s) doesn't follow its parent %u\n", i, point->name, point->parent);
+            valid = 0;
+        } else if(point->parent != BRANCH_SCHEMA_ROOT && point->parent_twig != BRANCH_SCHEMA_ANY_TWIG &&
+                  point->parent_twig >= points[point->parent].num_twigs) {
+            cm_print_error("ERROR: Branch schema point %u (%s) is nested in twig %u of %s, which has %u twigs\n",
+                           i, point->name, point->parent_twig, points[point->parent].name, points[point->parent].num_twigs);
+            valid = 0;
+        } else {
+            /* The parent must be on the chain of points enclosing the previous point */
+            while(chain_length > 0 && chain[chain_length - 1] != point->parent) {
+                chain_length--;
+            }
+            if(chain_length == 0 && point->parent != BRANCH_SCHEMA_ROOT) {
+                cm_print_error("ERROR: Branch schema point %u (%s) is not in preorder, points nested in %s come before its next sibling\n",
+                               i, point->name, points[point->parent].name);
+                valid = 0;
+            }
+            chain[chain_length++] = i;
+        }
+    }
+    free(chain);
+    return valid;
+}
+
+BranchSchema *branch_schema_create(const BranchSchemaPoint *points, const unsigned int num_points)
+{
+    BranchSchema *schema;
+    unsigned int num_twigs = 0;
+    unsigned int *last_child;
+    unsigned int last_root = BRANCH_SCHEMA_ROOT;
+    unsigned int i, twig;
+    if(!branch_schema_validate(points, num_points)) {
+        return NULL;
+    }
+    schema = (BranchSchema*)calloc(1, sizeof(BranchSchema));
+    schema->num_points = num_points;
+    schema->points = (BranchSchemaPoint*)malloc((num_points + 1) * sizeof(BranchSchemaPoint));
+    memcpy(schema->points, points, num_points * sizeof(BranchSchemaPoint));
+    schema->first_child = (unsigned int*)malloc((num_points + 1) * sizeof(unsigned int));
+    schema->next_sibling = (unsigned int*)malloc((num_points + 1) * sizeof(unsigned int));
+    schema->depth = (unsigned int*)malloc((num_points + 1) * sizeof(unsigned int));
+    schema->twig_offsets = (unsigned int*)malloc((num_points + 1) * sizeof(unsigned int));
+    schema->point_counts = (uint64_t*)malloc((num_points + 1) * sizeof(uint64_t));
+    last_child = (unsigned int*)malloc((num_points + 1) * sizeof(unsigned int));
+    schema->first_root = BRANCH_SCHEMA_ROOT;
+    for(i = 0; i < num_points; i++) {
+        const unsigned int parent = points[i].parent;
+        unsigned int * const previous = parent == BRANCH_SCHEMA_ROOT ? &last_root : &last_child[parent];
+        schema->first_child[i] = BRANCH_SCHEMA_ROOT;
+        schema->next_sibling[i] = BRANCH_SCHEMA_ROOT;
+        last_child[i] = BRANCH_SCHEMA_ROOT;
+        schema->depth[i] = parent == BRANCH_SCHEMA_ROOT ? 0 : schema->depth[parent] + 1;
+        if(*previous != BRANCH_SCHEMA_ROOT) {
+            schema->next_sibling[*previous] = i;
+        } else if(parent == BRANCH_SCHEMA_ROOT) {
+            schema->first_root = i;
+        } else {
+            schema->first_child[parent] = i;
+        }
+        *previous = i;
+        schema->twig_offsets[i] = num_twigs;
+        num_twigs += points[i].num_twigs;
+    }
+    free(last_child);
+
+    /* Children follow their parents, so counting backwards counts the children first */
+    schema->twig_counts = (uint64_t*)malloc((num_twigs + 1) * sizeof(uint64_t));
+    for(twig = 0; twig < num_twigs; twig++) {
+        schema->twig_counts[twig] = 1;
+    }
+    schema->count = 1;
+    for(i = num_points; i-- > 0;) {
+        const BranchSchemaPoint * const point = &points[i];
+        uint64_t count = 0;
+        int valid = 1;
+        for(twig = 0; twig < point->num_twigs && valid; twig++) {
+            count += schema->twig_counts[schema->twig_offsets[i] + twig];
+            valid = count >= schema->twig_counts[schema->twig_offsets[i] + twig];
+        }
+        schema->point_counts[i] = count;
+        if(point->parent == BRANCH_SCHEMA_ROOT) {
+            valid = valid && branch_schema_multiply(&schema->count, count);
+        } else {
+            for(twig = 0; twig < points[point->parent].num_twigs && valid; twig++) {
+                if(branch_schema_applies(point, twig)) {
+                    valid = branch_schema_multiply(&schema->twig_counts[schema->twig_offsets[point->parent] + twig], count);
+                }
+            }
+        }
+        if(!valid) {
+            cm_print_error("ERROR: Branch schema has more than %llu combinations\n", (unsigned long long)UINT64_MAX);
+            branch_schema_destroy(schema);
+            return NULL;
+        }
+    }
+    return schema;
+}
+
+void branch_schema_destroy(BranchSchema *schema)
+{
+    if(schema == NULL) {
+        return;
+    }
+    free(schema->points);
+    free(schema->first_child);
+    free(schema->next_sibling);
+    free(schema->depth);
+    free(schema->twig_counts);
+    free(schema->twig_offsets);
+    free(schema->point_counts);
+    free(schema);
+}
+
+uint64_t branch_schema_count(const BranchSchema *schema)
+{
+    return schema->count;
+}
+
+static void branch_schema_decode_point(const BranchSchema *schema, const unsigned int point, uint64_t index, unsigned int *twigs);
+
+/* Decode index into the siblings from first on taken under twig, the last sibling being the least significant */
+static void branch_schema_decode_siblings(const BranchSchema *schema, const unsigned int first, const unsigned int twig, uint64_t index, unsigned int *twigs)
+{
+    unsigned int child;
+    unsigned int num_children = 0;
+    unsigned int *children;
+    for(child = first; child != BRANCH_SCHEMA_ROOT; child = schema->next_sibling[child]) {
+        num_children += twig == BRANCH_SCHEMA_ANY_TWIG || branch_schema_applies(&schema->points[child], twig);
+    }
+    if(num_children == 0) {
+        return;
+    }
+    children = (unsigned int*)malloc(num_children * sizeof(unsigned int));
+    num_children = 0;
+    for(child = first; child != BRANCH_SCHEMA_ROOT; child = schema->next_sibling[child]) {
+        if(twig == BRANCH_SCHEMA_ANY_TWIG || branch_schema_applies(&schema->points[child], twig)) {
+            children[num_children++] = child;
+        }
+    }
+    while(num_children-- > 0) {
+        const uint64_t count = schema->point_counts[children[num_children]];
+        branch_schema_decode_point(schema, children[num_children], index % count, twigs);
+        index /= count;
+    }
+    free(children);
+}
+
+static void branch_schema_decode_point(const BranchSchema *schema, const unsigned int point, uint64_t index, unsigned int *twigs)
+{
+    const uint64_t * const twig_counts = &schema->twig_counts[schema->twig_offsets[point]];
+    unsigned int twig = 0;
+    while(index >= twig_counts[twig]) {
+        index -= twig_counts[twig];
+        twig++;
+    }
+    twigs[point] = twig;
+    branch_schema_decode_siblings(schema, schema->first_child[point], twig, index, twigs);
+}
+
+int branch_schema_decode(const BranchSchema *schema, const uint64_t index, unsigned int *twigs)
+{
+    unsigned int i;
+    if(index >= schema->count) {
+        return 0;
+    }
+    for(i = 0; i < schema->num_points; i++) {
+        twigs[i] = BRANCH_SCHEMA_INACTIVE;
+    }
+    branch_schema_decode_siblings(schema, schema->first_root, BRANCH_SCHEMA_ANY_TWIG, index, twigs);
+    return 1;
+}
+
+void branch_schema_iterate(BranchSchemaIterator *iterator, const BranchSchema *schema, const uint64_t begin, const uint64_t end, unsigned int *twigs)
+{
+    iterator->schema = schema;
+    iterator->index = begin;
+    iterator->end = end < schema->count ? end : schema->count;
+    iterator->started = 0;
+    iterator->twigs = twigs;
+}
+
+void branch_schema_iterate_part(BranchSchemaIterator *iterator, const BranchSchema *schema, const unsigned int part, const unsigned int num_parts, unsigned int *twigs)
+{
+    uint64_t size, remainder, begin;
+    if(part >= num_parts) {
+        /* Nothing to iterate if the failure returns */
+        branch_schema_iterate(iterator, schema, 0, 0, twigs);
+        cm_print_error("ERROR: Branch schema part %u of %u parts requested\n", part, num_parts);
+        fail();
+        return;
+    }
+    size = schema->count / num_parts;
+    remainder = schema->count % num_parts;
+    /* The first remainder parts get one combination more */
+    begin = size * part + (part < remainder ? part : remainder);
+    branch_schema_iterate(iterator, schema, begin, begin + size + (part < remainder), twigs);
+}
+
+int branch_schema_next(BranchSchemaIterator *iterator)
+{
+    const BranchSchema * const schema = iterator->schema;
+    unsigned int * const twigs = iterator->twigs;
+    unsigned int i, j;
+    if(!iterator->started) {
+        iterator->started = 1;
+        return iterator->index < iterator->end && branch_schema_decode(schema, iterator->index, twigs);
+    }
+    if(iterator->index + 1 >= iterator->end) {
+        return 0;
+    }
+    iterator->index++;
+    /* Like an odometer, advance the last point that has twigs left and restart the points after it */
+    for(i = schema->num_points; i-- > 0;) {
+        if(twigs[i] != BRANCH_SCHEMA_INACTIVE && twigs[i] + 1 < schema->points[i].num_twigs) {
+            break;
+        }
+    }
+    twigs[i]++;
+    for(j = i + 1; j < schema->num_points; j++) {
+        const BranchSchemaPoint * const point = &schema->points[j];
+        const int taken = point->parent == BRANCH_SCHEMA_ROOT ||
+                          (twigs[point->parent] != BRANCH_SCHEMA_INACTIVE && branch_schema_applies(point, twigs[point->parent]));
+        twigs[j] = taken ? 0 : BRANCH_SCHEMA_INACTIVE;
+    }
+    return 1;
+}
+
+void branch_schema_print_combination(const BranchSchema *schema, const unsigned int *twigs)
+{
+    unsigned int i, j;
+    branch_print_error("\n");
+    for(i = 0; i < schema->num_points; i++) {
+        const BranchSchemaPoint * const point = &schema->points[i];
+        if(twigs[i] == BRANCH_SCHEMA_INACTIVE) {
+            continue;
+        }
+        for(j = 0; j < schema->depth[i]; j++) {
+            branch_print_error("  ");
+        }
+        if(point->twig_names != NULL) {
+            branch_print_error("- %s (%s, %u)\n", point->name, point->twig_names[twigs[i]], twigs[i]);
+        } else {
+            branch_print_error("- %s (%u)\n", point->name, twigs[i]);
+        }
+    }
+}
+
+/*****************************************************************************/
+/**** Exploration server                                                     ***/
+/*****************************************************************************/
+
+/* Last line of the reply to a request, followed by the number of failed tests */
+#define BRANCH_SERVE_RESULT "CMOCKA_BRANCHES_RESULT"
+#define BRANCH_SERVE_LINE_MAX 4096
+#define BRANCH_SERVE_FIELDS_MAX 64
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H) && defined(HAVE_UNISTD_H) && defined(HAVE_SIGNAL_H)
+
+/* Read a request line of the connection without its newline, returns 0 if there is none */
+static int branch_serve_read_line(const int connection, char *line, const size_t size)
+{
+    size_t length = 0;
+    while(length + 1 < size) {
+        const ssize_t result = read(connection, &line[length], 1);
+        if(result < 0 && errno == EINTR) {
+            continue;
+        }
+        if(result <= 0) {
+            break;
+        }
+        if(line[length] == '\n') {
+            line[length] = '\0';
+            return 1;
+        }
+        length++;
+    }
+    line[length] = '\0';
+    return length > 0 && length + 1 < size;
+}
+
+/* Split line at spaces, returns the number of fields */
+static unsigned int branch_serve_split(char *line, char **fields)
+{
+    unsigned int num_fields = 0;
+    char *field = strtok(line, " \t\r");
+    while(field != NULL && num_fields < BRANCH_SERVE_FIELDS_MAX) {
+        fields[num_fields++] = field;
+        field = strtok(NULL, " \t\r");
+    }
+    return num_fields;
+}
+
+/*
+ * Run the test once for every path with stdout and stderr sent to the connection, returns the
+ * number of failed runs
+ */
+static int branch_serve_run(const int connection, const struct CMUnitTest *test, char **paths, const unsigned int num_paths,
+                            const int replay, BranchServeReset reset, void *data)
+{
+    BranchesInformation * const ctx = branch_current_context();
+    const char * const saved_path = ctx->path;
+    const int saved_replay = ctx->path_replay;
+    const int saved_configured = ctx->path_configured;
+    int saved_stdout, saved_stderr;
+    int failed = 0;
+    unsigned int i;
+
+    fflush(stdout);
+    fflush(stderr);
+    saved_stdout = dup(STDOUT_FILENO);
+    saved_stderr = dup(STDERR_FILENO);
+    dup2(connection, STDOUT_FILENO);
+    dup2(connection, STDERR_FILENO);
+    for(i = 0; i < (num_paths != 0 ? num_paths : 1); i++) {
+        if(reset != NULL && reset(data) != 0) {
+            cm_print_error("ERROR: The reset hook of the server failed\n");
+            failed++;
+            break;
+        }
+        branch_set_path(num_paths != 0 ? paths[i] : NULL, replay);
+        failed += _cmocka_run_group_tests(test->name, test, 1, NULL, NULL);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_stdout, STDOUT_FILENO);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stdout);
+    close(saved_stderr);
+
+    ctx->path = saved_path;
+    ctx->path_replay = saved_replay;
+    ctx->path_configured = saved_configured;
+    return failed;
+}
+
+static void branch_serve_reply(const int connection, const char *reply)
+{
+    size_t written = 0;
+    const size_t length = strlen(reply);
+    while(written < length) {
+        const ssize_t result = write(connection, reply + written, length - written);
+        if(result < 0 && errno == EINTR) {
+            continue;
+        }
+        if(result <= 0) {
+            break;
+        }
+        written += (size_t)result;
+    }
+}
+
+/* Handle one request, returns 1 if the server is asked to stop */
+static int branch_serve_request(const int connection, char **fields, const unsigned int num_fields,
+                                const struct CMUnitTest * const tests, const size_t num_tests,
+                                BranchServeReset reset, void *data)
+{
+    char reply[256];
+    size_t i;
+    int failed = 1;
+    if(num_fields == 1 && strcmp(fields[0], "QUIT") == 0) {
+        return 1;
+    }
+    if(num_fields == 1 && strcmp(fields[0], "LIST") == 0) {
+        for(i = 0; i < num_tests; i++) {
+            branch_serve_reply(connection, tests[i].name);
+            branch_serve_reply(connection, "\n");
+        }
+        failed = 0;
+    } else if(num_fields >= 2 && (strcmp(fields[0], "RUN") == 0 || (strcmp(fields[0], "REPLAY") == 0 && num_fields == 3))) {
+        for(i = 0; i < num_tests && strcmp(tests[i].name, fields[1]) != 0; i++) {
+        }
+        if(i < num_tests) {
+            failed = branch_serve_run(connection, &tests[i], &fields[2], num_fields - 2, strcmp(fields[0], "REPLAY") == 0, reset, data);
+        } else {
+            snprintf(reply, sizeof(reply), "ERROR: No test named %s\n", fields[1]);
+            branch_serve_reply(connection, reply);
+        }
+    } else {
+        branch_serve_reply(connection, "ERROR: Expected RUN <test> [<path>...], REPLAY <test> <path>, LIST or QUIT\n");
+    }
+    snprintf(reply, sizeof(reply), "%s %d\n", BRANCH_SERVE_RESULT, failed);
+    branch_serve_reply(connection, reply);
+    return 0;
+}
+
+int branch_serve(const char *socket_path, const struct CMUnitTest * const tests, const size_t num_tests,
+                 BranchServeReset reset, void *data)
+{
+    struct sockaddr_un address;
+    void (*previous_sigpipe)(int);
+    int listener;
+    int quit = 0;
+    int status = 0;
+
+    if(strlen(socket_path) >= sizeof(address.sun_path)) {
+        cm_print_error("ERROR: The server socket path %s is too long\n", socket_path);
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0 || bind(listener, (const struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        cm_print_error("ERROR: Could not serve on %s: %s\n", socket_path, strerror(errno));
+        if(listener >= 0) {
+            close(listener);
+        }
+        return -1;
+    }
+
+    /* A client that goes away mid reply must not end the server */
+    previous_sigpipe = signal(SIGPIPE, SIG_IGN);
+    while(!quit) {
+        char line[BRANCH_SERVE_LINE_MAX];
+        char *fields[BRANCH_SERVE_FIELDS_MAX];
+        const int connection = accept(listener, NULL, NULL);
+        if(connection < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            cm_print_error("ERROR: The server on %s stopped: %s\n", socket_path, strerror(errno));
+            status = -1;
+            break;
+        }
+        if(branch_serve_read_line(connection, line, sizeof(line))) {
+            const unsigned int num_fields = branch_serve_split(line, fields);
+            quit = branch_serve_request(connection, fields, num_fields, tests, num_tests, reset, data);
+        }
+        close(connection);
+    }
+    signal(SIGPIPE, previous_sigpipe);
+    close(listener);
+    unlink(socket_path);
+    return status;
+}
+
+#else
+
+int branch_serve(const char *socket_path, const struct CMUnitTest * const tests, const size_t num_tests,
+                 BranchServeReset reset, void *data)
+{
+    cm_print_error("ERROR: Serving explorations on %s is not supported on this platform\n", socket_path);
+    (void)tests;
+    (void)num_tests;
+    (void)reset;
+    (void)data;
+    return -1;
+}
+
+#endif
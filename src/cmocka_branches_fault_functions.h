@@ -0,0 +1,28 @@
+/*
+ * Copyright 2017 Nordic Semiconductor <frederik.vestre@nordicsemi.no>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Functions with fault injection, included by the wrapper libraries with BRANCH_FAULT_FUNCTION
+ * defined as (return type, name, parameters, arguments, value returned on failure, errno on failure).
+ */
+BRANCH_FAULT_FUNCTION(void *, malloc, (size_t size), (size), NULL, ENOMEM)
+BRANCH_FAULT_FUNCTION(void *, calloc, (size_t number, size_t size), (number, size), NULL, ENOMEM)
+BRANCH_FAULT_FUNCTION(void *, realloc, (void *ptr, size_t size), (ptr, size), NULL, ENOMEM)
+BRANCH_FAULT_FUNCTION(ssize_t, read, (int fd, void *buffer, size_t count), (fd, buffer, count), -1, EIO)
+BRANCH_FAULT_FUNCTION(ssize_t, write, (int fd, const void *buffer, size_t count), (fd, buffer, count), -1, EIO)
+BRANCH_FAULT_FUNCTION(ssize_t, send, (int fd, const void *buffer, size_t length, int flags), (fd, buffer, length, flags), -1, ECONNRESET)
+BRANCH_FAULT_FUNCTION(ssize_t, recv, (int fd, void *buffer, size_t length, int flags), (fd, buffer, length, flags), -1, ECONNRESET)
+BRANCH_FAULT_FUNCTION(FILE *, fopen, (const char *path, const char *mode), (path, mode), NULL, ENOENT)
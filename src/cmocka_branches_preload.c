@@ -0,0 +1,110 @@
+/*
+ * Copyright 2017 Nordic Semiconductor <frederik.vestre@nordicsemi.no>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fault injection wrappers for LD_PRELOAD, for libraries that can't be relinked. The functions in
+ * cmocka_branches_fault_functions.h are interposed and forward to the next definition. The
+ * branch library is referenced weakly, so programs without it run unaffected. A test linked with
+ * the static branch library must export its symbols (-rdynamic), or the references stay NULL.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern int _branch_fault_injection_active __attribute__((weak));
+int _branch_fault_point(const char *function, const void *caller, int *error) __attribute__((weak));
+
+#ifdef __GLIBC__
+/* dlsym allocates, so the allocators are not looked up with it */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t number, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+#define BRANCH_REAL_malloc __libc_malloc
+#define BRANCH_REAL_calloc __libc_calloc
+#define BRANCH_REAL_realloc __libc_realloc
+#endif
+
+#define BRANCH_FAULT_ACTIVE() (&_branch_fault_injection_active != NULL && _branch_fault_injection_active && _branch_fault_point != NULL)
+
+#define BRANCH_FAULT_INJECT(name, fail_value, fail_errno) \
+    if(BRANCH_FAULT_ACTIVE()) { \
+        int error = (fail_errno); \
+        if(_branch_fault_point(#name, __builtin_return_address(0), &error)) { \
+            errno = error; \
+            return (fail_value); \
+        } \
+    }
+
+#ifdef __GLIBC__
+#define BRANCH_FAULT_FUNCTION(type, name, parameters, arguments, fail_value, fail_errno) \
+    BRANCH_FAULT_FUNCTION_##name(type, name, parameters, arguments, fail_value, fail_errno)
+#else
+#define BRANCH_FAULT_FUNCTION(type, name, parameters, arguments, fail_value, fail_errno) \
+    BRANCH_FAULT_FUNCTION_DLSYM(type, name, parameters, arguments, fail_value, fail_errno)
+#endif
+
+/* Forward to the next definition of the function, looked up on first use */
+#define BRANCH_FAULT_FUNCTION_DLSYM(type, name, parameters, arguments, fail_value, fail_errno) \
+    type name parameters \
+    { \
+        static type (*real) parameters = NULL; \
+        BRANCH_FAULT_INJECT(name, fail_value, fail_errno) \
+        if(real == NULL) { \
+            *(void**)(&real) = dlsym(RTLD_NEXT, #name); \
+        } \
+        return real arguments; \
+    }
+
+/* Forward to the allocator of the C library */
+#define BRANCH_FAULT_FUNCTION_LIBC(type, name, parameters, arguments, fail_value, fail_errno) \
+    type name parameters \
+    { \
+        BRANCH_FAULT_INJECT(name, fail_value, fail_errno) \
+        return BRANCH_REAL_##name arguments; \
+    }
+
+#define BRANCH_FAULT_FUNCTION_malloc BRANCH_FAULT_FUNCTION_LIBC
+#define BRANCH_FAULT_FUNCTION_calloc BRANCH_FAULT_FUNCTION_LIBC
+#define BRANCH_FAULT_FUNCTION_realloc BRANCH_FAULT_FUNCTION_LIBC
+#define BRANCH_FAULT_FUNCTION_read BRANCH_FAULT_FUNCTION_DLSYM
+#define BRANCH_FAULT_FUNCTION_write BRANCH_FAULT_FUNCTION_DLSYM
+#define BRANCH_FAULT_FUNCTION_send BRANCH_FAULT_FUNCTION_DLSYM
+#define BRANCH_FAULT_FUNCTION_recv BRANCH_FAULT_FUNCTION_DLSYM
+#define BRANCH_FAULT_FUNCTION_fopen BRANCH_FAULT_FUNCTION_DLSYM
+
+#include "cmocka_branches_fault_functions.h"
+
+/* Faults were asked for, but the branch library of the test is not visible to the preloaded one */
+static void branch_preload_check(void) __attribute__((constructor));
+static void branch_preload_check(void)
+{
+    if(getenv("CMOCKA_BRANCHES_FAULTS") != NULL && (&_branch_fault_injection_active == NULL || _branch_fault_point == NULL)) {
+        fprintf(stderr, "cmocka_branches_preload: the branch library is not visible, no faults are injected. "
+                "Link the test with the shared branch library or with -rdynamic\n");
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2017 Nordic Semiconductor <frederik.vestre@nordicsemi.no>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fault injection wrappers for static linking. Link them into the test together with
+ * -Wl,--wrap=malloc,--wrap=read,... for the functions in cmocka_branches_fault_functions.h that
+ * shall become fault points.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cmocka_branches.h"
+
+#if defined(__GNUC__)
+#define BRANCH_FAULT_CALLER __builtin_return_address(0)
+/* Only the functions passed to --wrap have a __real_ definition */
+#define BRANCH_FAULT_REAL_ATTRIBUTE __attribute__((weak))
+#else
+#define BRANCH_FAULT_CALLER NULL
+#define BRANCH_FAULT_REAL_ATTRIBUTE
+#endif
+
+#define BRANCH_FAULT_FUNCTION(type, name, parameters, arguments, fail_value, fail_errno) \
+    type __real_##name parameters BRANCH_FAULT_REAL_ATTRIBUTE; \
+    type __wrap_##name parameters; \
+    type __wrap_##name parameters \
+    { \
+        if(_branch_fault_injection_active) { \
+            int error = (fail_errno); \
+            if(_branch_fault_point(#name, BRANCH_FAULT_CALLER, &error)) { \
+                errno = error; \
+                return (fail_value); \
+            } \
+        } \
+        return __real_##name arguments; \
+    }
+
+#include "cmocka_branches_fault_functions.h"
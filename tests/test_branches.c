@@ -19,10 +19,21 @@
 #define TEST_FAILING 1
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <setjmp.h>
 #include <cmocka.h>
 #include <cmocka_branches.h>
+#include <cmocka_branches_monitor.h>
+#include <cmocka_branches_trace.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 static int runs;
 static int total_runs;
 
@@ -344,6 +355,1588 @@ static void branch_test_errname(void **state) {
     printf("aCaseEnd\n");
     (void)state;
 }
+#define ISOLATION_FILE "test_branches_isolation.txt"
+
+static void isolation_crash_inner(void *state)
+{
+    const unsigned int twig = branch_start_count("isolated", 4, NULL);
+    FILE *passed;
+    switch(twig) {
+        case 1:
+            raise(SIGSEGV);
+            break;
+        case 2:
+            for(;;) {
+            }
+            break;
+    }
+    branch_end_named("isolated");
+    passed = fopen(ISOLATION_FILE, "a");
+    assert_non_null(passed);
+    fprintf(passed, "%u\n", twig);
+    fclose(passed);
+    (void)state;
+}
+
+static void isolation_crash_and_hang(void **state)
+{
+    branch_set_isolation(1, 200);
+    branch_custom_func_wrapper_named("isolation_crash", isolation_crash_inner, NULL);
+    (void)state;
+}
+
+static int isolation_teardown(void **state)
+{
+    branch_set_isolation(0, 0);
+    (void)state;
+    return 0;
+}
+
+/* A crash and a hang each fail their own combination, the exploration continues after them */
+static void isolation_failure_test(void **state)
+{
+    char passed[16];
+    size_t length;
+    FILE *file;
+    int status;
+    pid_t child;
+
+    remove(ISOLATION_FILE);
+    child = fork();
+    if(child == 0) {
+        const struct CMUnitTest failing[] = {
+            cmocka_unit_test_teardown(isolation_crash_and_hang, isolation_teardown),
+        };
+        BranchContextStatus context_status;
+        const int failed = cmocka_run_group_tests(failing, NULL, NULL);
+        branch_context_status(NULL, &context_status);
+        _exit(failed == 1 && context_status.combinations == 4 && context_status.failed_combinations == 2 ? 0 : 1);
+    }
+    assert_true(child > 0);
+    assert_int_equal(waitpid(child, &status, 0), child);
+    assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    /* The twigs after the crash and the hang passed */
+    file = fopen(ISOLATION_FILE, "r");
+    assert_non_null(file);
+    length = fread(passed, 1, sizeof(passed) - 1, file);
+    passed[length] = '\0';
+    fclose(file);
+    remove(ISOLATION_FILE);
+    assert_string_equal(passed, "0\n3\n");
+    (void)state;
+}
+
+#define HISTORY_FILE "test_branches_history.txt"
+static unsigned int history_order[3];
+
+static void history_order_inner(void *state)
+{
+    static const unsigned int history_branch_line = __LINE__ + 1;
+    history_order[runs] = branch_start_count("history", 3, NULL);
+    branch_end_named("history");
+    runs++;
+    *(unsigned int*)state = history_branch_line;
+}
+
+/* A twig that failed in an earlier run is explored first, the others follow in order */
+static void failure_history_order_test(void **state)
+{
+    unsigned int history_branch_line = 0;
+    FILE *history_file;
+
+    /* Run once to learn the line of the branch point */
+    runs = 0;
+    branch_custom_func_wrapper(history_order_inner, &history_branch_line);
+
+    history_file = fopen(HISTORY_FILE, "w");
+    assert_non_null(history_file);
+    fprintf(history_file, "history_order\thistory\t%s\t%u\thistory_order_inner\t3\t2\t0\n", __FILE__, history_branch_line);
+    fclose(history_file);
+
+    runs = 0;
+    branch_set_history_file(HISTORY_FILE);
+    branch_custom_func_wrapper_named("history_order", history_order_inner, &history_branch_line);
+    branch_set_history_file(NULL);
+    remove(HISTORY_FILE);
+
+    assert_int_equal(runs, 3);
+    assert_int_equal(history_order[0], 2);
+    assert_int_equal(history_order[1], 0);
+    assert_int_equal(history_order[2], 1);
+    (void)state;
+}
+
+#define HISTORY_WIDE_TWIGS 100
+static unsigned int history_wide_first;
+
+static void history_wide_inner(void *state)
+{
+    static const unsigned int history_branch_line = __LINE__ + 1;
+    const unsigned int twig = branch_start_count("wide", HISTORY_WIDE_TWIGS, NULL);
+    branch_end_named("wide");
+    if(runs++ == 0) {
+        history_wide_first = twig;
+    }
+    *(unsigned int*)state = history_branch_line;
+}
+
+/* The failure history also orders branch points with many twigs */
+static void failure_history_wide_test(void **state)
+{
+    unsigned int history_branch_line = 0;
+    FILE *history_file;
+
+    runs = 0;
+    branch_custom_func_wrapper(history_wide_inner, &history_branch_line);
+    assert_int_equal(history_wide_first, 0);
+
+    history_file = fopen(HISTORY_FILE, "w");
+    assert_non_null(history_file);
+    fprintf(history_file, "history_wide\twide\t%s\t%u\thistory_wide_inner\t%u\t70\t0\n", __FILE__,
+            history_branch_line, HISTORY_WIDE_TWIGS);
+    fclose(history_file);
+
+    runs = 0;
+    branch_set_history_file(HISTORY_FILE);
+    branch_custom_func_wrapper_named("history_wide", history_wide_inner, &history_branch_line);
+    branch_set_history_file(NULL);
+    remove(HISTORY_FILE);
+
+    assert_int_equal(runs, HISTORY_WIDE_TWIGS);
+    assert_int_equal(history_wide_first, 70);
+    (void)state;
+}
+
+static unsigned int history_failing_twig;
+
+static void history_record_inner(void *state)
+{
+    const unsigned int twig = branch_start_count("history", 3, NULL);
+    history_order[runs++] = twig;
+    assert_int_not_equal(twig, history_failing_twig);
+    branch_end_named("history");
+    (void)state;
+}
+
+static void history_record_failing(void **state)
+{
+    history_record_inner(*state);
+}
+
+/* Read the history file, an empty string if there is none */
+static void history_read(char *history, const size_t size)
+{
+    FILE * const history_file = fopen(HISTORY_FILE, "r");
+    size_t length = 0;
+    if(history_file != NULL) {
+        length = fread(history, 1, size - 1, history_file);
+        fclose(history_file);
+    }
+    history[length] = '\0';
+}
+
+/* A failing twig is recorded, explored first by the next runs and forgotten after passing runs */
+static void failure_history_record_test(void **state)
+{
+    char history[1024];
+    int status;
+    unsigned int i;
+    pid_t child;
+
+    remove(HISTORY_FILE);
+    branch_set_history_file(HISTORY_FILE);
+    history_failing_twig = 2;
+    runs = 0;
+    child = fork();
+    if(child == 0) {
+        const struct CMUnitTest failing[] = {
+            cmocka_unit_test_twigs(history_record_failing),
+        };
+        _exit(cmocka_run_group_tests(failing, NULL, NULL) == 1 ? 0 : 1);
+    }
+    assert_true(child > 0);
+    assert_int_equal(waitpid(child, &status, 0), child);
+    assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    history_read(history, sizeof(history));
+    assert_true(strstr(history, "history_record_failing\thistory\t") == history);
+    assert_non_null(strstr(history, "\thistory_record_inner\t3\t2\t0\n"));
+
+    history_failing_twig = 3;
+    for(i = 1; i <= 5; i++) {
+        runs = 0;
+        branch_custom_func_wrapper_named("history_record_failing", history_record_inner, NULL);
+        assert_int_equal(runs, 3);
+        assert_int_equal(history_order[0], 2);
+        assert_int_equal(history_order[1], 0);
+        assert_int_equal(history_order[2], 1);
+        history_read(history, sizeof(history));
+        if(i < 5) {
+            char age[16];
+            snprintf(age, sizeof(age), "\t3\t2\t%u\n", i);
+            assert_non_null(strstr(history, age));
+        } else {
+            assert_string_equal(history, "");
+        }
+    }
+
+    runs = 0;
+    branch_custom_func_wrapper_named("history_record_failing", history_record_inner, NULL);
+    assert_int_equal(history_order[0], 0);
+    assert_int_equal(history_order[1], 1);
+    assert_int_equal(history_order[2], 2);
+    branch_set_history_file(NULL);
+    remove(HISTORY_FILE);
+    (void)state;
+}
+
+#define CACHE_FILE "test_branches_cache.txt"
+
+static void incremental_inner(void *state)
+{
+    if(branch_start_count("outer", 2, NULL) == 1) {
+        branch_start_count("inner", 3, NULL);
+        branch_end_named("inner");
+    }
+    branch_end_named("outer");
+    runs++;
+    (void)state;
+}
+
+/* Unchanged combinations are replayed from the cache, unless the build changed or a full run is forced */
+static void incremental_cache_test(void **state)
+{
+    branch_set_incremental_cache(CACHE_FILE);
+    remove(CACHE_FILE);
+
+    runs = 0;
+    branch_custom_func_wrapper_named("incremental", incremental_inner, NULL);
+    assert_int_equal(runs, 4);
+
+    runs = 0;
+    branch_custom_func_wrapper_named("incremental", incremental_inner, NULL);
+    assert_int_equal(runs, 0);
+
+    runs = 0;
+    branch_set_incremental_full_run(1);
+    branch_custom_func_wrapper_named("incremental", incremental_inner, NULL);
+    branch_set_incremental_full_run(0);
+    assert_int_equal(runs, 4);
+
+    /* A new build id stands for a change in code without branch call sites */
+    runs = 0;
+    branch_set_incremental_build_id("changed build");
+    branch_custom_func_wrapper_named("incremental", incremental_inner, NULL);
+    assert_int_equal(runs, 4);
+
+    runs = 0;
+    branch_custom_func_wrapper_named("incremental", incremental_inner, NULL);
+    branch_set_incremental_build_id(NULL);
+    assert_int_equal(runs, 0);
+
+    branch_set_incremental_cache(NULL);
+    remove(CACHE_FILE);
+    (void)state;
+}
+
+/* Stands for a source file only some combinations depend on */
+#define CACHE_DEPENDENCY_FILE "test_branches_cache_dependency.c"
+
+static void write_cache_dependency(const char *contents)
+{
+    FILE * const file = fopen(CACHE_DEPENDENCY_FILE, "w");
+    assert_non_null(file);
+    fputs(contents, file);
+    fclose(file);
+}
+
+static void incremental_dependency_inner(void *state)
+{
+    if(branch_start_count("outer", 3, NULL) == 2) {
+        _branch_start("dependency", 2, NULL, CACHE_DEPENDENCY_FILE, 1, "dependency");
+        _branch_end("dependency", CACHE_DEPENDENCY_FILE, 1, "dependency");
+    }
+    branch_end_named("outer");
+    runs++;
+    (void)state;
+}
+
+/* A changed source file only executes the combinations visiting one of its branch call sites */
+static void incremental_dependency_test(void **state)
+{
+    branch_set_incremental_cache(CACHE_FILE);
+    remove(CACHE_FILE);
+    write_cache_dependency("int dependency;\n");
+
+    runs = 0;
+    branch_custom_func_wrapper_named("dependency", incremental_dependency_inner, NULL);
+    assert_int_equal(runs, 4);
+
+    runs = 0;
+    write_cache_dependency("long dependency;\n");
+    branch_custom_func_wrapper_named("dependency", incremental_dependency_inner, NULL);
+    assert_int_equal(runs, 2);
+
+    runs = 0;
+    branch_custom_func_wrapper_named("dependency", incremental_dependency_inner, NULL);
+    assert_int_equal(runs, 0);
+
+    branch_set_incremental_cache(NULL);
+    remove(CACHE_FILE);
+    remove(CACHE_DEPENDENCY_FILE);
+    (void)state;
+}
+
+#define EXPORT_PREFIX "test_branches_export_"
+
+/* The explored tree is written with the statistics of every twig */
+static void tree_export_test(void **state)
+{
+    char line[256];
+    int found = 0;
+    FILE *file;
+
+    branch_set_tree_export(EXPORT_PREFIX, 0);
+    branch_custom_func_wrapper_named("export", incremental_inner, NULL);
+    branch_set_tree_export(NULL, 0);
+
+    file = fopen(EXPORT_PREFIX "export.json", "r");
+    assert_non_null(file);
+    while(fgets(line, sizeof(line), file) != NULL) {
+        found |= strstr(line, "\"combinations\": 4, \"passed\": 4, \"failed\": 0") != NULL;
+    }
+    fclose(file);
+    assert_true(found);
+
+    file = fopen(EXPORT_PREFIX "export.dot", "r");
+    assert_non_null(file);
+    assert_non_null(fgets(line, sizeof(line), file));
+    assert_string_equal(line, "digraph branches {\n");
+    fclose(file);
+
+    remove(EXPORT_PREFIX "export.json");
+    remove(EXPORT_PREFIX "export.dot");
+    (void)state;
+}
+
+/* Combinations run in child processes while the exploration state stays in the test process */
+static void isolation_test(void **state)
+{
+    BranchContextStatus status;
+    runs = 0;
+    branch_set_isolation(3, 0);
+    branch_custom_func_wrapper_named("isolation", incremental_inner, NULL);
+    branch_set_isolation(0, 0);
+    branch_context_status(NULL, &status);
+    assert_int_equal(status.combinations, 4);
+    assert_int_equal(status.failed_combinations, 0);
+    /* The test function only ran in the child processes */
+    assert_int_equal(runs, 0);
+    (void)state;
+}
+
+#define STREAMING_MAX_RUNS 64
+static char streaming_paths[2][STREAMING_MAX_RUNS][16];
+
+/* Two sequential branch points over twigs with subtrees of different shapes */
+static void streaming_inner(void *state)
+{
+    char * const path = streaming_paths[*(int*)state][runs];
+    size_t length = 0;
+    unsigned int i;
+    assert_true(runs < STREAMING_MAX_RUNS);
+    for(i = 0; i < 2; i++) {
+        const unsigned int outer = branch_start_count("outer", 3, NULL);
+        path[length++] = (char)('0' + outer);
+        if(outer == 1) {
+            const unsigned int middle = branch_start_count("middle", 2, NULL);
+            path[length++] = (char)('0' + middle);
+            if(middle == 1) {
+                path[length++] = (char)('0' + branch_start_count("inner", 3, NULL));
+                branch_end_named("inner");
+            }
+            branch_end_named("middle");
+        } else if(outer == 2) {
+            const unsigned int wide = branch_start_count("wide", 4, NULL);
+            path[length++] = (char)('0' + wide);
+            if(wide == 3) {
+                path[length++] = (char)('0' + branch_start_count("last", 2, NULL));
+                branch_end_named("last");
+            }
+            branch_end_named("wide");
+        }
+        branch_end_named("outer");
+        path[length++] = '|';
+    }
+    path[length] = '\0';
+    runs++;
+}
+
+/*
+ * Freeing completed subtrees visits every combination of a tree of varying shape exactly once, in
+ * the order of the default exploration. The order depends on the branches directly below a
+ * completed twig keeping their current twig, so they can't be freed with the deeper subtrees.
+ */
+static void streaming_test(void **state)
+{
+    int streaming = 0;
+    int default_runs;
+    int i, j;
+    runs = 0;
+    branch_custom_func_wrapper_named("streaming", streaming_inner, &streaming);
+    default_runs = runs;
+    assert_int_equal(default_runs, 44);
+    for(i = 0; i < default_runs; i++) {
+        for(j = 0; j < i; j++) {
+            assert_string_not_equal(streaming_paths[0][i], streaming_paths[0][j]);
+        }
+    }
+
+    runs = 0;
+    streaming = 1;
+    branch_set_streaming(1);
+    branch_custom_func_wrapper_named("streaming", streaming_inner, &streaming);
+    branch_set_streaming(0);
+    assert_int_equal(runs, default_runs);
+    for(i = 0; i < default_runs; i++) {
+        assert_string_equal(streaming_paths[1][i], streaming_paths[0][i]);
+    }
+    (void)state;
+}
+
+static unsigned long streaming_order[2];
+
+/* A lazy branch below every twig, with a branch below each of its values */
+static void streaming_lazy_inner(void *state)
+{
+    const unsigned int outer = branch_start_count("outer", 2, NULL);
+    const long value = branch_start_range("range", 0, 99, 1);
+    const unsigned int inner = branch_start_count("inner", 2, NULL);
+    unsigned long * const order = &streaming_order[*(int*)state];
+    *order = *order * 31 + outer * 1000 + (unsigned long)value * 2 + inner;
+    branch_end_named("inner");
+    branch_end_named("range");
+    branch_end_named("outer");
+    runs++;
+}
+
+/* Freeing the idle twigs of lazy branches below completed twigs keeps the exploration order */
+static void streaming_lazy_test(void **state)
+{
+    int streaming = 0;
+    runs = 0;
+    memset(streaming_order, 0, sizeof(streaming_order));
+    branch_custom_func_wrapper_named("streaming lazy", streaming_lazy_inner, &streaming);
+    assert_int_equal(runs, 2 * 100 * 2);
+
+    runs = 0;
+    streaming = 1;
+    branch_set_streaming(1);
+    branch_custom_func_wrapper_named("streaming lazy", streaming_lazy_inner, &streaming);
+    branch_set_streaming(0);
+    assert_int_equal(runs, 2 * 100 * 2);
+    assert_true(streaming_order[1] == streaming_order[0]);
+    (void)state;
+}
+
+static struct {
+    int counter;
+    char name[8];
+} small_state = { 1, "init" };
+static unsigned char large_state[16 * 4096];
+
+static void registered_state_inner(void *state)
+{
+    unsigned int twig;
+    assert_int_equal(small_state.counter, 1);
+    assert_string_equal(small_state.name, "init");
+    assert_int_equal(large_state[0], 7);
+    assert_int_equal(large_state[sizeof(large_state) / 2], 0);
+    assert_int_equal(large_state[sizeof(large_state) - 1], 0);
+
+    twig = branch_start_count("writes", 3, NULL);
+    small_state.counter++;
+    small_state.name[0] = 'x';
+    large_state[twig * (sizeof(large_state) / 2 - 1)] = 0xff;
+    branch_end_named("writes");
+    runs++;
+    (void)state;
+}
+
+/* Registered state is restored before every combination, whole pages only when they were written */
+static void registered_state_test(void **state)
+{
+    large_state[0] = 7;
+    branch_register_state(&small_state, sizeof(small_state));
+    branch_register_state(large_state, sizeof(large_state));
+    runs = 0;
+    branch_custom_func_wrapper_named("registered_state", registered_state_inner, NULL);
+    branch_unregister_state(large_state);
+    branch_unregister_state(&small_state);
+    assert_int_equal(runs, 3);
+    (void)state;
+}
+
+/* Child processes track the writes to registered state like the test process */
+static void registered_state_isolation_test(void **state)
+{
+    BranchContextStatus status;
+    small_state.counter = 1;
+    strcpy(small_state.name, "init");
+    memset(large_state, 0, sizeof(large_state));
+    large_state[0] = 7;
+    branch_register_state(&small_state, sizeof(small_state));
+    branch_register_state(large_state, sizeof(large_state));
+    branch_set_isolation(2, 0);
+    branch_custom_func_wrapper_named("registered_state_isolation", registered_state_inner, NULL);
+    branch_set_isolation(0, 0);
+    branch_unregister_state(large_state);
+    branch_unregister_state(&small_state);
+    branch_context_status(NULL, &status);
+    assert_int_equal(status.combinations, 3);
+    assert_int_equal(status.failed_combinations, 0);
+    (void)state;
+}
+
+static int fault_failures;
+static const char fault_caller;
+
+static int fault_filter(const char *function, const void *caller, int *error, void *data)
+{
+    (void)caller;
+    (void)data;
+    *error = EAGAIN;
+    return strcmp(function, "read") == 0;
+}
+
+static void fault_inner(void *state)
+{
+    int error = EIO;
+    if(_branch_fault_point("read", &fault_caller, &error)) {
+        assert_int_equal(error, EAGAIN);
+        fault_failures++;
+    }
+    error = EIO;
+    assert_false(_branch_fault_point("write", &fault_caller, &error));
+    runs++;
+    (void)state;
+}
+
+/* Wrapped calls accepted by the filter are explored both succeeding and failing */
+static void fault_injection_test(void **state)
+{
+    int error = EIO;
+    runs = 0;
+    fault_failures = 0;
+    branch_set_fault_filter(fault_filter, NULL);
+    branch_custom_func_wrapper_named("fault_injection", fault_inner, NULL);
+    assert_false(_branch_fault_point("read", &fault_caller, &error));
+    branch_set_fault_filter(NULL, NULL);
+    assert_int_equal(runs, 2);
+    assert_int_equal(fault_failures, 1);
+    assert_int_equal(_branch_fault_injection_active, 0);
+    (void)state;
+}
+
+static const char * const prune_phy_names[] = {"change to 2mbps", "change to coded", "no change"};
+static const BranchExclusion prune_exclusions[] = {
+    { "phy", 2, "dle", 0, NULL, 0, NULL, 0 },
+    { "phy", 2, "dle", 1, NULL, 0, NULL, 0 },
+    { "phy", 2, "dle", 2, NULL, 0, NULL, 0 },
+};
+static unsigned int prune_seen[3][4];
+
+static void prune_inner(void *state)
+{
+    const unsigned int phy = branch_start_count("phy", 3, prune_phy_names);
+    unsigned int dle;
+    branch_end_named("phy");
+    dle = branch_start_count("dle", 4, NULL);
+    assert_false(phy == 2 && dle != 3);
+    branch_assume(!(phy == 1 && dle == 3));
+    branch_end_named("dle");
+    prune_seen[phy][dle]++;
+    runs++;
+    (void)state;
+}
+
+/* Excluded twigs are skipped, assumed away combinations are pruned and the rest run once */
+static void prune_test(void **state)
+{
+    BranchContextStatus status;
+    unsigned int batch_size;
+    for(batch_size = 0; batch_size <= 2; batch_size += 2) {
+        runs = 0;
+        memset(prune_seen, 0, sizeof(prune_seen));
+        branch_set_isolation(batch_size, 0);
+        branch_set_exclusions(prune_exclusions, sizeof(prune_exclusions) / sizeof(prune_exclusions[0]));
+        branch_custom_func_wrapper_named("prune", prune_inner, NULL);
+        branch_set_exclusions(NULL, 0);
+        branch_set_isolation(0, 0);
+        branch_context_status(NULL, &status);
+        assert_int_equal(status.combinations, 9);
+        assert_int_equal(status.pruned_combinations, 1);
+        assert_int_equal(status.failed_combinations, 0);
+        if(batch_size == 0) {
+            assert_int_equal(runs, 8);
+            assert_int_equal(prune_seen[0][3], 1);
+            assert_int_equal(prune_seen[1][3], 0);
+            assert_int_equal(prune_seen[2][3], 1);
+        }
+    }
+    (void)state;
+}
+
+/* Two branch points with the same name, told apart by their call site */
+static const BranchSite exclusion_site_first = { "mode", 2, NULL, "exclusion_site.c", 10, "exclusion_site_inner" };
+static const BranchSite exclusion_site_second = { "mode", 3, NULL, "exclusion_site.c", 20, "exclusion_site_inner" };
+static const BranchExclusion exclusion_site_exclusions[] = {
+    { "mode", 0, "mode", 0, "exclusion_site.c", 10, "exclusion_site.c", 20 },
+    { "mode", 1, "mode", 2, "exclusion_site.c", 10, "exclusion_site.c", 20 },
+};
+static unsigned int exclusion_site_seen[2][3];
+
+static void exclusion_site_inner(void *state)
+{
+    const unsigned int first = _branch_start_site(&exclusion_site_first);
+    unsigned int second;
+    _branch_end_site(&exclusion_site_first);
+    second = _branch_start_site(&exclusion_site_second);
+    _branch_end_site(&exclusion_site_second);
+    exclusion_site_seen[first][second]++;
+    (void)state;
+}
+
+/* Exclusions with a call site only apply there, and excluded combinations are never started */
+static void exclusion_site_test(void **state)
+{
+    BranchContextStatus status;
+    memset(exclusion_site_seen, 0, sizeof(exclusion_site_seen));
+    branch_set_exclusions(exclusion_site_exclusions, sizeof(exclusion_site_exclusions) / sizeof(exclusion_site_exclusions[0]));
+    branch_custom_func_wrapper_named("exclusion_site", exclusion_site_inner, NULL);
+    branch_set_exclusions(NULL, 0);
+    branch_context_status(NULL, &status);
+    assert_int_equal(status.combinations, 4);
+    assert_int_equal(status.pruned_combinations, 0);
+    assert_int_equal(exclusion_site_seen[0][0], 0);
+    assert_int_equal(exclusion_site_seen[0][1], 1);
+    assert_int_equal(exclusion_site_seen[0][2], 1);
+    assert_int_equal(exclusion_site_seen[1][0], 1);
+    assert_int_equal(exclusion_site_seen[1][1], 1);
+    assert_int_equal(exclusion_site_seen[1][2], 0);
+    (void)state;
+}
+
+#define MONITOR_FILE "test_branches_monitor.bin"
+
+static void monitor_inner(void *state)
+{
+    branch_start_count("a", 2, NULL);
+    branch_start_count("b", 3, NULL);
+    branch_end_named("b");
+    branch_end_named("a");
+    (void)state;
+}
+
+/* The progress block holds the counters of the finished exploration */
+static void monitor_test(void **state)
+{
+    BranchMonitorBlock block;
+    FILE *file;
+    branch_set_monitor_file(MONITOR_FILE);
+    branch_custom_func_wrapper_named("monitor", monitor_inner, NULL);
+    branch_set_monitor_file(NULL);
+
+    file = fopen(MONITOR_FILE, "rb");
+    assert_non_null(file);
+    assert_int_equal(fread(&block, sizeof(block), 1, file), 1);
+    fclose(file);
+    remove(MONITOR_FILE);
+    assert_int_equal(block.magic, BRANCH_MONITOR_MAGIC);
+    assert_int_equal(block.running, 0);
+    assert_int_equal(block.combinations, 6);
+    assert_int_equal(block.failures, 0);
+    assert_int_equal(block.nesting_depth, 2);
+    assert_int_equal(block.nodes, 1 + 2 + 2 * (1 + 3));
+    assert_string_equal(block.test_name, "monitor");
+    (void)state;
+}
+
+static const long range_values[] = {-7, 3, 1000000};
+static unsigned long range_sum;
+static unsigned int range_nested_runs;
+static unsigned int range_value_runs[3];
+
+static void range_inner(void *state)
+{
+    const long value = branch_start_range("range", 0, 99990, 10);
+    const long picked = branch_start_values("picked", range_values, 3);
+    assert_int_equal(value % 10, 0);
+    if(value % 10000 == 0) {
+        branch_start_count("nested", 2, NULL);
+        range_nested_runs++;
+        branch_end_named("nested");
+    }
+    branch_end_named("picked");
+    branch_end_named("range");
+    range_value_runs[picked == -7 ? 0 : picked == 3 ? 1 : 2]++;
+    range_sum += (unsigned long)value;
+    runs++;
+    (void)state;
+}
+
+/* Every value of a wide range is taken once, with the nested branches under it */
+static void range_test(void **state)
+{
+    BranchContextStatus status;
+    runs = 0;
+    range_sum = 0;
+    range_nested_runs = 0;
+    memset(range_value_runs, 0, sizeof(range_value_runs));
+    branch_custom_func_wrapper_named("range", range_inner, NULL);
+    branch_context_status(NULL, &status);
+    assert_int_equal(status.failed_combinations, 0);
+    assert_int_equal(runs, 3 * (10000 + 10));
+    assert_int_equal(range_nested_runs, 3 * 10 * 2);
+    assert_int_equal(range_value_runs[0], 10000 + 10);
+    assert_int_equal(range_value_runs[2], 10000 + 10);
+    assert_int_equal(range_sum, 3 * (499950000UL + 450000UL));
+    (void)state;
+}
+
+static long range_wide_values[4];
+
+static void range_wide_inner(void *state)
+{
+    const long value = branch_start_range("wide", LONG_MIN, LONG_MAX, 1L << 62);
+    range_wide_values[runs++] = value;
+    branch_end_named("wide");
+    (void)state;
+}
+
+/* A range over all long values returns each value without overflowing */
+static void range_wide_step_test(void **state)
+{
+    runs = 0;
+    branch_custom_func_wrapper_named("range wide", range_wide_inner, NULL);
+    assert_int_equal(runs, 4);
+    assert_true(range_wide_values[0] == LONG_MIN);
+    assert_true(range_wide_values[1] == LONG_MIN / 2);
+    assert_true(range_wide_values[2] == 0);
+    assert_true(range_wide_values[3] == LONG_MAX / 2 + 1);
+    (void)state;
+}
+
+static void range_stats_inner(void *state)
+{
+    branch_start_range("stats", 0, 999, 1);
+    runs++;
+    branch_end_named("stats");
+    (void)state;
+}
+
+/* The statistics of the twigs of a wide range are folded into the branch, which frees the twigs */
+static void range_stats_test(void **state)
+{
+    char json[4096];
+    size_t size;
+    FILE *file;
+    runs = 0;
+    branch_set_tree_export(EXPORT_PREFIX, 0);
+    branch_custom_func_wrapper_named("range stats", range_stats_inner, NULL);
+    branch_set_tree_export(NULL, 0);
+    assert_int_equal(runs, 1000);
+
+    file = fopen(EXPORT_PREFIX "range stats.json", "r");
+    assert_non_null(file);
+    size = fread(json, 1, sizeof(json) - 1, file);
+    json[size] = '\0';
+    fclose(file);
+    assert_non_null(strstr(json, "\"engine\": {\"branches\": 1, \"twigs\": 1,"));
+    assert_non_null(strstr(json, "\"other_twigs\": {\"combinations\": 999, \"passed\": 999, \"failed\": 0"));
+    remove(EXPORT_PREFIX "range stats.json");
+    remove(EXPORT_PREFIX "range stats.dot");
+    (void)state;
+}
+
+static const BranchSite assume_site = { "assume_site", 2, NULL, __FILE__, __LINE__, "assume_in_site" };
+
+/* A false assumption inside a branch point of a C++ scope would jump over the scope */
+static void assume_in_site(void **state)
+{
+    const unsigned int twig = _branch_start_site(&assume_site);
+    branch_assume(twig == 0);
+    _branch_end_site(&assume_site);
+    (void)state;
+}
+
+/* A range with a single value is not a branch point */
+static void range_single_value(void **state)
+{
+    branch_start_range("single", 5, 9, 10);
+    branch_end_named("single");
+    (void)state;
+}
+
+#define TRACE_FILE "test_branches_trace.bin"
+
+/* Every combination, branch start and branch end of the exploration is in the trace */
+static void trace_test(void **state)
+{
+    unsigned int counts[BRANCH_TRACE_RESTART + 1];
+    BranchTraceChunk chunk;
+    unsigned int sites = 0;
+    FILE *file;
+    memset(counts, 0, sizeof(counts));
+    branch_set_trace_file(TRACE_FILE);
+    branch_custom_func_wrapper_named("trace", monitor_inner, NULL);
+    branch_set_trace_file(NULL);
+
+    file = fopen(TRACE_FILE, "rb");
+    assert_non_null(file);
+    while(fread(&chunk, sizeof(chunk), 1, file) == 1) {
+        assert_int_equal(chunk.magic, BRANCH_TRACE_MAGIC);
+        if(chunk.kind == BRANCH_TRACE_CHUNK_RECORDS) {
+            BranchTraceRecord record;
+            unsigned int i;
+            for(i = 0; i < chunk.size / sizeof(record); i++) {
+                assert_int_equal(fread(&record, sizeof(record), 1, file), 1);
+                assert_true(record.type >= BRANCH_TRACE_COMBINATION_BEGIN && record.type <= BRANCH_TRACE_RESTART);
+                counts[record.type]++;
+            }
+        } else {
+            assert_int_equal(chunk.kind, BRANCH_TRACE_CHUNK_SITE);
+            assert_int_equal(fseek(file, (long)chunk.size, SEEK_CUR), 0);
+            sites++;
+        }
+    }
+    fclose(file);
+    remove(TRACE_FILE);
+    assert_int_equal(sites, 2);
+    assert_int_equal(counts[BRANCH_TRACE_COMBINATION_BEGIN], 6);
+    assert_int_equal(counts[BRANCH_TRACE_COMBINATION_END], 6);
+    assert_int_equal(counts[BRANCH_TRACE_BRANCH_START], 12);
+    assert_int_equal(counts[BRANCH_TRACE_BRANCH_END], 12);
+    assert_int_equal(counts[BRANCH_TRACE_RESTART], 6);
+    assert_int_equal(counts[BRANCH_TRACE_FAILURE], 0);
+    (void)state;
+}
+
+static const char * const schema_phy_names[] = {"change to 2mbps", "change to coded", "no change"};
+static const BranchSchemaPoint schema_points[] = {
+    { "phy", 3, schema_phy_names, BRANCH_SCHEMA_ROOT, 0 },
+    { "dle", 4, NULL, 0, 1 },
+    { "ack", 2, NULL, 1, BRANCH_SCHEMA_ANY_TWIG },
+    { "len", 2, NULL, BRANCH_SCHEMA_ROOT, 0 },
+};
+#define SCHEMA_POINTS (sizeof(schema_points) / sizeof(schema_points[0]))
+
+/* Iteration, random access and parts yield the same combinations */
+static void schema_test(void **state)
+{
+    static const BranchSchemaPoint unordered[] = {
+        { "a", 2, NULL, BRANCH_SCHEMA_ROOT, 0 },
+        { "b", 2, NULL, BRANCH_SCHEMA_ROOT, 0 },
+        { "c", 2, NULL, 0, 0 },
+    };
+    unsigned int twigs[SCHEMA_POINTS];
+    unsigned int decoded[SCHEMA_POINTS];
+    unsigned int seen[3] = {0, 0, 0};
+    BranchSchemaIterator iterator;
+    BranchSchema * const schema = branch_schema_create(schema_points, SCHEMA_POINTS);
+    unsigned int part;
+    uint64_t count = 0;
+    assert_non_null(schema);
+    assert_null(branch_schema_create(unordered, 3));
+    assert_int_equal(branch_schema_count(schema), (1 + 4 * 2 + 1) * 2);
+
+    branch_schema_iterate(&iterator, schema, 0, UINT64_MAX, twigs);
+    while(branch_schema_next(&iterator)) {
+        assert_int_equal(iterator.index, count);
+        assert_true(branch_schema_decode(schema, count, decoded));
+        assert_memory_equal(twigs, decoded, sizeof(twigs));
+        assert_true((twigs[1] == BRANCH_SCHEMA_INACTIVE) == (twigs[0] != 1));
+        assert_true((twigs[2] == BRANCH_SCHEMA_INACTIVE) == (twigs[0] != 1));
+        assert_true(twigs[3] < 2);
+        seen[twigs[0]]++;
+        count++;
+    }
+    assert_int_equal(count, 20);
+    assert_int_equal(seen[1], 16);
+    assert_false(branch_schema_decode(schema, 20, decoded));
+
+    count = 0;
+    for(part = 0; part < 3; part++) {
+        branch_schema_iterate_part(&iterator, schema, part, 3, twigs);
+        while(branch_schema_next(&iterator)) {
+            assert_int_equal(iterator.index, count);
+            count++;
+        }
+    }
+    assert_int_equal(count, 20);
+    branch_schema_destroy(schema);
+    (void)state;
+}
+
+static int schema_setup(void **state)
+{
+    *state = branch_schema_create(schema_points, SCHEMA_POINTS);
+    return *state != NULL ? 0 : -1;
+}
+
+static int schema_teardown(void **state)
+{
+    branch_schema_destroy((BranchSchema*)*state);
+    return 0;
+}
+
+/* Combinations can't be shared by no consumers */
+static void schema_no_parts(void **state)
+{
+    unsigned int twigs[SCHEMA_POINTS];
+    BranchSchemaIterator iterator;
+    branch_schema_iterate_part(&iterator, (const BranchSchema*)*state, 0, 0, twigs);
+}
+
+static int path_twig_sum;
+
+static void path_inner(void *state)
+{
+    const unsigned int a = branch_start_count("a", 2, NULL);
+    const unsigned int b = branch_start_count("b", 3, NULL);
+    const unsigned int c = branch_start_count("c", 4, NULL);
+    assert_int_equal(a, 1);
+    assert_int_equal(b, 2);
+    path_twig_sum += (int)c;
+    branch_end_named("c");
+    branch_end_named("b");
+    branch_end_named("a");
+    runs++;
+    (void)state;
+}
+
+/* A path pins the first branch points, the rest is explored */
+static void path_test(void **state)
+{
+    runs = 0;
+    path_twig_sum = 0;
+    branch_set_path("1.2", 0);
+    branch_custom_func_wrapper_named("path", path_inner, NULL);
+    assert_int_equal(runs, 4);
+    assert_int_equal(path_twig_sum, 0 + 1 + 2 + 3);
+
+    runs = 0;
+    path_twig_sum = 0;
+    branch_set_path("1.2.3", 1);
+    branch_custom_func_wrapper_named("path", path_inner, NULL);
+    assert_int_equal(runs, 1);
+    assert_int_equal(path_twig_sum, 3);
+    branch_set_path(NULL, 0);
+    (void)state;
+}
+
+#define TIMING_FILE "test_branches_timings.txt"
+#define PLAN_FILE "test_branches_plan.txt"
+
+static unsigned int shard_seen[2][3];
+
+static void shard_inner(void *state)
+{
+    const unsigned int a = branch_start_count("a", 2, NULL);
+    const unsigned int b = branch_start_count("b", 3, NULL);
+    shard_seen[a][b]++;
+    branch_end_named("b");
+    branch_end_named("a");
+    runs++;
+    (void)state;
+}
+
+/* Subtree durations are recorded by prefix, and a shard explores the prefixes the plan assigns to it */
+static void shard_test(void **state)
+{
+    char line[256];
+    unsigned int lines = 0, i;
+    FILE *file;
+    remove(TIMING_FILE);
+    runs = 0;
+    branch_set_timing_file(TIMING_FILE, 1);
+    branch_custom_func_wrapper_named("shard", shard_inner, NULL);
+    branch_set_timing_file(NULL, 0);
+    assert_int_equal(runs, 6);
+    file = fopen(TIMING_FILE, "r");
+    assert_non_null(file);
+    while(fgets(line, sizeof(line), file) != NULL) {
+        assert_true(strncmp(line, "shard\t0\t", 8) == 0 || strncmp(line, "shard\t1\t", 8) == 0);
+        assert_non_null(strstr(line, "\t3\ta\t"));
+        lines++;
+    }
+    fclose(file);
+    assert_int_equal(lines, 2);
+
+    file = fopen(PLAN_FILE, "w");
+    assert_non_null(file);
+    fprintf(file, "# Shard plan for 2 shards\nshard\t0\t0.2\nshard\t0\t1\nshard\t1\t0.0\nshard\t1\t0.1\n");
+    fclose(file);
+    runs = 0;
+    memset(shard_seen, 0, sizeof(shard_seen));
+    branch_set_shard(PLAN_FILE, 0);
+    branch_custom_func_wrapper_named("shard", shard_inner, NULL);
+    assert_int_equal(runs, 4);
+    assert_int_equal(shard_seen[0][0] + shard_seen[0][1], 0);
+    assert_int_equal(shard_seen[0][2] + shard_seen[1][0] + shard_seen[1][1] + shard_seen[1][2], 4);
+    runs = 0;
+    branch_set_shard(PLAN_FILE, 1);
+    branch_custom_func_wrapper_named("shard", shard_inner, NULL);
+    assert_int_equal(runs, 2);
+    assert_int_equal(shard_seen[0][0] + shard_seen[0][1], 2);
+
+    /* Subtrees the plan leaves out are explored by the first shard after its own */
+    file = fopen(PLAN_FILE, "w");
+    assert_non_null(file);
+    fprintf(file, "# Shard plan for 2 shards\nshard\t0\t0.2\nshard\t1\t0.0\n");
+    fclose(file);
+    runs = 0;
+    memset(shard_seen, 0, sizeof(shard_seen));
+    branch_set_shard(PLAN_FILE, 0);
+    branch_custom_func_wrapper_named("shard", shard_inner, NULL);
+    assert_int_equal(runs, 5);
+    assert_int_equal(shard_seen[0][0], 0);
+    runs = 0;
+    branch_set_shard(PLAN_FILE, 1);
+    branch_custom_func_wrapper_named("shard", shard_inner, NULL);
+    assert_int_equal(runs, 1);
+    for(i = 0; i < 6; i++) {
+        assert_int_equal(shard_seen[i / 3][i % 3], 1);
+    }
+
+    /* A test missing from the plan is explored by the first shard */
+    runs = 0;
+    branch_custom_func_wrapper_named("unplanned", shard_inner, NULL);
+    assert_int_equal(runs, 0);
+    branch_set_shard(PLAN_FILE, 0);
+    branch_custom_func_wrapper_named("unplanned", shard_inner, NULL);
+    assert_int_equal(runs, 6);
+    branch_set_shard(NULL, 0);
+    remove(PLAN_FILE);
+    remove(TIMING_FILE);
+    (void)state;
+}
+
+static unsigned int classes_seen[4][3];
+
+static void classes_inner(void *state)
+{
+    /* Codes 1 to 3 take the same abort path */
+    static const unsigned int code_classes[] = {0, 1, 1, 1};
+    const unsigned int code = branch_start_classes("code", 4, NULL, code_classes);
+    const unsigned int retry = branch_start_count("retry", 3, NULL);
+    branch_start_count("delay", 2, NULL);
+    classes_seen[code][retry]++;
+    branch_end_named("delay");
+    branch_end_named("retry");
+    branch_end_named("code");
+    runs++;
+    (void)state;
+}
+
+/* Only the representative of a class is explored in full, the other twigs take a single path */
+static void classes_test(void **state)
+{
+    unsigned int sampled[4][3];
+    char json[8192];
+    size_t size;
+    FILE *file;
+    runs = 0;
+    memset(classes_seen, 0, sizeof(classes_seen));
+    branch_set_tree_export(EXPORT_PREFIX, 0);
+    branch_custom_func_wrapper_named("classes", classes_inner, NULL);
+    branch_set_tree_export(NULL, 0);
+    assert_int_equal(runs, 6 + 6 + 1 + 1);
+    assert_int_equal(classes_seen[0][0] + classes_seen[0][1] + classes_seen[0][2], 6);
+    assert_int_equal(classes_seen[1][0] + classes_seen[1][1] + classes_seen[1][2], 6);
+    assert_int_equal(classes_seen[2][0], 1);
+    assert_int_equal(classes_seen[3][0], 1);
+
+    file = fopen(EXPORT_PREFIX "classes.json", "r");
+    assert_non_null(file);
+    size = fread(json, 1, sizeof(json) - 1, file);
+    json[size] = '\0';
+    fclose(file);
+    assert_non_null(strstr(json, "{\"value\": 3, \"name\": \"\", \"equivalent_to\": 1"));
+    assert_non_null(strstr(json, "\"pinned\": true"));
+    remove(EXPORT_PREFIX "classes.json");
+    remove(EXPORT_PREFIX "classes.dot");
+
+    /* A seed samples the twigs below the covered twigs, the same seed the same twigs */
+    runs = 0;
+    memset(classes_seen, 0, sizeof(classes_seen));
+    branch_set_equivalence_seed(7);
+    branch_custom_func_wrapper_named("classes", classes_inner, NULL);
+    assert_int_equal(runs, 14);
+    assert_int_equal(classes_seen[2][0] + classes_seen[2][1] + classes_seen[2][2], 1);
+    assert_int_equal(classes_seen[3][0] + classes_seen[3][1] + classes_seen[3][2], 1);
+    /* Not only the first twig is taken */
+    assert_int_equal(classes_seen[2][2], 1);
+    memcpy(sampled, classes_seen, sizeof(sampled));
+    memset(classes_seen, 0, sizeof(classes_seen));
+    branch_custom_func_wrapper_named("classes", classes_inner, NULL);
+    assert_memory_equal(classes_seen, sampled, sizeof(sampled));
+
+    /* Seed 0 goes back to the seed in the environment */
+    branch_set_equivalence_seed(0);
+    setenv("CMOCKA_BRANCHES_EQUIVALENCE_SEED", "7", 1);
+    memset(classes_seen, 0, sizeof(classes_seen));
+    branch_custom_func_wrapper_named("classes", classes_inner, NULL);
+    unsetenv("CMOCKA_BRANCHES_EQUIVALENCE_SEED");
+    assert_memory_equal(classes_seen, sampled, sizeof(sampled));
+    (void)state;
+}
+
+static unsigned int batch_seen[10];
+
+static void batch_inner(void *state)
+{
+    BranchBatch batch;
+    unsigned int lane;
+    const unsigned int lanes = branch_start_batch(&batch, "crc", 10, 4);
+    assert_true(lanes == 4 || (lanes == 2 && batch.first == 8));
+    assert_int_equal(batch.mask, (1u << lanes) - 1);
+    for(lane = 0; lane < lanes; lane++) {
+        batch_seen[branch_batch_twig(&batch, lane)]++;
+        assert_lane_true(&batch, lane, branch_batch_twig(&batch, lane) < 10);
+    }
+    branch_end_batch(&batch);
+    runs++;
+    (void)state;
+}
+
+static void batch_lane_inner(void *state)
+{
+    BranchBatch batch;
+    const unsigned int lanes = branch_start_batch(&batch, "crc", 10, 4);
+    assert_int_equal(lanes, 1);
+    assert_int_equal(batch.mask, 1);
+    batch_seen[branch_batch_twig(&batch, 0)]++;
+    branch_end_batch(&batch);
+    runs++;
+    (void)state;
+}
+
+/* A batched branch point takes width twigs per combination, a path with a lane replays one twig */
+static void batch_test(void **state)
+{
+    unsigned int i;
+    runs = 0;
+    memset(batch_seen, 0, sizeof(batch_seen));
+    branch_custom_func_wrapper_named("batch", batch_inner, NULL);
+    assert_int_equal(runs, 3);
+    for(i = 0; i < 10; i++) {
+        assert_int_equal(batch_seen[i], 1);
+    }
+
+    runs = 0;
+    memset(batch_seen, 0, sizeof(batch_seen));
+    branch_set_path("1+2", 1);
+    branch_custom_func_wrapper_named("batch_lane", batch_lane_inner, NULL);
+    branch_set_path(NULL, 0);
+    assert_int_equal(runs, 1);
+    assert_int_equal(batch_seen[6], 1);
+    (void)state;
+}
+
+static long shared_counter;
+static int lost_updates;
+static BranchMutex counter_mutex = BRANCH_MUTEX_INITIALIZER;
+static int counter_locked;
+
+static void counter_thread(void *arg)
+{
+    long value;
+    if(counter_locked) {
+        branch_mutex_lock(&counter_mutex);
+    }
+    value = branch_atomic_load(&shared_counter);
+    branch_atomic_store(&shared_counter, value + 1);
+    if(counter_locked) {
+        branch_mutex_unlock(&counter_mutex);
+    }
+    (void)arg;
+}
+
+static void counter_inner(void *state)
+{
+    shared_counter = 0;
+    assert_int_equal(branch_thread_create(counter_thread, NULL), 1);
+    assert_int_equal(branch_thread_create(counter_thread, NULL), 2);
+    branch_threads_run();
+    assert_int_equal(branch_thread_self(), 0);
+    lost_updates += shared_counter != 2;
+    runs++;
+    (void)state;
+}
+
+/* Interleavings of cooperative threads are explored up to the preemption bound */
+static void threads_test(void **state)
+{
+    unsigned int bound;
+    for(counter_locked = 0; counter_locked <= 1; counter_locked++) {
+        for(bound = 0; bound <= 2; bound++) {
+            runs = 0;
+            lost_updates = 0;
+            branch_set_preemption_bound(bound);
+            branch_custom_func_wrapper_named("threads", counter_inner, NULL);
+            assert_true(runs > 1);
+            if(bound == 0 || counter_locked) {
+                assert_int_equal(lost_updates, 0);
+            } else {
+                assert_true(lost_updates > 0);
+            }
+        }
+    }
+    branch_set_preemption_bound(2);
+    (void)state;
+}
+
+static int memo_inits;
+
+static void memo_fill(void *data, const size_t size, void *arg)
+{
+    memset(data, *(const unsigned char*)arg, size);
+    memo_inits++;
+}
+
+static void memo_inner(void *state)
+{
+    char key[16];
+    const unsigned char twig = (unsigned char)branch_start_count("key", 8, NULL);
+    const unsigned char shared_value = 0xa5;
+    const unsigned char *shared;
+    const unsigned char *keyed;
+    shared = (const unsigned char*)branch_memo("shared", 1000, memo_fill, (void*)&shared_value);
+    snprintf(key, sizeof(key), "key %u", twig);
+    keyed = (const unsigned char*)branch_memo(key, 1000, memo_fill, (void*)&twig);
+    assert_int_equal(shared[999], 0xa5);
+    assert_int_equal(keyed[0], twig);
+    if(branch_start() != 0) {
+        /* Both entries are found again in the same combination */
+        assert_ptr_equal(branch_memo(key, 1000, memo_fill, NULL), keyed);
+    }
+    branch_end();
+    if(twig == 7) {
+        /* The first key again, evicted by now under the limit */
+        const unsigned char first_twig = 0;
+        assert_int_equal(((const unsigned char*)branch_memo("key 0", 1000, memo_fill, (void*)&first_twig))[0], 0);
+    }
+    branch_end_named("key");
+    (void)state;
+}
+
+/* Memoized data is initialized once per key, the least recently used entries are evicted over the limit */
+static void memo_test(void **state)
+{
+    BranchContextStatus status;
+    memo_inits = 0;
+    branch_custom_func_wrapper_named("memo", memo_inner, NULL);
+    branch_context_status(NULL, &status);
+    assert_int_equal(memo_inits, 1 + 8);
+    assert_int_equal(status.memo_misses, 1 + 8);
+    assert_int_equal(status.memo_evictions, 0);
+
+    /*
+     * Room for two entries, the shared one stays as it is used by every combination. Each key
+     * evicts the one before it, and the first key is initialized again when it is requested last.
+     */
+    memo_inits = 0;
+    branch_set_memo_limit(2500);
+    branch_custom_func_wrapper_named("memo", memo_inner, NULL);
+    branch_set_memo_limit(0);
+    branch_context_status(NULL, &status);
+    assert_int_equal(memo_inits, 1 + 8 + 1);
+    assert_int_equal(status.memo_misses, 1 + 8 + 1);
+    assert_int_equal(status.memo_evictions, 7);
+    (void)state;
+}
+
+#define SERVE_SOCKET "test_branches_serve.sock"
+
+static int serve_resets;
+
+static int serve_reset(void *data)
+{
+    serve_resets++;
+    (void)data;
+    return 0;
+}
+
+static void served_inner(void **state)
+{
+    const unsigned int outer = branch_start_count("outer", 2, NULL);
+    if(outer == 1 && branch_start_count("inner", 3, NULL) == 2) {
+        /* Reports the reset count of the server for the test to check */
+        fprintf(stderr, "resets %d\n", serve_resets);
+        fail();
+    }
+    if(outer == 1) {
+        branch_end_named("inner");
+    }
+    branch_end_named("outer");
+    (void)state;
+}
+
+/* Send a request to the server and read the reply until the server closes the connection */
+static void serve_request(const char *request, char *reply, const size_t reply_size)
+{
+    struct sockaddr_un address;
+    size_t length = 0;
+    ssize_t result;
+    int attempts;
+    int connection = -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, SERVE_SOCKET);
+    for(attempts = 0; attempts < 500 && connection < 0; attempts++) {
+        connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        assert_true(connection >= 0);
+        if(connect(connection, (const struct sockaddr*)&address, sizeof(address)) != 0) {
+            close(connection);
+            connection = -1;
+            usleep(10000);
+        }
+    }
+    assert_true(connection >= 0);
+    assert_int_equal(write(connection, request, strlen(request)), strlen(request));
+    while(length + 1 < reply_size && (result = read(connection, reply + length, reply_size - length - 1)) > 0) {
+        length += (size_t)result;
+    }
+    reply[length] = '\0';
+    close(connection);
+}
+
+static pid_t serve_server;
+
+/* Stop a server left running by a failed check */
+static int serve_teardown(void **state)
+{
+    if(serve_server > 0) {
+        kill(serve_server, SIGKILL);
+        waitpid(serve_server, NULL, 0);
+        serve_server = 0;
+        remove(SERVE_SOCKET);
+    }
+    (void)state;
+    return 0;
+}
+
+/* A server process runs requests for shards and replays of a test it loaded once */
+static void serve_test(void **state)
+{
+    char reply[8192];
+    int status;
+    const pid_t server = fork();
+    if(server == 0) {
+        const struct CMUnitTest served[] = {
+            cmocka_unit_test_twigs(served_inner),
+        };
+        _exit(branch_serve(SERVE_SOCKET, served, 1, serve_reset, NULL) == 0 ? 0 : 1);
+    }
+    assert_true(server > 0);
+    serve_server = server;
+
+    serve_request("LIST\n", reply, sizeof(reply));
+    assert_non_null(strstr(reply, "served_inner\nCMOCKA_BRANCHES_RESULT 0\n"));
+    serve_request("RUN served_inner 0\n", reply, sizeof(reply));
+    assert_non_null(strstr(reply, "CMOCKA_BRANCHES_RESULT 0\n"));
+    serve_request("RUN served_inner 0 1\n", reply, sizeof(reply));
+    assert_non_null(strstr(reply, "resets 3\n"));
+    assert_non_null(strstr(reply, "Branch path id: 1.2\n"));
+    assert_non_null(strstr(reply, "CMOCKA_BRANCHES_RESULT 1\n"));
+    serve_request("REPLAY served_inner 1.1\n", reply, sizeof(reply));
+    assert_non_null(strstr(reply, "CMOCKA_BRANCHES_RESULT 0\n"));
+    serve_request("REPLAY served_inner 1.2\n", reply, sizeof(reply));
+    assert_non_null(strstr(reply, "resets 5\n"));
+    assert_non_null(strstr(reply, "CMOCKA_BRANCHES_RESULT 1\n"));
+    serve_request("RUN unknown\n", reply, sizeof(reply));
+    assert_non_null(strstr(reply, "CMOCKA_BRANCHES_RESULT 1\n"));
+    serve_request("QUIT\n", reply, sizeof(reply));
+
+    assert_int_equal(waitpid(server, &status, 0), server);
+    serve_server = 0;
+    assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    (void)state;
+}
+
+static int inner_runs;
+
+static void context_inner(void *state)
+{
+    branch_start_count("inner", 3, NULL);
+    inner_runs++;
+    branch_end_named("inner");
+    (void)state;
+}
+
+static void context_outer(void *state)
+{
+    BranchContext *inner = (BranchContext*)state;
+    BranchContextStatus status;
+    branch_start_count("outer", 2, NULL);
+    branch_context_run(inner, "context_inner", context_inner, NULL);
+    branch_context_status(inner, &status);
+    assert_false(status.running);
+    assert_int_equal(status.combinations, 3);
+    branch_context_status(NULL, &status);
+    assert_true(status.running);
+    assert_int_equal(status.nesting_level, 1);
+    runs++;
+    branch_end_named("outer");
+}
+
+/* Explorations in separate contexts can be nested and interleaved */
+static void context_test(void **state)
+{
+    BranchContext *first = branch_context_create();
+    BranchContext *second = branch_context_create();
+    int first_more = 1;
+    int second_more = 1;
+    runs = 0;
+    inner_runs = 0;
+    branch_custom_func_wrapper_named("context_outer", context_outer, first);
+    assert_int_equal(runs, 2);
+    assert_int_equal(inner_runs, 6);
+
+    inner_runs = 0;
+    while(first_more || second_more) {
+        if(first_more) {
+            first_more = branch_context_run_one(first, "context_first", context_inner, NULL);
+        }
+        if(second_more) {
+            second_more = branch_context_run_one(second, "context_second", context_inner, NULL);
+        }
+    }
+    assert_int_equal(inner_runs, 6);
+    branch_context_destroy(first);
+    branch_context_destroy(second);
+    (void)state;
+}
+
+/*
+ * Performance counters are attributed to the twigs in the tree export. Where perf_event_open is
+ * denied, every twig lists no counters, otherwise each twig that ran a combination has a count.
+ */
+static void perf_counters_test(void **state)
+{
+    char line[1024];
+    unsigned int twigs = 0, empty = 0, counted = 0;
+    FILE *file;
+    inner_runs = 0;
+    branch_set_perf_counters(1);
+    branch_set_tree_export(EXPORT_PREFIX, 0);
+    branch_custom_func_wrapper_named("perf", context_inner, NULL);
+    branch_set_tree_export(NULL, 0);
+    branch_set_perf_counters(0);
+    assert_int_equal(inner_runs, 3);
+
+    file = fopen(EXPORT_PREFIX "perf.json", "r");
+    assert_non_null(file);
+    while(fgets(line, sizeof(line), file) != NULL) {
+        const char *perf = line;
+        while((perf = strstr(perf, "\"perf\": {")) != NULL) {
+            const char *value = perf + strlen("\"perf\": {");
+            const char * const end = strchr(value, '}');
+            int count = 0;
+            assert_non_null(end);
+            twigs++;
+            empty += value == end;
+            while((value = strstr(value, "\": ")) != NULL && value < end) {
+                value += strlen("\": ");
+                count |= *value != '0';
+            }
+            counted += count;
+            perf = end;
+        }
+    }
+    fclose(file);
+    assert_true(twigs != 0);
+    if(empty != twigs) {
+        assert_int_equal(empty, 0);
+        assert_int_equal(counted, inner_runs);
+    }
+    remove(EXPORT_PREFIX "perf.json");
+    remove(EXPORT_PREFIX "perf.dot");
+    (void)state;
+}
+
+static void context_inner_failure(void *state)
+{
+    if(branch_start_count("inner", 2, NULL) == 1) {
+        fail();
+    }
+    branch_end_named("inner");
+    (void)state;
+}
+
+/* Context of context_nested_failure, the failure skips the end of the test so the group teardown frees it */
+static BranchContext *nested_failure_context;
+
+/* A failure in a nested context ends both explorations and reports both paths */
+static void context_nested_failure(void **state)
+{
+    if(nested_failure_context == NULL) {
+        nested_failure_context = branch_context_create();
+    }
+    branch_start_count("outer", 2, NULL);
+    branch_context_run(nested_failure_context, "context_inner_failure", context_inner_failure, NULL);
+    branch_end_named("outer");
+    (void)state;
+}
+
+static int fail_expected_teardown(void **state)
+{
+    branch_context_destroy(nested_failure_context);
+    nested_failure_context = NULL;
+    (void)state;
+    return 0;
+}
+
+/* Lanes 5 and 6 fail, the combination of their batch fails at the end of the batch */
+static void batch_lane_failure(void **state)
+{
+    BranchBatch batch;
+    unsigned int lane;
+    const unsigned int lanes = branch_start_batch(&batch, "crc", 8, 4);
+    for(lane = 0; lane < lanes; lane++) {
+        const unsigned int twig = branch_batch_twig(&batch, lane);
+        assert_lane_true(&batch, lane, twig != 5 && twig != 6);
+    }
+    branch_end_batch(&batch);
+    (void)state;
+}
+
+static BranchMutex lock_a = BRANCH_MUTEX_INITIALIZER;
+static BranchMutex lock_b = BRANCH_MUTEX_INITIALIZER;
+
+static void lock_order_thread(void *arg)
+{
+    BranchMutex * const first = arg != NULL ? &lock_a : &lock_b;
+    BranchMutex * const second = arg != NULL ? &lock_b : &lock_a;
+    branch_mutex_lock(first);
+    branch_mutex_lock(second);
+    branch_mutex_unlock(second);
+    branch_mutex_unlock(first);
+}
+
+/* Two threads taking two mutexes in opposite order deadlock when preempted between the locks */
+static void threads_deadlock(void **state)
+{
+    const BranchMutex unlocked = BRANCH_MUTEX_INITIALIZER;
+    lock_a = unlocked;
+    lock_b = unlocked;
+    branch_thread_create(lock_order_thread, &lock_a);
+    branch_thread_create(lock_order_thread, NULL);
+    branch_threads_run();
+    (void)state;
+}
+
 static void mistmatched_branch_start(void **state) {
     branch_start_count("aba", 2, NULL);
     (void)state;
@@ -374,6 +1967,36 @@ int main(void) {
         cmocka_unit_test_setup_teardown_twigs(varying_double_nested_branch_test_success, branch_test_success_setup, branch_test_success_teardown),
         cmocka_unit_test_setup_teardown_twigs(varying_sequential_nested_branch_test_success, branch_test_success_setup, branch_test_success_teardown),
         cmocka_unit_test_twigs(phy_change_test),
+        cmocka_unit_test(failure_history_order_test),
+        cmocka_unit_test(failure_history_wide_test),
+        cmocka_unit_test(failure_history_record_test),
+        cmocka_unit_test(incremental_cache_test),
+        cmocka_unit_test(incremental_dependency_test),
+        cmocka_unit_test(tree_export_test),
+        cmocka_unit_test(isolation_test),
+        cmocka_unit_test(isolation_failure_test),
+        cmocka_unit_test(streaming_test),
+        cmocka_unit_test(streaming_lazy_test),
+        cmocka_unit_test(registered_state_test),
+        cmocka_unit_test(registered_state_isolation_test),
+        cmocka_unit_test(fault_injection_test),
+        cmocka_unit_test(context_test),
+        cmocka_unit_test(prune_test),
+        cmocka_unit_test(exclusion_site_test),
+        cmocka_unit_test(monitor_test),
+        cmocka_unit_test(perf_counters_test),
+        cmocka_unit_test(range_test),
+        cmocka_unit_test(range_wide_step_test),
+        cmocka_unit_test(range_stats_test),
+        cmocka_unit_test(trace_test),
+        cmocka_unit_test(schema_test),
+        cmocka_unit_test(path_test),
+        cmocka_unit_test_teardown(serve_test, serve_teardown),
+        cmocka_unit_test(shard_test),
+        cmocka_unit_test(batch_test),
+        cmocka_unit_test(threads_test),
+        cmocka_unit_test(memo_test),
+        cmocka_unit_test(classes_test),
     };
 
     const struct CMUnitTest test_group_fail_expected[] = {
@@ -386,14 +2009,21 @@ int main(void) {
         cmocka_unit_test_setup_teardown_twigs(empty_test, branch_test_fail_setup, branch_test_fail_teardown),
         cmocka_unit_test_setup_twigs(empty_test, branch_test_fail_setup),
         cmocka_unit_test_teardown_twigs(empty_test, branch_test_fail_teardown),
+        cmocka_unit_test_twigs(context_nested_failure),
+        cmocka_unit_test_twigs(batch_lane_failure),
+        cmocka_unit_test_twigs(threads_deadlock),
+        cmocka_unit_test_twigs(range_single_value),
+        cmocka_unit_test_twigs(assume_in_site),
+        cmocka_unit_test_setup_teardown(schema_no_parts, schema_setup, schema_teardown),
     };
 
     int result = 0;
     result += cmocka_run_group_tests(test_group1, NULL, NULL);
 #ifdef TEST_FAILING
-    result += cmocka_run_group_tests(test_group_fail_expected, NULL, NULL);
+    result += cmocka_run_group_tests(test_group_fail_expected, NULL, fail_expected_teardown);
 #else
     (void) test_group_fail_expected;
+    (void) fail_expected_teardown;
 #endif
 
     return result;
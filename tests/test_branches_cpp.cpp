@@ -0,0 +1,127 @@
+/*
+ * Copyright 2017 Nordic Semiconductor <frederik.vestre@nordicsemi.no>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka_branches.hpp>
+#include <cstdio>
+#include <cstring>
+
+CMOCKA_BRANCH_ENUM(Phy, change_to_2mbps, change_to_coded, no_change)
+
+/* Combinations of the enum scope test, appended by the process that runs them */
+#define ENUM_SCOPE_FILE "test_branches_cpp_enum_scope.txt"
+
+static int runs;
+static int seen[3][2];
+
+static int phy_inner_nested(Phy phy)
+{
+    if(phy == Phy::no_change) {
+        /* Ending the scope on return */
+        return 0;
+    }
+    branch_scope_count(dle, "dle", 2, NULL);
+    return 1 + static_cast<int>(dle);
+}
+
+static void phy_inner(void *state)
+{
+    branch_enum(phy, Phy);
+    const int dle = phy_inner_nested(phy);
+    switch(phy) {
+        case Phy::change_to_2mbps:
+        case Phy::change_to_coded:
+            assert_true(dle == 1 || dle == 2);
+            break;
+        case Phy::no_change:
+            assert_int_equal(dle, 0);
+            break;
+    }
+    std::FILE * const file = std::fopen(ENUM_SCOPE_FILE, "a");
+    assert_non_null(file);
+    std::fprintf(file, "%d %d\n", static_cast<int>(phy.value()), dle != 0 ? dle - 1 : 0);
+    std::fclose(file);
+    (void)state;
+}
+
+/* Scopes end their branch points on every path out of the block, also in isolated children */
+static void enum_scope_test(void **state)
+{
+    unsigned int batch_size;
+    for(batch_size = 0; batch_size <= 2; batch_size += 2) {
+        BranchContextStatus status;
+        std::FILE *file;
+        int phy, dle;
+        runs = 0;
+        std::memset(seen, 0, sizeof(seen));
+        std::remove(ENUM_SCOPE_FILE);
+        branch_set_isolation(batch_size, 0);
+        branch_custom_func_wrapper_named("enum_scope", phy_inner, NULL);
+        branch_set_isolation(0, 0);
+        branch_context_status(NULL, &status);
+        assert_int_equal(status.combinations, 5);
+        assert_int_equal(status.failed_combinations, 0);
+
+        file = std::fopen(ENUM_SCOPE_FILE, "r");
+        assert_non_null(file);
+        while(std::fscanf(file, "%d %d", &phy, &dle) == 2) {
+            assert_in_range(phy, 0, 2);
+            assert_in_range(dle, 0, 1);
+            seen[phy][dle]++;
+            runs++;
+        }
+        std::fclose(file);
+        std::remove(ENUM_SCOPE_FILE);
+        assert_int_equal(runs, 5);
+        assert_int_equal(seen[0][0], 1);
+        assert_int_equal(seen[0][1], 1);
+        assert_int_equal(seen[1][0], 1);
+        assert_int_equal(seen[1][1], 1);
+        assert_int_equal(seen[2][0], 1);
+        assert_int_equal(seen[2][1], 0);
+    }
+    (void)state;
+}
+
+static void names_inner(void *state)
+{
+    branch_enum(phy, Phy);
+    const BranchSite *site = &phy_branch_site;
+    assert_int_equal(site->num_twigs, 3);
+    assert_string_equal(site->name, "phy");
+    assert_string_equal(site->twig_names[static_cast<int>(phy.value())],
+                        phy == Phy::change_to_2mbps ? "change_to_2mbps" :
+                        phy == Phy::change_to_coded ? "change_to_coded" : "no_change");
+    runs++;
+    (void)state;
+}
+
+/* The descriptor takes the count and names of the enumerators */
+static void enum_names_test(void **state)
+{
+    runs = 0;
+    branch_custom_func_wrapper_named("enum_names", names_inner, NULL);
+    assert_int_equal(runs, 3);
+    (void)state;
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(enum_scope_test),
+        cmocka_unit_test(enum_names_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
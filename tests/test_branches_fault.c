@@ -0,0 +1,128 @@
+/*
+ * Copyright 2017 Nordic Semiconductor <frederik.vestre@nordicsemi.no>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs with fopen wrapped by cmocka_branches_wrap (-Wl,--wrap=fopen) and, as
+ * test_branches_fault_preload, interposed by cmocka_branches_preload.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <cmocka_branches.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FAULT_FILE "test_branches_fault.txt"
+
+static int opened;
+static int failed;
+
+static int fopen_filter(const char *function, const void *caller, int *error, void *data)
+{
+    (void)caller;
+    (void)data;
+    *error = EACCES;
+    return strcmp(function, "fopen") == 0;
+}
+
+static void fopen_inner(void *state)
+{
+    FILE * const file = fopen(FAULT_FILE, "r");
+    if(file == NULL) {
+        assert_int_equal(errno, EACCES);
+        failed++;
+    } else {
+        fclose(file);
+        opened++;
+    }
+    (void)state;
+}
+
+/* Every call to a wrapped function is a branch point between its success and its failure */
+static void fopen_fault_test(void **state)
+{
+    BranchContextStatus status;
+    FILE *file = fopen(FAULT_FILE, "w");
+    assert_non_null(file);
+    fclose(file);
+
+    opened = 0;
+    failed = 0;
+    branch_set_fault_filter(fopen_filter, NULL);
+    branch_custom_func_wrapper_named("fopen_fault", fopen_inner, NULL);
+    branch_set_fault_filter(NULL, NULL);
+    branch_context_status(NULL, &status);
+    remove(FAULT_FILE);
+
+    assert_int_equal(status.combinations, 2);
+    assert_int_equal(opened, 1);
+    assert_int_equal(failed, 1);
+    (void)state;
+}
+
+#define FAULT_TRACE_FILE "test_branches_fault_trace.bin"
+
+static int fopen_write_filter(const char *function, const void *caller, int *error, void *data)
+{
+    (void)caller;
+    (void)data;
+    *error = EACCES;
+    return strcmp(function, "fopen") == 0 || strcmp(function, "write") == 0;
+}
+
+/* A traced branch point before the fopen call, its site is written to the trace when first taken */
+static void traced_fopen_inner(void *state)
+{
+    branch_start_count("traced", 2, NULL);
+    fopen_inner(state);
+    branch_end_named("traced");
+}
+
+/* The writes of the engine itself during a combination, like those of the trace, are not fault points */
+static void engine_write_test(void **state)
+{
+    BranchContextStatus status;
+    FILE *file = fopen(FAULT_FILE, "w");
+    assert_non_null(file);
+    fclose(file);
+
+    opened = 0;
+    failed = 0;
+    branch_set_trace_file(FAULT_TRACE_FILE);
+    branch_set_fault_filter(fopen_write_filter, NULL);
+    branch_custom_func_wrapper_named("engine_write", traced_fopen_inner, NULL);
+    branch_set_fault_filter(NULL, NULL);
+    branch_set_trace_file(NULL);
+    branch_context_status(NULL, &status);
+    remove(FAULT_FILE);
+    remove(FAULT_TRACE_FILE);
+
+    assert_int_equal(status.combinations, 4);
+    assert_int_equal(opened, 2);
+    assert_int_equal(failed, 2);
+    (void)state;
+}
+
+int main(void) {
+    const struct CMUnitTest test_group1[] = {
+        cmocka_unit_test(fopen_fault_test),
+        cmocka_unit_test(engine_write_test),
+    };
+
+    return cmocka_run_group_tests(test_group1, NULL, NULL);
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2017 Nordic Semiconductor <frederik.vestre@nordicsemi.no>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Use the unit test allocators */
+#define UNIT_TESTING 1
+#define TEST_FAILING 1
+/* Use the branch allocators for per combination heap accounting */
+#define CMOCKA_BRANCHES_HEAP_ACCOUNTING 1
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <cmocka_branches.h>
+#include <stdio.h>
+#include <string.h>
+
+#define EXPORT_PREFIX "test_branches_heap_"
+
+static void *leaked_buffer;
+static int allocations_done;
+
+static void heap_accounting_inner(void *state)
+{
+    static char const * const  buffer_names[] = {"small", "large", "leak", "none"};
+    void *buffer = NULL;
+    switch(branch_start_count("buffer size", 4, buffer_names)) {
+        case 0:
+            buffer = malloc(16);
+            break;
+        case 1:
+            buffer = malloc(64 * 1024);
+            break;
+        case 2:
+            leaked_buffer = malloc(32);
+            break;
+    }
+    branch_end_named("buffer size");
+    free(buffer);
+    (void)state;
+}
+
+/* Check the heap statistics exported for the twig with the given name */
+static void assert_twig_heap(const char *json, const char *name, const unsigned long peak, const unsigned long leaked)
+{
+    char twig[64];
+    char expected[64];
+    const char *found;
+    snprintf(twig, sizeof(twig), "\"name\": \"%s\"", name);
+    snprintf(expected, sizeof(expected), "\"heap_peak\": %lu, \"heap_leaked\": %lu", peak, leaked);
+    found = strstr(json, twig);
+    assert_non_null(found);
+    found = strstr(found, "\"heap_peak\"");
+    assert_non_null(found);
+    assert_memory_equal(found, expected, strlen(expected));
+}
+
+/* The peak and the leaked bytes of every combination are attributed to its twigs */
+static void heap_accounting_test(void **state)
+{
+    char json[4096];
+    size_t size;
+    FILE *file;
+    leaked_buffer = NULL;
+    branch_set_tree_export(EXPORT_PREFIX, 0);
+    branch_custom_func_wrapper_named("accounting", heap_accounting_inner, NULL);
+    branch_set_tree_export(NULL, 0);
+    assert_non_null(leaked_buffer);
+    free(leaked_buffer);
+
+    file = fopen(EXPORT_PREFIX "accounting.json", "r");
+    assert_non_null(file);
+    size = fread(json, 1, sizeof(json) - 1, file);
+    json[size] = '\0';
+    fclose(file);
+    assert_twig_heap(json, "small", 16, 0);
+    assert_twig_heap(json, "large", 64 * 1024, 0);
+    assert_twig_heap(json, "leak", 32, 32);
+    assert_twig_heap(json, "none", 0, 0);
+    remove(EXPORT_PREFIX "accounting.json");
+    remove(EXPORT_PREFIX "accounting.dot");
+    (void)state;
+}
+
+static void heap_calloc_overflow_test(void **state)
+{
+    assert_null(calloc(SIZE_MAX / 2, 4));
+    (void)state;
+}
+
+static void heap_limit_inner(void *state)
+{
+    const size_t large = *(const size_t*)state;
+    void *buffer = malloc(branch_start_count("buffer size", 2, NULL) == 0 ? 16 : large);
+    branch_end_named("buffer size");
+    free(buffer);
+    allocations_done++;
+}
+
+/* A limit holds for the exploration it is set for, the next one starts without a limit */
+static void heap_limit_reset_test(void **state)
+{
+    size_t large = 512;
+    allocations_done = 0;
+    branch_set_heap_limit(1024);
+    branch_custom_func_wrapper_named("limit", heap_limit_inner, &large);
+    large = 4096;
+    branch_custom_func_wrapper_named("no limit", heap_limit_inner, &large);
+    assert_int_equal(allocations_done, 4);
+    (void)state;
+}
+
+/* The allocation above the limit fails the test before it returns */
+static void heap_limit_exceeded(void **state)
+{
+    void *buffer;
+    branch_set_heap_limit(1024);
+    buffer = malloc(branch_start_count("buffer size", 2, NULL) == 0 ? 16 : 4096);
+    branch_end_named("buffer size");
+    free(buffer);
+    (void)state;
+}
+
+int main(void) {
+    const struct CMUnitTest test_group1[] = {
+        cmocka_unit_test(heap_accounting_test),
+        cmocka_unit_test(heap_calloc_overflow_test),
+        cmocka_unit_test(heap_limit_reset_test),
+    };
+
+    const struct CMUnitTest test_group_fail_expected[] = {
+        cmocka_unit_test_twigs(heap_limit_exceeded),
+    };
+
+    int result = 0;
+    result += cmocka_run_group_tests(test_group1, NULL, NULL);
+#ifdef TEST_FAILING
+    result += cmocka_run_group_tests(test_group_fail_expected, NULL, NULL);
+#else
+    (void) test_group_fail_expected;
+#endif
+
+    return result;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2017 Nordic semiconductor.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Send a request to a test binary serving explorations with branch_serve and print its output.
+ *
+ * Usage: cmocka_branches_client [-w seconds] <socket> RUN <test> [<path>...]
+ *        cmocka_branches_client [-w seconds] <socket> REPLAY <test> <path>
+ *        cmocka_branches_client [-w seconds] <socket> LIST|QUIT
+ *
+ * Waits up to the given seconds (default 10) for the server to listen. Exits with 0 if the request
+ * passed, 1 if tests failed and 2 if the server could not be reached, so it can be the command of
+ * a CTest test.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RESULT_PREFIX "CMOCKA_BRANCHES_RESULT "
+
+static int client_connect(const char *socket_path, const unsigned int wait_seconds)
+{
+    struct sockaddr_un address;
+    unsigned int attempts;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    for(attempts = 0; attempts <= wait_seconds * 10; attempts++) {
+        const struct timespec delay = {0, 100000000};
+        const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(connection < 0) {
+            return -1;
+        }
+        if(connect(connection, (const struct sockaddr*)&address, sizeof(address)) == 0) {
+            return connection;
+        }
+        close(connection);
+        if(errno != ENOENT && errno != ECONNREFUSED) {
+            return -1;
+        }
+        nanosleep(&delay, NULL);
+    }
+    return -1;
+}
+
+static int client_send(const int connection, const char *text)
+{
+    size_t written = 0;
+    const size_t length = strlen(text);
+    while(written < length) {
+        const ssize_t result = write(connection, text + written, length - written);
+        if(result <= 0) {
+            return 0;
+        }
+        written += (size_t)result;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int wait_seconds = 10;
+    int quit;
+    int connection;
+    int first = 1;
+    int failed = -1;
+    FILE *reply;
+    char line[4096];
+
+    if(argc >= 3 && strcmp(argv[1], "-w") == 0) {
+        wait_seconds = (unsigned int)strtoul(argv[2], NULL, 10);
+        argc -= 2;
+        argv += 2;
+    }
+    if(argc < 3) {
+        fprintf(stderr, "Usage: %s [-w seconds] <socket> RUN <test> [<path>...] | REPLAY <test> <path> | LIST | QUIT\n", argv[0]);
+        return 2;
+    }
+    quit = argc == 3 && strcmp(argv[2], "QUIT") == 0;
+    connection = client_connect(argv[1], wait_seconds);
+    if(connection < 0) {
+        fprintf(stderr, "Could not connect to %s: %s\n", argv[1], strerror(errno));
+        return 2;
+    }
+    for(argv += 2; *argv != NULL; argv++) {
+        if(!client_send(connection, first ? "" : " ") || !client_send(connection, *argv)) {
+            break;
+        }
+        first = 0;
+    }
+    if(!client_send(connection, "\n")) {
+        fprintf(stderr, "Could not send the request: %s\n", strerror(errno));
+        close(connection);
+        return 2;
+    }
+
+    reply = fdopen(connection, "r");
+    if(reply == NULL) {
+        close(connection);
+        return 2;
+    }
+    while(fgets(line, sizeof(line), reply) != NULL) {
+        if(strncmp(line, RESULT_PREFIX, strlen(RESULT_PREFIX)) == 0) {
+            failed = atoi(line + strlen(RESULT_PREFIX));
+        } else {
+            fputs(line, stdout);
+        }
+    }
+    fclose(reply);
+    if(failed < 0 && !quit) {
+        fprintf(stderr, "The server closed the connection without a result\n");
+        return 2;
+    }
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2017 Nordic semiconductor.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Watch the progress block of a running branch exploration, see branch_set_monitor_file.
+ *
+ * Usage: cmocka_branches_monitor [-1] [-i interval_ms] [-s stall_seconds] <file>
+ *
+ * Prints a line per interval until the exploration ends, -1 prints a single line. An exploration
+ * that has not finished a combination for stall_seconds (10 by default) is reported as stalled,
+ * and the exit status is 2 if it was stalled when it was last printed.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cmocka_branches_monitor.h"
+
+static uint64_t monitor_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/* Copy the test name, retrying while the engine changes it */
+static void monitor_test_name(const volatile BranchMonitorBlock *block, char *test_name)
+{
+    uint32_t sequence;
+    unsigned int i;
+    do {
+        sequence = block->sequence;
+        for(i = 0; i < BRANCH_MONITOR_TEST_NAME_SIZE; i++) {
+            test_name[i] = block->test_name[i];
+        }
+    } while((sequence & 1) != 0 || sequence != block->sequence);
+    test_name[BRANCH_MONITOR_TEST_NAME_SIZE - 1] = '\0';
+}
+
+/* Print the block on one line, returns 1 if the exploration is stalled */
+static int monitor_print(const volatile BranchMonitorBlock *block, const uint64_t stall_ns)
+{
+    char test_name[BRANCH_MONITOR_TEST_NAME_SIZE];
+    const int running = block->running != 0;
+    const uint64_t update_ns = block->update_ns;
+    const uint64_t now = monitor_time_ns();
+    const uint64_t idle_ns = now > update_ns ? now - update_ns : 0;
+    const int stalled = running && idle_ns >= stall_ns;
+    monitor_test_name(block, test_name);
+    printf("%s [pid %lu] %s: %llu combinations, %llu failed, %llu pruned, %llu/s, depth %lu, %llu nodes, path %016llx, last update %.1f s ago%s\n",
+           test_name[0] != '\0' ? test_name : "<unnamed>", (unsigned long)block->pid,
+           running ? "running" : "finished",
+           (unsigned long long)block->combinations, (unsigned long long)block->failures,
+           (unsigned long long)block->pruned, (unsigned long long)block->combinations_per_second,
+           (unsigned long)block->nesting_depth, (unsigned long long)block->nodes,
+           (unsigned long long)block->path_id, (double)idle_ns / 1e9,
+           stalled ? ", STALLED" : "");
+    fflush(stdout);
+    return stalled;
+}
+
+static void monitor_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-1] [-i interval_ms] [-s stall_seconds] <file>\n", program);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    unsigned long interval_ms = 1000;
+    unsigned long stall_seconds = 10;
+    int once = 0;
+    int stalled;
+    int fd;
+    int i;
+    void *mapping;
+    const volatile BranchMonitorBlock *block;
+
+    for(i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-1") == 0) {
+            once = 1;
+        } else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            interval_ms = strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            stall_seconds = strtoul(argv[++i], NULL, 10);
+        } else if(argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            monitor_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(path == NULL) {
+        monitor_usage(argv[0]);
+        return 1;
+    }
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return 1;
+    }
+    mapping = mmap(NULL, sizeof(BranchMonitorBlock), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s\n", path);
+        return 1;
+    }
+    block = (const volatile BranchMonitorBlock*)mapping;
+    if(block->magic != BRANCH_MONITOR_MAGIC || block->version != BRANCH_MONITOR_VERSION) {
+        fprintf(stderr, "%s is not a branch progress block of version %d\n", path, BRANCH_MONITOR_VERSION);
+        munmap(mapping, sizeof(BranchMonitorBlock));
+        return 1;
+    }
+
+    for(;;) {
+        stalled = monitor_print(block, (uint64_t)stall_seconds * 1000000000ULL);
+        if(once || !block->running) {
+            break;
+        }
+        usleep((useconds_t)(interval_ms * 1000));
+    }
+    munmap(mapping, sizeof(BranchMonitorBlock));
+    return stalled ? 2 : 0;
+}
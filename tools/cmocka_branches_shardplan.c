@@ -0,0 +1,185 @@
+/*
+ * Copyright 2017 Nordic semiconductor.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Balance the subtrees recorded in timing files written with branch_set_timing_file over shards.
+ *
+ * Usage: cmocka_branches_shardplan <num_shards> <plan> <timings>...
+ *
+ * The subtrees of all tests are assigned longest first to the shard with the least time so far,
+ * and the plan is written for branch_set_shard or CMOCKA_BRANCHES_SHARD_PLAN. A subtree found in
+ * several timing files takes the duration of the last one. The estimated time of every shard is
+ * printed. Tests and subtrees without timings are left out of the plan, so the first shard explores
+ * them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Fields of a timing file line: test, path, time in ns, combinations, name, file and line */
+#define TIMING_FIELDS 7
+
+typedef struct Subtree {
+    char *test;
+    char *path;
+    unsigned long long time_ns;
+    unsigned long combinations;
+    unsigned int shard;
+} Subtree;
+
+typedef struct Shard {
+    unsigned long long time_ns;
+    unsigned long combinations;
+    unsigned int subtrees;
+} Shard;
+
+static char *plan_strdup(const char *str)
+{
+    const size_t size = strlen(str) + 1;
+    char * const copy = (char*)malloc(size);
+    memcpy(copy, str, size);
+    return copy;
+}
+
+static unsigned int plan_split_fields(char *line, char **fields, const unsigned int max_fields)
+{
+    unsigned int num_fields = 0;
+    while(num_fields < max_fields) {
+        char * const separator = strchr(line, '\t');
+        fields[num_fields++] = line;
+        if(separator == NULL) {
+            break;
+        }
+        *separator = '\0';
+        line = separator + 1;
+    }
+    return num_fields;
+}
+
+/* Read the subtrees of a timing file, returns 0 if it can't be read */
+static int plan_read_timings(const char *path, Subtree **subtrees, unsigned int *num_subtrees)
+{
+    char line[1024];
+    FILE * const timing_file = fopen(path, "r");
+    if(timing_file == NULL) {
+        return 0;
+    }
+    while(fgets(line, sizeof(line), timing_file) != NULL) {
+        char *fields[TIMING_FIELDS];
+        Subtree *subtree = NULL;
+        unsigned int i;
+        line[strcspn(line, "\r\n")] = '\0';
+        if(plan_split_fields(line, fields, TIMING_FIELDS) != TIMING_FIELDS) {
+            continue;
+        }
+        for(i = 0; i < *num_subtrees; i++) {
+            if(strcmp((*subtrees)[i].test, fields[0]) == 0 && strcmp((*subtrees)[i].path, fields[1]) == 0) {
+                subtree = &(*subtrees)[i];
+            }
+        }
+        if(subtree == NULL) {
+            *subtrees = (Subtree*)realloc(*subtrees, (*num_subtrees + 1) * sizeof(Subtree));
+            subtree = &(*subtrees)[(*num_subtrees)++];
+            subtree->test = plan_strdup(fields[0]);
+            subtree->path = plan_strdup(fields[1]);
+        }
+        subtree->time_ns = strtoull(fields[2], NULL, 10);
+        subtree->combinations = strtoul(fields[3], NULL, 10);
+        subtree->shard = 0;
+    }
+    fclose(timing_file);
+    return 1;
+}
+
+/* Longest first, ties in the order of test and path so the plan is reproducible */
+static int plan_compare_subtrees(const void *a, const void *b)
+{
+    const Subtree * const first = (const Subtree*)a;
+    const Subtree * const second = (const Subtree*)b;
+    const int by_test = strcmp(first->test, second->test);
+    if(first->time_ns != second->time_ns) {
+        return first->time_ns > second->time_ns ? -1 : 1;
+    }
+    return by_test != 0 ? by_test : strcmp(first->path, second->path);
+}
+
+int main(int argc, char **argv)
+{
+    Subtree *subtrees = NULL;
+    unsigned int num_subtrees = 0;
+    Shard *shards;
+    unsigned long num_shards;
+    FILE *plan;
+    unsigned int i;
+    int status = 0;
+
+    if(argc < 4) {
+        fprintf(stderr, "Usage: %s <num_shards> <plan> <timings>...\n", argv[0]);
+        return 1;
+    }
+    num_shards = strtoul(argv[1], NULL, 10);
+    if(num_shards == 0 || num_shards > 65536) {
+        fprintf(stderr, "Invalid number of shards %s\n", argv[1]);
+        return 1;
+    }
+    for(i = 3; i < (unsigned int)argc; i++) {
+        if(!plan_read_timings(argv[i], &subtrees, &num_subtrees)) {
+            fprintf(stderr, "Could not read %s, its subtrees are left out\n", argv[i]);
+        }
+    }
+
+    shards = (Shard*)calloc(num_shards, sizeof(Shard));
+    qsort(subtrees, num_subtrees, sizeof(Subtree), plan_compare_subtrees);
+    for(i = 0; i < num_subtrees; i++) {
+        unsigned int least = 0;
+        unsigned int shard;
+        for(shard = 1; shard < num_shards; shard++) {
+            if(shards[shard].time_ns < shards[least].time_ns) {
+                least = shard;
+            }
+        }
+        subtrees[i].shard = least;
+        shards[least].time_ns += subtrees[i].time_ns;
+        shards[least].combinations += subtrees[i].combinations;
+        shards[least].subtrees++;
+    }
+
+    plan = fopen(argv[2], "w");
+    if(plan == NULL) {
+        fprintf(stderr, "Could not create %s\n", argv[2]);
+        status = 1;
+    } else {
+        fprintf(plan, "# Shard plan for %lu shards\n", num_shards);
+        for(i = 0; i < num_subtrees; i++) {
+            fprintf(plan, "%s\t%u\t%s\n", subtrees[i].test, subtrees[i].shard, subtrees[i].path);
+        }
+        fclose(plan);
+        for(i = 0; i < num_shards; i++) {
+            printf("Shard %u: %llu.%03llu ms, %lu combinations in %u subtrees\n", i,
+                   shards[i].time_ns / 1000000, shards[i].time_ns / 1000 % 1000,
+                   shards[i].combinations, shards[i].subtrees);
+        }
+    }
+
+    for(i = 0; i < num_subtrees; i++) {
+        free(subtrees[i].test);
+        free(subtrees[i].path);
+    }
+    free(subtrees);
+    free(shards);
+    return status;
+}
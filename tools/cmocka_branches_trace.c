@@ -0,0 +1,297 @@
+/*
+ * Copyright 2017 Nordic semiconductor.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Convert an event trace written by branch_set_trace_file to the Chrome trace event JSON format,
+ * which chrome://tracing and the Perfetto UI open.
+ *
+ * Usage: cmocka_branches_trace <trace> [output.json]
+ *
+ * Every combination is a slice of its thread, with a nested slice for every branch point named
+ * after the branch and the twig taken. Failures and restarts are instant events. Slices of branch
+ * points that a failure left open end with their combination.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmocka_branches_trace.h"
+
+typedef struct TraceSite {
+    uint32_t pid;
+    uint32_t id;
+    int line;
+    unsigned int num_twigs;
+    unsigned int num_names;
+    char *strings;              /* Name, file, function and twig names */
+    const char *name;
+    const char *file;
+    const char *function_name;
+    const char **twig_names;
+} TraceSite;
+
+typedef struct TraceThread {
+    uint32_t pid;
+    uint32_t thread;
+    unsigned long combinations;
+    unsigned int open_branches;     /* Branch slices started in the current combination and not ended */
+    int in_combination;
+} TraceThread;
+
+typedef struct Trace {
+    TraceSite *sites;
+    unsigned int num_sites;
+    TraceThread *threads;
+    unsigned int num_threads;
+    FILE *output;
+    int events;
+} Trace;
+
+static const char * const trace_outcomes[] = {"passed", "failed", "pruned"};
+
+static void trace_print_string(FILE *output, const char *string)
+{
+    fputc('"', output);
+    for(; *string != '\0'; string++) {
+        const unsigned char c = (unsigned char)*string;
+        if(c == '"' || c == '\\') {
+            fprintf(output, "\\%c", c);
+        } else if(c < 0x20) {
+            fprintf(output, "\\u%04x", c);
+        } else {
+            fputc(c, output);
+        }
+    }
+    fputc('"', output);
+}
+
+static const TraceSite *trace_site(const Trace *trace, const uint32_t pid, const uint32_t id)
+{
+    unsigned int i;
+    for(i = trace->num_sites; i > 0; i--) {
+        if(trace->sites[i - 1].pid == pid && trace->sites[i - 1].id == id) {
+            return &trace->sites[i - 1];
+        }
+    }
+    return NULL;
+}
+
+static TraceThread *trace_thread(Trace *trace, const uint32_t pid, const uint32_t thread)
+{
+    unsigned int i;
+    for(i = 0; i < trace->num_threads; i++) {
+        if(trace->threads[i].pid == pid && trace->threads[i].thread == thread) {
+            return &trace->threads[i];
+        }
+    }
+    trace->threads = (TraceThread*)realloc(trace->threads, (trace->num_threads + 1) * sizeof(TraceThread));
+    memset(&trace->threads[trace->num_threads], 0, sizeof(TraceThread));
+    trace->threads[trace->num_threads].pid = pid;
+    trace->threads[trace->num_threads].thread = thread;
+    return &trace->threads[trace->num_threads++];
+}
+
+/* Start an event of the thread, the caller adds its name and arguments and closes it */
+static void trace_event(Trace *trace, const TraceThread *thread, const char *phase, const uint64_t time_ns)
+{
+    fprintf(trace->output, "%s\n{\"ph\": \"%s\", \"pid\": %lu, \"tid\": %lu, \"ts\": %llu.%03llu",
+            trace->events++ == 0 ? "" : ",", phase, (unsigned long)thread->pid, (unsigned long)thread->thread,
+            (unsigned long long)(time_ns / 1000), (unsigned long long)(time_ns % 1000));
+}
+
+static void trace_end_branches(Trace *trace, TraceThread *thread, const uint64_t time_ns)
+{
+    for(; thread->open_branches > 0; thread->open_branches--) {
+        trace_event(trace, thread, "E", time_ns);
+        fprintf(trace->output, "}");
+    }
+}
+
+static void trace_convert_record(Trace *trace, TraceThread *thread, const BranchTraceRecord *record)
+{
+    FILE * const output = trace->output;
+    switch(record->type) {
+        case BRANCH_TRACE_COMBINATION_BEGIN:
+            thread->in_combination = 1;
+            thread->open_branches = 0;
+            trace_event(trace, thread, "B", record->time_ns);
+            fprintf(output, ", \"name\": \"combination %lu\", \"cat\": \"combination\"}", ++thread->combinations);
+        break;
+        case BRANCH_TRACE_COMBINATION_END:
+            if(!thread->in_combination) {
+                break;
+            }
+            trace_end_branches(trace, thread, record->time_ns);
+            trace_event(trace, thread, "E", record->time_ns);
+            fprintf(output, ", \"args\": {\"outcome\": \"%s\"}}",
+                    record->value < sizeof(trace_outcomes) / sizeof(trace_outcomes[0]) ? trace_outcomes[record->value] : "unknown");
+            thread->in_combination = 0;
+        break;
+        case BRANCH_TRACE_BRANCH_START:
+        {
+            const TraceSite * const site = trace_site(trace, thread->pid, record->site);
+            char name[256];
+            if(site == NULL) {
+                snprintf(name, sizeof(name), "site %lu: %lu", (unsigned long)record->site, (unsigned long)record->value);
+            } else if(record->value < site->num_names) {
+                snprintf(name, sizeof(name), "%s: %s", site->name[0] != '\0' ? site->name : site->function_name,
+                         site->twig_names[record->value]);
+            } else {
+                snprintf(name, sizeof(name), "%s: %lu", site->name[0] != '\0' ? site->name : site->function_name,
+                         (unsigned long)record->value);
+            }
+            thread->open_branches++;
+            trace_event(trace, thread, "B", record->time_ns);
+            fprintf(output, ", \"name\": ");
+            trace_print_string(output, name);
+            fprintf(output, ", \"cat\": \"branch\", \"args\": {\"twig\": %lu, \"depth\": %lu",
+                    (unsigned long)record->value, (unsigned long)record->depth);
+            if(site != NULL) {
+                fprintf(output, ", \"file\": ");
+                trace_print_string(output, site->file);
+                fprintf(output, ", \"line\": %d, \"function\": ", site->line);
+                trace_print_string(output, site->function_name);
+            }
+            fprintf(output, "}}");
+        }
+        break;
+        case BRANCH_TRACE_BRANCH_END:
+            if(thread->open_branches == 0) {
+                break;
+            }
+            thread->open_branches--;
+            trace_event(trace, thread, "E", record->time_ns);
+            fprintf(output, "}");
+        break;
+        case BRANCH_TRACE_FAILURE:
+            trace_event(trace, thread, "i", record->time_ns);
+            fprintf(output, ", \"name\": \"failure\", \"cat\": \"combination\", \"s\": \"t\", \"args\": {\"depth\": %lu}}",
+                    (unsigned long)record->depth);
+        break;
+        case BRANCH_TRACE_RESTART:
+            trace_event(trace, thread, "i", record->time_ns);
+            fprintf(output, ", \"name\": \"%s\", \"cat\": \"restart\", \"s\": \"t\"}", record->value ? "restart" : "complete");
+        break;
+        default:
+        break;
+    }
+}
+
+/* Read the site described by a chunk, returns 0 if it is malformed */
+static int trace_add_site(Trace *trace, const BranchTraceChunk *chunk, char *data)
+{
+    const BranchTraceSite *header = (const BranchTraceSite*)data;
+    char *strings = data + sizeof(BranchTraceSite);
+    const char * const end = data + chunk->size;
+    TraceSite *site;
+    unsigned int i;
+    if(chunk->size < sizeof(BranchTraceSite) || end[-1] != '\0') {
+        return 0;
+    }
+    trace->sites = (TraceSite*)realloc(trace->sites, (trace->num_sites + 1) * sizeof(TraceSite));
+    site = &trace->sites[trace->num_sites++];
+    site->pid = chunk->pid;
+    site->id = header->id;
+    site->line = header->line;
+    site->num_twigs = header->num_twigs;
+    site->num_names = header->num_names;
+    site->strings = data;
+    site->twig_names = (const char**)calloc(header->num_names + 1, sizeof(const char*));
+    site->name = strings;
+    strings += strlen(strings) + 1;
+    site->file = strings < end ? strings : "";
+    strings += strings < end ? strlen(strings) + 1 : 0;
+    site->function_name = strings < end ? strings : "";
+    strings += strings < end ? strlen(strings) + 1 : 0;
+    for(i = 0; i < header->num_names; i++) {
+        site->twig_names[i] = strings < end ? strings : "";
+        strings += strings < end ? strlen(strings) + 1 : 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    Trace trace;
+    BranchTraceChunk chunk;
+    FILE *input;
+    unsigned int i;
+    int status = 0;
+
+    if(argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <trace> [output.json]\n", argv[0]);
+        return 1;
+    }
+    input = fopen(argv[1], "rb");
+    if(input == NULL) {
+        fprintf(stderr, "Could not open %s\n", argv[1]);
+        return 1;
+    }
+    memset(&trace, 0, sizeof(trace));
+    trace.output = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if(trace.output == NULL) {
+        fprintf(stderr, "Could not create %s\n", argv[2]);
+        fclose(input);
+        return 1;
+    }
+
+    fprintf(trace.output, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    while(fread(&chunk, sizeof(chunk), 1, input) == 1) {
+        char *data;
+        if(chunk.magic != BRANCH_TRACE_MAGIC || chunk.version != BRANCH_TRACE_VERSION) {
+            fprintf(stderr, "%s is not a branch trace of version %d\n", argv[1], BRANCH_TRACE_VERSION);
+            status = 1;
+            break;
+        }
+        data = (char*)malloc(chunk.size != 0 ? chunk.size : 1);
+        if(fread(data, 1, chunk.size, input) != chunk.size) {
+            fprintf(stderr, "%s ends within a chunk\n", argv[1]);
+            free(data);
+            status = 1;
+            break;
+        }
+        if(chunk.kind == BRANCH_TRACE_CHUNK_SITE) {
+            /* Sites are kept, their strings are referenced until the end */
+            if(!trace_add_site(&trace, &chunk, data)) {
+                free(data);
+            }
+        } else {
+            if(chunk.kind == BRANCH_TRACE_CHUNK_RECORDS) {
+                TraceThread * const thread = trace_thread(&trace, chunk.pid, chunk.thread);
+                const BranchTraceRecord * const records = (const BranchTraceRecord*)data;
+                const unsigned int num_records = chunk.size / sizeof(BranchTraceRecord);
+                for(i = 0; i < num_records; i++) {
+                    trace_convert_record(&trace, thread, &records[i]);
+                }
+            }
+            free(data);
+        }
+    }
+    fprintf(trace.output, "\n]}\n");
+
+    if(trace.output != stdout) {
+        fclose(trace.output);
+    }
+    fclose(input);
+    for(i = 0; i < trace.num_sites; i++) {
+        free(trace.sites[i].strings);
+        free((void*)trace.sites[i].twig_names);
+    }
+    free(trace.sites);
+    free(trace.threads);
+    return status;
+}